@@ -17,6 +17,7 @@
 #ifndef __LIBJSON_H__
 #define __LIBJSON_H__
 
+#include <stdbool.h>
 #include <stdio.h>
 
 /* String conversions */
@@ -31,23 +32,50 @@ enum json_value_type {
 	JSON_VAL_ARRAY,
 };
 
+/**
+ * Literal types.
+ *
+ * Literals are typed once, as they are parsed. Quoted literals are always
+ * strings, as are unquoted names other than true, false and null.
+ */
+enum json_literal_type {
+	JSON_LIT_STRING,
+	JSON_LIT_INT,         // integer that fits in int64_t
+	JSON_LIT_UINT,        // integer that only fits in uint64_t
+	JSON_LIT_DOUBLE,      // any other number
+	JSON_LIT_BOOL,
+	JSON_LIT_NULL,
+};
+
 /**
  * Value.
+ *
+ * The text of a literal is always available in jval_lit, whatever its type.
  */
 struct json_value {
 	enum json_value_type   jval_type;
+	enum json_literal_type jval_lit_type;   // literals only
 	union {
 	struct json_object   * jval_object;
 	struct json_array    * jval_array;
 	char const           * jval_lit;
 	};
+	union {
+	int64_t                jval_int;        // JSON_LIT_INT
+	uint64_t               jval_uint;       // JSON_LIT_UINT
+	double                 jval_double;     // JSON_LIT_DOUBLE
+	bool                   jval_bool;       // JSON_LIT_BOOL
+	};
 };
 
 /**
  * Array.
+ *
+ * Edited arrays may have room for more values than they hold.
  */
 struct json_array {
 	int unsigned           jarr_length;
+	int unsigned           jarr_size;       // room for values
 	struct json_value      jarr_values[];
 };
 
@@ -56,14 +84,29 @@ struct json_array {
  */
 struct json_tuple {
 	char const           * jtup_key;
+	int unsigned           jtup_keylen;     // length of key
+	uint32_t               jtup_hash;       // hash of case-folded key
 	struct json_value      jtup_val;
 };
 
 /**
  * Object.
+ *
+ * Wide objects come with an open-addressing index of their keys: a table of
+ * jobj_mask + 1 slots, each holding a tuple number plus one, or zero.
+ *
+ * Objects parsed with JSON_PARSE_SORTKEYS have their tuples sorted by key
+ * instead, and jobj_order gives the position in jobj_tuples of each tuple
+ * in document order.
+ *
+ * Edited objects may have room for more tuples than they hold.
  */
 struct json_object {
 	int unsigned           jobj_length;
+	int unsigned           jobj_size;       // room for tuples
+	int unsigned           jobj_mask;
+	uint32_t             * jobj_slots;      // key index, or NULL
+	uint32_t             * jobj_order;      // if sorted, or NULL
 	struct json_tuple      jobj_tuples[];
 };
 
@@ -71,6 +114,52 @@ struct json_object {
  */
 typedef struct json_doc json_document_t;
 
+/* Compiled path.
+ */
+typedef struct json_path json_path_t;
+
+/* String intern table.
+ */
+typedef struct json_intern json_intern_t;
+
+/**
+ * Parse flags.
+ */
+enum json_parse_flags {
+	JSON_PARSE_INSITU     = 0x0001,  // store literals in the input buffer
+	JSON_PARSE_HUGEPAGES  = 0x0002,  // back large arena chunks by huge pages
+	JSON_PARSE_SORTKEYS   = 0x0004,  // sort object keys, reject duplicates
+};
+
+/**
+ * Memory allocator.
+ *
+ * The functions behave like malloc(), realloc() and free(), and are passed
+ * the allocator context. They need not set errno on failure.
+ *
+ * Given in the parse options, the allocator provides all the memory of the
+ * documents, parsers and readers created with them, and must outlive them.
+ * Only arena chunks backed by huge pages (JSON_PARSE_HUGEPAGES) bypass it.
+ * Intern tables, compiled paths and compiled schemas take one through their
+ * _alloc constructors.
+ */
+struct json_allocator {
+	void * (* jalloc_malloc)(void * ctx, size_t size);
+	void * (* jalloc_realloc)(void * ctx, void * p, size_t size);
+	void   (* jalloc_free)(void * ctx, void * p);
+	void                 * jalloc_ctx;
+};
+
+/**
+ * Parse options.
+ */
+struct json_parse_options {
+	unsigned               jopt_flags;      // JSON_PARSE_xxx
+	unsigned               jopt_max_depth;  // nesting limit, 0 for default
+	json_intern_t        * jopt_intern;     // shared intern table, or NULL
+	struct json_allocator const * jopt_allocator; // or NULL for malloc()
+};
+
 // :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
 //                               Document                                   //
 // :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
@@ -80,31 +169,596 @@ typedef struct json_doc json_document_t;
  */
 extern int json_parse(FILE * f, json_document_t ** newdoc);
 
+/**
+ * Parse JSON document with the given options.
+ *
+ * Documents nested deeper than the options allow (512 levels by default) are
+ * rejected with EOVERFLOW. JSON_PARSE_INSITU has no effect on streams. With
+ * JSON_PARSE_SORTKEYS, objects with keys that differ only in ASCII case are
+ * rejected with EINVAL.
+ */
+extern int json_parse_opts(
+	FILE * f,
+	struct json_parse_options const * opts,
+	json_document_t ** newdoc
+	);
+
+/**
+ * Create a string intern table.
+ *
+ * Documents parsed with an intern table share a single copy of their keys
+ * and short string literals, which live in the table rather than in the
+ * documents. The table must outlive all such documents, and may only be
+ * used by one parser at a time. It holds at most max strings (65536 if
+ * zero); once it is full, further strings are no longer interned.
+ */
+extern int json_intern_new(unsigned max, json_intern_t ** newintern);
+
+/**
+ * Same as json_intern_new(), with the table, its slots and its strings
+ * allocated by the given allocator rather than malloc(). The allocator must
+ * outlive the table.
+ */
+extern int json_intern_new_alloc(
+	unsigned max,
+	struct json_allocator const * alloc,
+	json_intern_t ** newintern
+	);
+
+/**
+ * Free string intern table.
+ */
+extern void json_intern_free(json_intern_t * intern);
+
+/**
+ * Intern a string.
+ *
+ * Returns ENOSPC if the string is not in the table and the table is full.
+ */
+extern int json_intern_string(
+	json_intern_t * intern,
+	char const * s,
+	char const ** out
+	);
+
 /**
  * Parse JSON document from string.
+ *
+ * The string is parsed in place; it is not copied.
  */
 extern int json_parse_string(char const * s, json_document_t ** newdoc);
 
 /**
  * Parse JSON document from buffer.
+ *
+ * The buffer is read directly, without going through a stdio stream.
  */
 extern int json_parse_data(void * buf, size_t size, json_document_t ** newdoc);
 
+/**
+ * Parse JSON document from buffer with the given options.
+ *
+ * With JSON_PARSE_INSITU, literals and keys are decoded and NUL-terminated
+ * inside the buffer itself, which must then stay alive and untouched for as
+ * long as the document is in use. The buffer contents are unspecified after
+ * a failed parse.
+ */
+extern int json_parse_data_opts(
+	void * buf,
+	size_t size,
+	struct json_parse_options const * opts,
+	json_document_t ** newdoc
+	);
+
+/**
+ * Parse events.
+ *
+ * Callbacks may be NULL. Literals and keys passed to them only live until
+ * the callback returns. A callback returning non-zero stops the parse, which
+ * returns the same value.
+ */
+struct json_parse_events {
+	int (*jev_object_begin)(void * arg);
+	int (*jev_object_end)(void * arg);
+	int (*jev_array_begin)(void * arg);
+	int (*jev_array_end)(void * arg);
+	int (*jev_key)(void * arg, char const * key, size_t len);
+	int (*jev_value)(void * arg, struct json_value const * val);
+};
+
+/**
+ * Parse JSON document into a sequence of events, without building it.
+ *
+ * No memory is allocated for the document itself; scratch space only depends
+ * on the nesting depth and the longest literal. JSON_PARSE_SORTKEYS has no
+ * effect, and neither does JSON_PARSE_INSITU on streams.
+ */
+extern int json_parse_events(
+	FILE * f,
+	struct json_parse_options const * opts,
+	struct json_parse_events const * events,
+	void * arg
+	);
+
+/**
+ * Parse JSON document from buffer into a sequence of events.
+ */
+extern int json_parse_events_data(
+	void * buf,
+	size_t size,
+	struct json_parse_options const * opts,
+	struct json_parse_events const * events,
+	void * arg
+	);
+
 /**
  * Free JSON document.
  */
 extern void json_free(json_document_t * doc);
 
+/**
+ * Create an empty document, to parse into.
+ *
+ * A document parsed into again and again keeps the memory of each parse for
+ * the next ones, so that parsing no longer allocates memory once warm. The
+ * options are those of json_parse_opts(). The root object of an empty
+ * document is NULL.
+ */
+extern int json_doc_new(
+	struct json_parse_options const * opts,
+	json_document_t ** newdoc
+	);
+
+/**
+ * Parse JSON document into a document, replacing its contents.
+ *
+ * Any document may be parsed into, whatever it was created by. It is left
+ * empty on failure.
+ */
+extern int json_doc_parse(json_document_t * doc, FILE * f);
+
+/**
+ * Parse JSON document from buffer into a document, replacing its contents.
+ */
+extern int json_doc_parse_data(json_document_t * doc, void * buf, size_t size);
+
+/**
+ * Empty document, keeping its memory for the next parse.
+ */
+extern void json_doc_reset(json_document_t * doc);
+
+/**
+ * Give the memory a document does not use back to the system.
+ *
+ * All of it goes if the document is empty.
+ */
+extern void json_doc_trim(json_document_t * doc);
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                             Push parser                                  //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/* Push parser.
+ */
+typedef struct json_parser json_parser_t;
+
+/**
+ * Create a parser fed with chunks of input as they arrive.
+ *
+ * The options are those of json_parse_opts(), except for JSON_PARSE_INSITU
+ * which has no effect.
+ */
+extern int json_parser_new(
+	struct json_parse_options const * opts,
+	json_parser_t ** newparser
+	);
+
+/**
+ * Free parser, and the document being built if it was not handed out.
+ */
+extern void json_parser_free(json_parser_t * parser);
+
+/**
+ * Parse the next chunk of input.
+ *
+ * Chunks may split the document anywhere, including inside tokens. They
+ * are not used after the call returns. Errors are final: the parser keeps
+ * returning the same one.
+ */
+extern int json_parser_feed(
+	json_parser_t * parser,
+	void const * chunk,
+	size_t len
+	);
+
+/**
+ * Mark the end of input, and hand out the document.
+ *
+ * The document must be freed with json_free(), and outlives the parser.
+ */
+extern int json_parser_finish(
+	json_parser_t * parser,
+	json_document_t ** newdoc
+	);
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                                Reader                                    //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/* Pull reader.
+ */
+typedef struct json_reader json_reader_t;
+
+/**
+ * Reader event types.
+ */
+enum json_read_type {
+	JSON_READ_END,           // end of document
+	JSON_READ_OBJECT_BEGIN,
+	JSON_READ_OBJECT_END,
+	JSON_READ_ARRAY_BEGIN,
+	JSON_READ_ARRAY_END,
+	JSON_READ_KEY,
+	JSON_READ_VALUE,
+};
+
+/**
+ * Reader event.
+ *
+ * Keys and literals only live until the next call on the reader.
+ */
+struct json_read {
+	enum json_read_type    jrd_type;
+	char const           * jrd_key;       // JSON_READ_KEY
+	size_t                 jrd_keylen;
+	struct json_value      jrd_val;       // JSON_READ_VALUE
+};
+
+/**
+ * Create a reader of a JSON document from a stream.
+ *
+ * The options are those of json_parse_opts(), except for
+ * JSON_PARSE_SORTKEYS which has no effect.
+ */
+extern int json_reader_new(
+	FILE * f,
+	struct json_parse_options const * opts,
+	json_reader_t ** newreader
+	);
+
+/**
+ * Create a reader of a JSON document from a buffer.
+ */
+extern int json_reader_new_data(
+	void * buf,
+	size_t size,
+	struct json_parse_options const * opts,
+	json_reader_t ** newreader
+	);
+
+/**
+ * Free reader.
+ */
+extern void json_reader_free(json_reader_t * reader);
+
+/**
+ * Read the next event of the document.
+ *
+ * Once the document is over, JSON_READ_END is returned. Errors are final:
+ * the reader keeps returning the same one.
+ */
+extern int json_reader_next(json_reader_t * reader, struct json_read * ev);
+
+/**
+ * Skip the next value, whole.
+ *
+ * Where a key comes next, the key is skipped along with its value. Returns
+ * ENOENT at the end of a container, which is left for json_reader_next().
+ * Skipped containers are not stored or decoded; they are only checked for
+ * balanced brackets and strings.
+ */
+extern int json_reader_skip(json_reader_t * reader);
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                               Records                                    //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/* Record reader.
+ */
+typedef struct json_records json_records_t;
+
+/**
+ * Create a reader of a sequence of JSON documents from a stream.
+ *
+ * Documents may be separated by newlines, as in NDJSON and JSON Lines, by
+ * any other whitespace, or not at all. The options are those of
+ * json_parse_opts().
+ */
+extern int json_records_new(
+	FILE * f,
+	struct json_parse_options const * opts,
+	json_records_t ** newrecords
+	);
+
+/**
+ * Create a reader of a sequence of JSON documents from a buffer.
+ */
+extern int json_records_new_data(
+	void * buf,
+	size_t size,
+	struct json_parse_options const * opts,
+	json_records_t ** newrecords
+	);
+
+/**
+ * Free record reader.
+ */
+extern void json_records_free(json_records_t * records);
+
+/**
+ * Parse the next document.
+ *
+ * The document belongs to the reader and must not be freed. It only lives
+ * until the next call on the reader, which reuses its memory. Once the input
+ * is over, the document is NULL. Errors are final: the reader keeps
+ * returning the same one.
+ */
+extern int json_records_next(
+	json_records_t * records,
+	json_document_t const ** record
+	);
+
+/**
+ * Parse a buffer of newline-delimited JSON documents on several threads.
+ *
+ * The buffer is cut into chunks at newlines, so no document may span a
+ * newline. Chunks are parsed by nthreads threads (one per CPU if zero),
+ * including the calling one, and each document is passed to fn. The
+ * document only lives until fn returns, and must not be freed.
+ *
+ * Ordered, documents are passed in input order, and fn is never called
+ * concurrently. Unordered, they are passed as soon as they are parsed, from
+ * any thread, and fn must be thread safe.
+ *
+ * Parsing stops at the first error, or the first non-zero return of fn,
+ * which is returned. Ordered, all the documents before it have then been
+ * passed to fn; unordered, some of those after it may have been too. The
+ * options are those of json_parse_data_opts(), except that intern tables
+ * are not supported (EINVAL).
+ */
+extern int json_records_parallel(
+	void * buf,
+	size_t size,
+	struct json_parse_options const * opts,
+	unsigned nthreads,
+	bool ordered,
+	int (* fn)(void * arg, json_document_t const * record),
+	void * arg
+	);
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                               Builder                                    //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/* Document builder.
+ */
+typedef struct json_builder json_builder_t;
+
+/**
+ * Create a builder of documents from calls rather than text.
+ *
+ * Built documents are laid out like parsed ones, and take the same options:
+ * with JSON_PARSE_SORTKEYS, for instance, objects are sorted by key and
+ * duplicate keys are rejected.
+ */
+extern int json_builder_new(
+	struct json_parse_options const * opts,
+	json_builder_t ** newbuilder
+	);
+
+/**
+ * Free builder, and the document being built if it was not handed out.
+ */
+extern void json_builder_free(json_builder_t * builder);
+
+/**
+ * Open an object or an array.
+ *
+ * The root is an object. In an object, every value, containers included,
+ * follows its key. Errors are final: the builder keeps returning the same
+ * one. Misplaced calls return EINVAL.
+ */
+extern int json_builder_begin_object(json_builder_t * builder);
+extern int json_builder_begin_array(json_builder_t * builder);
+
+/**
+ * Close the innermost object or array.
+ */
+extern int json_builder_end(json_builder_t * builder);
+
+/**
+ * Set the key of the next value of an object.
+ *
+ * The key is copied. It may only be NULL if empty, and may not hold NUL
+ * bytes, which parsed keys cannot either.
+ */
+extern int json_builder_key(
+	json_builder_t * builder,
+	char const * key,
+	size_t len
+	);
+
+/**
+ * Add a literal to the innermost object or array.
+ *
+ * Literals are typed as they would be if parsed, and their text is set as
+ * well. Strings are copied, may only be NULL if empty, and may not hold NUL
+ * bytes. Doubles must be finite.
+ */
+extern int json_builder_string(
+	json_builder_t * builder,
+	char const * s,
+	size_t len
+	);
+extern int json_builder_int(json_builder_t * builder, int64_t v);
+extern int json_builder_uint(json_builder_t * builder, uint64_t v);
+extern int json_builder_double(json_builder_t * builder, double v);
+extern int json_builder_bool(json_builder_t * builder, bool v);
+extern int json_builder_null(json_builder_t * builder);
+
+/**
+ * Hand out the document, once the root object has been closed.
+ *
+ * The document must be freed with json_free(), and outlives the builder.
+ */
+extern int json_builder_finish(
+	json_builder_t * builder,
+	json_document_t ** newdoc
+	);
+
 /**
  * Return root document object.
  */
 extern struct json_object const * json_doc_object(json_document_t const *);
 
 /**
- * Dump JSON document to file stream.
+ * Dump JSON document to file stream, pretty printed.
+ *
+ * A document without a root object, as after json_doc_new(), dumps nothing.
  */
 extern void json_dump(json_document_t const * doc, FILE * f);
 
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                                  Output                                  //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/**
+ * Output flags.
+ */
+enum json_write_flags {
+	JSON_WRITE_PRETTY     = 0x0001,   // one value per line, indented
+};
+
+/**
+ * Serialize object to buffer.
+ *
+ * Strings and keys are escaped, down to ASCII. Numbers are written from
+ * their values: doubles with the fewest digits that read back the same, and
+ * always with a point or an exponent. Compact output has no whitespace.
+ *
+ * The length of the output is returned in len whether it fits or not; if it
+ * does not, the buffer holds as much of it as fits, and ENOBUFS is returned.
+ * A NULL buffer of size 0 only measures. The output is not NUL-terminated.
+ *
+ * Nested containers are tracked without recursion, in memory allocated
+ * past 32 levels; ENOMEM is returned if that fails.
+ *
+ * A NULL object, the root of a document that holds none, gives EINVAL, here
+ * as in json_write_alloc() and json_write_file().
+ */
+extern int json_write(
+	struct json_object const * obj,
+	unsigned flags,
+	char * buf,
+	size_t size,
+	size_t * len
+	);
+
+/**
+ * Serialize object to a new NUL-terminated string.
+ *
+ * The output is measured first, then allocated once with the given
+ * allocator, or malloc() if NULL. The length, without the NUL, is returned
+ * in len. The string is released with the same allocator.
+ */
+extern int json_write_alloc(
+	struct json_object const * obj,
+	unsigned flags,
+	struct json_allocator const * alloc,
+	char ** str,
+	size_t * len
+	);
+
+/**
+ * Serialize object to file stream.
+ */
+extern int json_write_file(
+	struct json_object const * obj,
+	unsigned flags,
+	FILE * f
+	);
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                                 Editing                                  //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/**
+ * Add a value to a document, as a JSON Patch (RFC 6902) add would.
+ *
+ * The path is a JSON Pointer (RFC 6901): "" for the root, which must then
+ * become another object, and "/a/b~1c/0" for member "b/c" of member "a",
+ * or for its first value if it is an array. Keys are matched regardless of
+ * ASCII case. In an array, the value is inserted before the given index,
+ * or at the end for "-"; in an object, it replaces the member of that key
+ * if there is one.
+ *
+ * The value is copied into the document, strings and containers included.
+ * Numbers may be given without text (jval_lit NULL), which is then made
+ * from their value; strings without text give EINVAL.
+ *
+ * Edits are all or nothing: on error, the document is left as it was.
+ * They may move the containers they change, invalidating pointers into
+ * them; the memory of the old ones is only reclaimed with the document.
+ */
+extern int json_doc_insert(
+	json_document_t * doc,
+	char const * path,
+	struct json_value const * val
+	);
+
+/**
+ * Replace an existing value of a document; ENOENT if there is none.
+ */
+extern int json_doc_set(
+	json_document_t * doc,
+	char const * path,
+	struct json_value const * val
+	);
+
+/**
+ * Remove a value from a document; ENOENT if there is none.
+ */
+extern int json_doc_remove(json_document_t * doc, char const * path);
+
+/**
+ * Move a value of a document to another path, as an add would.
+ *
+ * The value is not copied. A value cannot be moved inside itself. The value
+ * at from must exist (ENOENT), even if moved to where it already is.
+ */
+extern int json_doc_move(
+	json_document_t * doc,
+	char const * from,
+	char const * path
+	);
+
+/**
+ * Apply a JSON Patch (RFC 6902) to a document.
+ *
+ * The patch is an array of operation objects, such as
+ * { "op": "add", "path": "/a/0", "value": 1 }, run in turn with the
+ * semantics of the functions above; "copy" copies its value, and "test"
+ * compares it, numbers by exact value, and returns ECANCELED if it differs.
+ * Malformed operations return EINVAL.
+ *
+ * The patch is all or nothing: if any operation fails, the document is
+ * left as it was.
+ */
+extern int json_patch_apply(
+	json_document_t * doc,
+	struct json_array const * patch
+	);
+
 // :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
 //                              Object values                               //
 // :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
@@ -112,6 +766,9 @@ extern void json_dump(json_document_t const * doc, FILE * f);
 /**
  * Fetch value at given path.
  *
+ * Path segments are separated by slashes, and keys are matched regardless of
+ * ASCII case. A segment made of digits also indexes into arrays.
+ *
  * Return NULL if the path cannot be reached.
  */
 extern struct json_value const *
@@ -160,6 +817,27 @@ json_get_array(
 //                             Literal values                               //
 // :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
 
+/**
+ * Convert a literal value.
+ *
+ * Typed literals are loaded directly; string literals are converted from
+ * their text, so that quoted numbers are still accepted. Returns EINVAL if
+ * the value is not a literal of a compatible type, and ERANGE if it does not
+ * fit the destination type.
+ */
+extern int json_value_double(struct json_value const *, double *);
+extern int json_value_int(struct json_value const *, int *);
+extern int json_value_uint(struct json_value const *, unsigned *);
+extern int json_value_int64(struct json_value const *, int64_t *);
+extern int json_value_uint64(struct json_value const *, uint64_t *);
+
+/**
+ * Convert a boolean literal value.
+ *
+ * Only the unquoted true and false are booleans.
+ */
+extern int json_value_bool(struct json_value const *, bool *);
+
 /**
  * Lookup given path in the object and return its value as a double.
  */
@@ -191,6 +869,38 @@ json_get_uint(
 	unsigned * const val
 	);
 
+/**
+ * Lookup given path in the object and return its value as a signed 64-bit
+ * integer.
+ */
+extern int
+json_get_int64(
+	struct json_object const * const obj,
+	char const * const path,
+	int64_t * const val
+	);
+
+/**
+ * Lookup given path in the object and return its value as an unsigned
+ * 64-bit integer.
+ */
+extern int
+json_get_uint64(
+	struct json_object const * const obj,
+	char const * const path,
+	uint64_t * const val
+	);
+
+/**
+ * Lookup given path in the object and return its value as a boolean.
+ */
+extern int
+json_get_bool(
+	struct json_object const * const obj,
+	char const * const path,
+	bool * const val
+	);
+
 /**
  * Lookup given path in the object and return its value as an array of
  * unsigned 32-bit integers.
@@ -224,4 +934,114 @@ json_get_array_of_text(
 	unsigned * const outlen
 	);
 
+/**
+ * Same as json_get_array_of_uint32(), with the vector allocated by the given
+ * allocator rather than malloc().
+ */
+extern int
+json_get_array_of_uint32_alloc(
+	struct json_array const * const jarr,
+	struct json_allocator const * const alloc,
+	uint32_t ** const outvec,
+	unsigned * const outlen
+	);
+
+/**
+ * Same as json_get_array_of_uint64(), with the vector allocated by the given
+ * allocator rather than malloc().
+ */
+extern int
+json_get_array_of_uint64_alloc(
+	struct json_array const  * const jarr,
+	struct json_allocator const * const alloc,
+	uint64_t ** const outvec,
+	unsigned * const outlen
+	);
+
+/**
+ * Same as json_get_array_of_text(), with the vector allocated by the given
+ * allocator rather than malloc().
+ */
+extern int
+json_get_array_of_text_alloc(
+	struct json_array const  * const jarr,
+	struct json_allocator const * const alloc,
+	char const *** const outvec,
+	unsigned * const outlen
+	);
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                             Compiled paths                               //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/**
+ * Compile a path for repeated lookups.
+ *
+ * Segment lengths, key hashes and array indices are worked out once, so that
+ * the json_get_xxx_at() variants of the getters need no string processing.
+ * Returns EINVAL if the path has an empty segment.
+ */
+extern int json_path_compile(char const * path, json_path_t ** newpath);
+
+/**
+ * Compile a path, interning its keys.
+ *
+ * Keys are then first matched by pointer against documents parsed with the
+ * same intern table.
+ */
+extern int json_path_compile_intern(
+	char const * path,
+	json_intern_t * intern,
+	json_path_t ** newpath
+	);
+
+/**
+ * Same as json_path_compile_intern(), with the path allocated by the given
+ * allocator rather than malloc(). The intern table may be NULL.
+ */
+extern int json_path_compile_alloc(
+	char const * path,
+	json_intern_t * intern,
+	struct json_allocator const * alloc,
+	json_path_t ** newpath
+	);
+
+/**
+ * Free compiled path.
+ */
+extern void json_path_free(json_path_t * path);
+
+/**
+ * Fetch value at compiled path.
+ *
+ * Return NULL if the path cannot be reached.
+ */
+extern struct json_value const *
+json_get_value_at(
+	struct json_object const * obj,
+	json_path_t const * path
+	);
+
+/* Getters by compiled path; see their counterparts above.
+ */
+extern char const *
+json_get_literal_at(struct json_object const *, json_path_t const *);
+extern struct json_object const *
+json_get_object_at(struct json_object const *, json_path_t const *);
+extern struct json_array const *
+json_get_array_at(struct json_object const *, json_path_t const *);
+extern int
+json_get_double_at(struct json_object const *, json_path_t const *, double *);
+extern int
+json_get_int_at(struct json_object const *, json_path_t const *, int *);
+extern int
+json_get_uint_at(struct json_object const *, json_path_t const *, unsigned *);
+extern int
+json_get_int64_at(struct json_object const *, json_path_t const *, int64_t *);
+extern int
+json_get_uint64_at(struct json_object const *, json_path_t const *,
+		   uint64_t *);
+extern int
+json_get_bool_at(struct json_object const *, json_path_t const *, bool *);
+
 #endif
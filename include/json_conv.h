@@ -19,8 +19,21 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+/**
+ * Convert a decimal number to the nearest double.
+ *
+ * The whole of the given characters must be a number in the syntax of
+ * strtod(), less leading whitespace, hexadecimal, infinities and NaNs. The
+ * conversion is correctly rounded and does not depend on the locale.
+ * Returns EINVAL on syntax errors, and ERANGE if the number overflows, in
+ * which case the value is set to an infinity.
+ */
+extern int json_str2double(char const * s, size_t len, double * val);
 
 static inline int
 str2int64(char const * const lit, int64_t * const val)
@@ -107,14 +120,9 @@ str2uint(char const * const lit, unsigned * const val)
 static inline int
 str2double(char const * const lit, double * const val)
 {
-	char * endptr;
 	double d;
 
-	if (!*lit)
-		return EINVAL;
-	errno = 0;
-	d = strtod(lit, &endptr);
-	if (*endptr || errno)
+	if (json_str2double(lit, strlen(lit), &d))
 		return EINVAL;
 
 	*val = d;
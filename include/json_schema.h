@@ -256,4 +256,57 @@ json_validate(
 	size_t const               size
 	);
 
+/**
+ * A compiled schema.
+ */
+typedef struct json_validator json_validator_t;
+
+/**
+ * Compile a schema for json_validate_compiled().
+ *
+ * Unlike json_validate(), which only reports malformed entries when it
+ * reaches them, compilation rejects them all upfront with ENOTSUP. IFEQ
+ * entries nested too deep to be anything but a loop give ELOOP.
+ */
+extern int
+json_schema_compile(
+	struct json_schema const * schema,
+	unsigned                   n,
+	json_validator_t        ** newvalidator
+	);
+
+/**
+ * Same as json_schema_compile(), with the compiled schema allocated by the
+ * given allocator rather than malloc(). The vectors that
+ * json_validate_compiled() extracts with it are allocated by it as well, and
+ * must be released with it. The allocator must outlive the compiled schema.
+ */
+extern int
+json_schema_compile_alloc(
+	struct json_schema const * schema,
+	unsigned                   n,
+	struct json_allocator const * alloc,
+	json_validator_t        ** newvalidator
+	);
+
+/**
+ * Free a compiled schema.
+ */
+extern void
+json_validator_free(json_validator_t * validator);
+
+/**
+ * Validate JSON object against a compiled schema.
+ *
+ * Same as json_validate(), but each object is walked once, whatever the
+ * number of keys in the schema.
+ */
+extern int
+json_validate_compiled(
+	struct json_object const * obj,
+	json_validator_t const   * validator,
+	char                     * buf,
+	size_t                     size
+	);
+
 #endif
@@ -14,6 +14,8 @@
  * the use or non-use of this documentation.
  */
 
+#include <math.h>
+
 /* Private API */
 #include "json_private.h"
 
@@ -31,36 +33,116 @@ json_doc_object(json_document_t const * const doc)
 //                              Discovery                                   //
 // :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
 
-struct json_value const *
-json_get_value(
+/**
+ * Check whether a tuple has the given key.
+ *
+ * Interned keys match by pointer.
+ */
+static inline bool
+_key_match(struct json_tuple const * const tup,
+	   char const * const key, size_t const len, uint32_t const hash)
+{
+	return tup->jtup_keylen == len
+	    && (   tup->jtup_key == key
+		|| (   tup->jtup_hash == hash
+		    && json_key_compare(tup->jtup_key, len, key, len) == 0));
+}
+
+struct json_tuple const *
+json_object_find(
 	struct json_object const * const obj,
-	char const * const path )
+	char const * const key,
+	size_t const len,
+	uint32_t const hash )
 {
-	char const * const e = strchr(path, '/') ? : path + strlen(path);
-	unsigned const len = e - path;
+	struct json_tuple const * tup;
 
-	if (len == 0)
+	/* sorted objects: binary search */
+	if (obj->jobj_order) {
+		unsigned n = obj->jobj_length;
+		if (n == 0)
+			return NULL;
+		tup = obj->jobj_tuples;
+		while (n > 1) {
+			unsigned const half = n / 2;
+			tup = json_key_compare(tup[half].jtup_key,
+					       tup[half].jtup_keylen,
+					       key, len) <= 0 ? tup + half : tup;
+			n -= half;
+		}
+		return json_key_compare(tup->jtup_key, tup->jtup_keylen,
+					key, len) ? NULL : tup;
+	}
+
+	/* wide objects: probe the key index */
+	if (obj->jobj_slots) {
+		for (uint32_t i = hash & obj->jobj_mask;
+		     obj->jobj_slots[i];
+		     i = (i + 1) & obj->jobj_mask) {
+			tup = &obj->jobj_tuples[obj->jobj_slots[i] - 1];
+			if (_key_match(tup, key, len, hash))
+				return tup;
+		}
 		return NULL;
+	}
 
+	/* narrow objects: scan */
 	for (unsigned i = 0; i < obj->jobj_length; i++) {
-		char const * const key =
-			obj->jobj_tuples[i].jtup_key;
-		struct json_value const * const val =
-			&obj->jobj_tuples[i].jtup_val;
-		if (strlen(key) != len || strncasecmp(key, path, len))
-			continue;
-		/* continue along the path */
-		if (*e && val->jval_type == JSON_VAL_OBJECT)
-			return json_get_value(val->jval_object, e + 1);
-		else if (*e == '\0')
-			return val;   // final destination
-		else
-			return NULL;  // can go no farther
+		tup = &obj->jobj_tuples[i];
+		if (_key_match(tup, key, len, hash))
+			return tup;
 	}
-
 	return NULL;
 }
 
+struct json_value const *
+json_value_step(
+	struct json_value const * const val,
+	struct json_segment const * const seg )
+{
+	struct json_tuple const * tup;
+
+	switch (val->jval_type) {
+	case JSON_VAL_OBJECT:
+		tup = json_object_find(val->jval_object, seg->jseg_key,
+				       seg->jseg_keylen, seg->jseg_hash);
+		return tup ? &tup->jtup_val : NULL;
+	case JSON_VAL_ARRAY:
+		if (seg->jseg_index >= val->jval_array->jarr_length)
+			return NULL;
+		return &val->jval_array->jarr_values[seg->jseg_index];
+	default:
+		return NULL;  // can go no farther
+	}
+}
+
+struct json_value const *
+json_get_value(
+	struct json_object const * const obj,
+	char const * path )
+{
+	struct json_value const root = {
+		.jval_type   = JSON_VAL_OBJECT,
+		.jval_object = (struct json_object *) obj,
+	};
+	struct json_value const * val = &root;
+
+	for (;;) {
+		struct json_segment seg;
+		char const * const e = json_path_segment(path, &seg);
+
+		if (seg.jseg_keylen == 0)
+			return NULL;
+		if ((val = json_value_step(val, &seg)) == NULL)
+			return NULL;
+		if (*e == '\0')
+			return val;   // final destination
+
+		/* continue along the path */
+		path = e + 1;
+	}
+}
+
 char const *
 json_get_literal(
 	struct json_object const * const obj,
@@ -91,6 +173,127 @@ json_get_array(
 		? val->jval_array : NULL;
 }
 
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                             Literal values                               //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+int
+json_value_double(struct json_value const * const jval, double * const val)
+{
+	if (jval->jval_type != JSON_VAL_LITERAL)
+		return EINVAL;
+
+	switch (jval->jval_lit_type) {
+	case JSON_LIT_INT:
+		*val = jval->jval_int;
+		return 0;
+	case JSON_LIT_UINT:
+		*val = jval->jval_uint;
+		return 0;
+	case JSON_LIT_DOUBLE:
+		if (!isfinite(jval->jval_double))
+			return ERANGE;
+		*val = jval->jval_double;
+		return 0;
+	case JSON_LIT_STRING:
+		return str2double(jval->jval_lit, val);
+	default:
+		return EINVAL;
+	}
+}
+
+int
+json_value_int64(struct json_value const * const jval, int64_t * const val)
+{
+	if (jval->jval_type != JSON_VAL_LITERAL)
+		return EINVAL;
+
+	switch (jval->jval_lit_type) {
+	case JSON_LIT_INT:
+		*val = jval->jval_int;
+		return 0;
+	case JSON_LIT_UINT:
+		return ERANGE;
+	case JSON_LIT_STRING:
+		return str2int64(jval->jval_lit, val);
+	default:
+		return EINVAL;
+	}
+}
+
+int
+json_value_uint64(struct json_value const * const jval, uint64_t * const val)
+{
+	if (jval->jval_type != JSON_VAL_LITERAL)
+		return EINVAL;
+
+	switch (jval->jval_lit_type) {
+	case JSON_LIT_INT:
+		if (jval->jval_int < 0)
+			return ERANGE;
+		*val = jval->jval_int;
+		return 0;
+	case JSON_LIT_UINT:
+		*val = jval->jval_uint;
+		return 0;
+	case JSON_LIT_STRING:
+		return str2uint64(jval->jval_lit, val);
+	default:
+		return EINVAL;
+	}
+}
+
+int
+json_value_int(struct json_value const * const jval, int * const val)
+{
+	int64_t i;
+	int err;
+
+	if ((err = json_value_int64(jval, &i)))
+		return err;
+	if (i < INT_MIN || i > INT_MAX)
+		return ERANGE;
+
+	*val = i;
+	return 0;
+}
+
+int
+json_value_uint(struct json_value const * const jval, unsigned * const val)
+{
+	int64_t i;
+	int err;
+
+	if ((err = json_value_int64(jval, &i)))
+		return err;
+	if (i < 0 || i > UINT_MAX)
+		return ERANGE;
+
+	*val = i;
+	return 0;
+}
+
+int
+json_value_bool(struct json_value const * const jval, bool * const val)
+{
+	if (   jval->jval_type != JSON_VAL_LITERAL
+	    || jval->jval_lit_type != JSON_LIT_BOOL)
+		return EINVAL;
+
+	*val = jval->jval_bool;
+	return 0;
+}
+
+/* Fetch literal value at given path */
+static inline struct json_value const *
+_get_literal_value(
+	struct json_object const * const obj,
+	char const * const path )
+{
+	struct json_value const * const val = json_get_value(obj, path);
+	return val && val->jval_type == JSON_VAL_LITERAL ? val : NULL;
+}
+
 int
 json_get_double(
 	struct json_object const * const obj,
@@ -98,8 +301,8 @@ json_get_double(
 	double * const val
 	)
 {
-	char const * const lit = json_get_literal(obj, path);
-	return lit ? str2double(lit, val) : ENOENT;
+	struct json_value const * const jval = _get_literal_value(obj, path);
+	return jval ? json_value_double(jval, val) : ENOENT;
 }
 
 int
@@ -109,8 +312,8 @@ json_get_int(
 	int * const val
 	)
 {
-	char const * const lit = json_get_literal(obj, path);
-	return lit ? str2int(lit, val) : ENOENT;
+	struct json_value const * const jval = _get_literal_value(obj, path);
+	return jval ? json_value_int(jval, val) : ENOENT;
 }
 
 int
@@ -120,13 +323,47 @@ json_get_uint(
 	unsigned * const val
 	)
 {
-	char const * const lit = json_get_literal(obj, path);
-	return lit ? str2uint(lit, val) : ENOENT;
+	struct json_value const * const jval = _get_literal_value(obj, path);
+	return jval ? json_value_uint(jval, val) : ENOENT;
 }
 
 int
-json_get_array_of_uint32(
+json_get_int64(
+	struct json_object const * const obj,
+	char const * const path,
+	int64_t * const val
+	)
+{
+	struct json_value const * const jval = _get_literal_value(obj, path);
+	return jval ? json_value_int64(jval, val) : ENOENT;
+}
+
+int
+json_get_uint64(
+	struct json_object const * const obj,
+	char const * const path,
+	uint64_t * const val
+	)
+{
+	struct json_value const * const jval = _get_literal_value(obj, path);
+	return jval ? json_value_uint64(jval, val) : ENOENT;
+}
+
+int
+json_get_bool(
+	struct json_object const * const obj,
+	char const * const path,
+	bool * const val
+	)
+{
+	struct json_value const * const jval = _get_literal_value(obj, path);
+	return jval ? json_value_bool(jval, val) : ENOENT;
+}
+
+int
+json_get_array_of_uint32_alloc(
 	struct json_array const * const jarr,
+	struct json_allocator const * const alloc,
 	uint32_t ** const outvec,
 	unsigned * const outlen
 	)
@@ -136,7 +373,7 @@ json_get_array_of_uint32(
 	/* allocate a vector big enough to accomodate all values */
 	unsigned const len = jarr->jarr_length;
 	size_t const size = sizeof(uint32_t) * len;
-	uint32_t * const vec = malloc(size);
+	uint32_t * const vec = json_mem_alloc(alloc, size);
 	if (vec == NULL) {
 		err = errno;
 		goto fail;
@@ -145,26 +382,38 @@ json_get_array_of_uint32(
 	/* parse values */
 	for (unsigned i = 0; i < len; i++) {
 		struct json_value const * const jval = &jarr->jarr_values[i];
-		if (   jval->jval_type != JSON_VAL_LITERAL
-		    || str2uint32(jval->jval_lit, &vec[i])) {
+		uint64_t u;
+		if (json_value_uint64(jval, &u) || u > UINT32_MAX) {
 			err = EINVAL;
 			goto fail_1;
 		}
+		vec[i] = u;
 	}
 
 	*outvec = vec;
 	*outlen = len;
 	return 0;
 
-fail_1:	free(vec);
+fail_1:	json_mem_free(alloc, vec);
 fail:	*outvec = NULL;
 	*outlen = 0;
 	return err;
 }
 
 int
-json_get_array_of_uint64(
+json_get_array_of_uint32(
+	struct json_array const * const jarr,
+	uint32_t ** const outvec,
+	unsigned * const outlen
+	)
+{
+	return json_get_array_of_uint32_alloc(jarr, NULL, outvec, outlen);
+}
+
+int
+json_get_array_of_uint64_alloc(
 	struct json_array const  * const jarr,
+	struct json_allocator const * const alloc,
 	uint64_t ** const outvec,
 	unsigned * const outlen
 	)
@@ -174,7 +423,7 @@ json_get_array_of_uint64(
 	/* allocate a vector big enough to accomodate the values */
 	unsigned const len = jarr->jarr_length;
 	size_t const size = sizeof(uint64_t) * len;
-	uint64_t * const vec = malloc(size);
+	uint64_t * const vec = json_mem_alloc(alloc, size);
 	if (vec == NULL) {
 		err = errno;
 		goto fail;
@@ -183,8 +432,7 @@ json_get_array_of_uint64(
 	/* parse values */
 	for (unsigned i = 0; i < len; i++) {
 		struct json_value const * const jval = &jarr->jarr_values[i];
-		if (   jval->jval_type != JSON_VAL_LITERAL
-		    || str2uint64(jval->jval_lit, &vec[i])) {
+		if (json_value_uint64(jval, &vec[i])) {
 			err = EINVAL;
 			goto fail_1;
 		}
@@ -194,15 +442,26 @@ json_get_array_of_uint64(
 	*outlen = len;
 	return 0;
 
-fail_1:	free(vec);
+fail_1:	json_mem_free(alloc, vec);
 fail:	*outvec = NULL;
 	*outlen = 0;
 	return err;
 }
 
 int
-json_get_array_of_text(
+json_get_array_of_uint64(
 	struct json_array const  * const jarr,
+	uint64_t ** const outvec,
+	unsigned * const outlen
+	)
+{
+	return json_get_array_of_uint64_alloc(jarr, NULL, outvec, outlen);
+}
+
+int
+json_get_array_of_text_alloc(
+	struct json_array const  * const jarr,
+	struct json_allocator const * const alloc,
 	char const *** const outvec,
 	unsigned * const outlen
 	)
@@ -212,7 +471,7 @@ json_get_array_of_text(
 	/* allocate a vector big enough to accomodate the values */
 	unsigned const len = jarr->jarr_length;
 	size_t const size = sizeof(char const *) * len;
-	char const ** const vec = malloc(size);
+	char const ** const vec = json_mem_alloc(alloc, size);
 	if (vec == NULL) {
 		err = errno;
 		goto fail;
@@ -232,8 +491,18 @@ json_get_array_of_text(
 	*outlen = len;
 	return 0;
 
-fail_1:	free(vec);
+fail_1:	json_mem_free(alloc, vec);
 fail:	*outvec = NULL;
 	*outlen = 0;
 	return err;
 }
+
+int
+json_get_array_of_text(
+	struct json_array const  * const jarr,
+	char const *** const outvec,
+	unsigned * const outlen
+	)
+{
+	return json_get_array_of_text_alloc(jarr, NULL, outvec, outlen);
+}
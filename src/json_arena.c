@@ -0,0 +1,162 @@
+/*
+ * json_arena.c
+ *
+ * Simple JSON parser.
+ *
+ * https://github.com/e03213ac/libjson
+ *
+ * This work belongs to the Public Domain. Everyone is free to use, modify,
+ * republish, sell or give away this work without prior consent from anybody.
+ *
+ * This software is provided on an "AS IS" basis, without warranty of any kind.
+ * Use at your own risk! Under no circumstances shall the author(s) or
+ * contributor(s) be liable for damages resulting directly or indirectly from
+ * the use or non-use of this documentation.
+ */
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+/* Private API */
+#include "json_private.h"
+
+/* Size of the first chunk */
+#define CHUNK_MIN_SIZE   ((size_t) 4 << 10)
+
+/* Chunks stop growing past this size */
+#define CHUNK_MAX_SIZE   ((size_t) 64 << 20)
+
+/* Huge page size, and smallest chunk that is worth backing by huge pages */
+#define HUGE_PAGE_SIZE   ((size_t) 2 << 20)
+
+/* Round up to a multiple of a power of two */
+#define ROUNDUP(x, n)    (((x) + (n) - 1) & ~((n) - 1))
+
+void
+json_arena_init(struct json_arena * const ar, bool const hugepages,
+		struct json_allocator const * const alloc )
+{
+	*ar = (struct json_arena) {
+		.jar_next      = CHUNK_MIN_SIZE,
+		.jar_hugepages = hugepages,
+		.jar_alloc     = alloc,
+	};
+}
+
+/**
+ * Map a chunk backed by huge pages.
+ *
+ * Explicit huge pages are tried first; if none are reserved, fall back to a
+ * regular mapping and ask for transparent huge pages.
+ */
+static struct json_chunk *
+_map_chunk(size_t const size)
+{
+	void * p;
+
+#ifdef MAP_HUGETLB
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+		return p;
+#endif
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	(void) madvise(p, size, MADV_HUGEPAGE);
+#endif
+	return p;
+}
+
+/**
+ * Allocate a new chunk big enough for the given request, then allocate from
+ * it.
+ */
+int
+json_arena_grow(struct json_arena * const ar, size_t const size,
+		void ** const p )
+{
+	size_t const hdr = offsetof(struct json_chunk, jchk_data);
+	struct json_chunk * chk;
+	size_t len;
+
+	/* size the chunk; oversized requests get a chunk of their own */
+	len = ar->jar_next;
+	if (len < hdr + size)
+		len = ROUNDUP(hdr + size, CHUNK_MIN_SIZE);
+
+	/* allocate it */
+	bool const mapped = ar->jar_hugepages && len >= HUGE_PAGE_SIZE;
+	if (mapped)
+		len = ROUNDUP(len, HUGE_PAGE_SIZE);
+	chk = mapped ? _map_chunk(len) : json_mem_alloc(ar->jar_alloc, len);
+	if (chk == NULL)
+		return errno ? : ENOMEM;
+	*chk = (struct json_chunk) {
+		.jchk_next   = ar->jar_head,
+		.jchk_size   = len,
+		.jchk_mapped = mapped,
+	};
+
+	/* grow geometrically */
+	if (ar->jar_next < CHUNK_MAX_SIZE)
+		ar->jar_next *= 2;
+
+	/* carve the request out of the new chunk */
+	ar->jar_head = chk;
+	ar->jar_p    = chk->jchk_data + size;
+	ar->jar_e    = (char *) chk + len;
+	*p = chk->jchk_data;
+	return 0;
+}
+
+void
+json_arena_release(struct json_arena * const ar)
+{
+	struct json_chunk * next;
+
+	for (struct json_chunk * chk = ar->jar_head; chk; chk = next) {
+		next = chk->jchk_next;
+		if (chk->jchk_mapped)
+			munmap(chk, chk->jchk_size);
+		else
+			json_mem_free(ar->jar_alloc, chk);
+	}
+
+	json_arena_init(ar, ar->jar_hugepages, ar->jar_alloc);
+}
+
+/**
+ * Release all allocations, but keep the largest chunk for further ones.
+ */
+void
+json_arena_reset(struct json_arena * const ar)
+{
+	struct json_chunk * keep = ar->jar_head;
+	struct json_chunk * next;
+
+	if (keep == NULL)
+		return;
+
+	/* keep the largest chunk, which is the most likely to be enough */
+	for (struct json_chunk * chk = keep->jchk_next; chk; chk = chk->jchk_next)
+		if (chk->jchk_size > keep->jchk_size)
+			keep = chk;
+
+	for (struct json_chunk * chk = ar->jar_head; chk; chk = next) {
+		next = chk->jchk_next;
+		if (chk == keep)
+			continue;
+		if (chk->jchk_mapped)
+			munmap(chk, chk->jchk_size);
+		else
+			json_mem_free(ar->jar_alloc, chk);
+	}
+
+	keep->jchk_next = NULL;
+	ar->jar_head = keep;
+	ar->jar_p    = keep->jchk_data;
+	ar->jar_e    = (char *) keep + keep->jchk_size;
+}
@@ -0,0 +1,964 @@
+/*
+ * json_edit.c
+ *
+ * Simple JSON parser.
+ *
+ * https://github.com/e03213ac/libjson
+ *
+ * This work belongs to the Public Domain. Everyone is free to use, modify,
+ * republish, sell or give away this work without prior consent from anybody.
+ *
+ * This software is provided on an "AS IS" basis, without warranty of any kind.
+ * Use at your own risk! Under no circumstances shall the author(s) or
+ * contributor(s) be liable for damages resulting directly or indirectly from
+ * the use or non-use of this documentation.
+ */
+
+/*
+ * Document editing.
+ *
+ * Containers are edited in place while they have room, and moved elsewhere
+ * in the arena, with twice the room, when they do not. Sorted objects stay
+ * sorted, and wide objects keep their key index up to date.
+ *
+ * Every part of the document that an edit overwrites is saved beforehand in
+ * an undo journal, so that an edit, or a whole patch, that fails halfway can
+ * be rolled back by replaying the journal backwards. Memory allocated in the
+ * meantime is not reclaimed until the document is, as usual with arenas.
+ *
+ * Each path is resolved once per operation, down to the container of its
+ * target and the position of the target in it; the edit then works on that
+ * position directly.
+ */
+
+/* Private API */
+#include "json_private.h"
+
+/* Room of the smallest moved container */
+#define EDIT_MIN_SIZE 4
+
+/**
+ * Undo journal entry.
+ *
+ * Entries follow the bytes they saved, so that the journal can be walked
+ * backwards.
+ */
+struct _saved {
+	void                 * sv_p;          // where the bytes were
+	size_t                 sv_len;
+};
+
+/* Room taken by the saved bytes of an entry */
+#define SAVED_ROOM(len) \
+	(((len) + JSON_ARENA_ALIGN - 1) & ~(size_t) (JSON_ARENA_ALIGN - 1))
+
+/**
+ * Containers being compared, and the next of their values to compare.
+ */
+struct _pair {
+	struct json_value const * pr_a;
+	struct json_value const * pr_b;
+	unsigned               pr_next;
+};
+
+/**
+ * Location of a value, as found by a path.
+ */
+struct _loc {
+	struct json_value    * loc_cv;        // its container, NULL for the root
+	unsigned               loc_pos;       // its position, or the length
+	bool                   loc_found;     // it exists
+	char const           * loc_key;       // its key, in objects
+	size_t                 loc_keylen;
+	uint32_t               loc_hash;
+};
+
+/**
+ * Save bytes of the document before they are overwritten.
+ */
+static int
+_save(struct json_doc * const doc, void * const p, size_t const len)
+{
+	size_t const room = SAVED_ROOM(len) + sizeof(struct _saved);
+
+	if (doc->jdoc_undo_size - doc->jdoc_undo_len < room) {
+		size_t size = doc->jdoc_undo_size ? : 1024;
+		while (size - doc->jdoc_undo_len < room)
+			size *= 2;
+		char * const undo = json_mem_realloc(doc->jdoc_alloc,
+						     doc->jdoc_undo, size);
+		if (undo == NULL)
+			return errno;
+		doc->jdoc_undo = undo;
+		doc->jdoc_undo_size = size;
+	}
+
+	char * const e = doc->jdoc_undo + doc->jdoc_undo_len + SAVED_ROOM(len);
+	if (len)
+		memcpy(e - SAVED_ROOM(len), p, len);
+	*(struct _saved *) e = (struct _saved) { p, len };
+	doc->jdoc_undo_len += room;
+	return 0;
+}
+
+/**
+ * Roll back the edits journaled since the given point.
+ */
+static void
+_undo(struct json_doc * const doc, size_t const mark)
+{
+	while (doc->jdoc_undo_len > mark) {
+		struct _saved const * const sv = (struct _saved const *)
+			(doc->jdoc_undo + doc->jdoc_undo_len) - 1;
+		char const * const p = (char const *) sv
+				     - SAVED_ROOM(sv->sv_len);
+		if (sv->sv_len)
+			memcpy(sv->sv_p, p, sv->sv_len);
+		doc->jdoc_undo_len = p - doc->jdoc_undo;
+	}
+}
+
+/* Room of a container moved to make room for one more value */
+static int
+_grow(unsigned const n, unsigned * const size)
+{
+	if (n > UINT_MAX / 2)
+		return EOVERFLOW;
+	*size = n < EDIT_MIN_SIZE / 2 ? EDIT_MIN_SIZE : n * 2;
+	return 0;
+}
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                                 Paths                                    //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/**
+ * Decode the reference token starting at s, up to the next slash.
+ *
+ * Tokens with escapes are decoded into the scratch token buffer; others are
+ * used in place.
+ */
+static int
+_token(struct json_doc * const doc, char const * const s,
+       char const ** const end, char const ** const key, size_t * const len)
+{
+	char const * e = s;
+	bool escaped = false;
+
+	for (; *e && *e != '/'; e++)
+		escaped |= *e == '~';
+	*end = e;
+	*key = s;
+	*len = e - s;
+	if (!escaped)
+		return 0;
+
+	if (doc->jdoc_buf_size < *len) {
+		char * const buf = json_mem_realloc(doc->jdoc_alloc,
+						    doc->jdoc_buf, *len);
+		if (buf == NULL)
+			return errno;
+		doc->jdoc_buf = buf;
+		doc->jdoc_buf_size = *len;
+	}
+
+	/* ~0 is ~, ~1 is / */
+	char * d = doc->jdoc_buf;
+	for (char const * p = s; p < e; p++) {
+		if (*p != '~')
+			*d++ = *p;
+		else if (p + 1 < e && (p[1] == '0' || p[1] == '1'))
+			*d++ = *++p == '0' ? '~' : '/';
+		else
+			return EINVAL;
+	}
+	*key = doc->jdoc_buf;
+	*len = d - doc->jdoc_buf;
+	return 0;
+}
+
+/**
+ * Decode an array index: digits without leading zeros, or - for the end of
+ * the array.
+ */
+static int
+_index(char const * const key, size_t const len, unsigned const length,
+       unsigned * const pos )
+{
+	uint64_t i = 0;
+
+	if (len == 1 && *key == '-') {
+		*pos = length;
+		return 0;
+	}
+	if (len == 0 || (*key == '0' && len > 1))
+		return EINVAL;
+	for (size_t k = 0; k < len; k++) {
+		if (key[k] < '0' || key[k] > '9')
+			return EINVAL;
+		if ((i = i * 10 + (key[k] - '0')) > length)
+			return ENOENT;
+	}
+	*pos = i;
+	return 0;
+}
+
+/**
+ * Resolve a JSON pointer, down to the container of its target.
+ *
+ * The root object is held in a value of the caller's. The target itself may
+ * not exist, but its container must.
+ */
+static int
+_resolve(struct json_doc * const doc, struct json_value * const root,
+	 char const * path, struct _loc * const loc)
+{
+	struct json_value * val = root;
+	int err;
+
+	*loc = (struct _loc) { .loc_found = true };
+	if (*path == '\0')
+		return 0;
+	if (*path != '/')
+		return EINVAL;
+
+	while (*path == '/') {
+		struct json_value * const cv = val;
+		char const * key;
+		size_t len;
+
+		if (cv == NULL)
+			return ENOENT;
+		if ((err = _token(doc, path + 1, &path, &key, &len)))
+			return err;
+
+		*loc = (struct _loc) {
+			.loc_cv     = cv,
+			.loc_key    = key,
+			.loc_keylen = len,
+		};
+		val = NULL;
+		switch (cv->jval_type) {
+		case JSON_VAL_OBJECT: {
+			struct json_object * const obj = cv->jval_object;
+			loc->loc_hash = json_key_hash(key, len);
+			struct json_tuple * const tup = (struct json_tuple *)
+				json_object_find(obj, key, len, loc->loc_hash);
+			if (tup) {
+				loc->loc_pos = tup - obj->jobj_tuples;
+				val = &tup->jtup_val;
+			} else
+				loc->loc_pos = obj->jobj_length;
+			break;
+		}
+		case JSON_VAL_ARRAY: {
+			struct json_array * const arr = cv->jval_array;
+			if ((err = _index(key, len, arr->jarr_length,
+					  &loc->loc_pos)))
+				return err;
+			if (loc->loc_pos < arr->jarr_length)
+				val = &arr->jarr_values[loc->loc_pos];
+			break;
+		}
+		default:
+			return ENOENT;
+		}
+		loc->loc_found = val != NULL;
+	}
+	return 0;
+}
+
+/* The value at a location that exists */
+static inline struct json_value *
+_value(struct json_value * const root, struct _loc const * const loc)
+{
+	if (loc->loc_cv == NULL)
+		return root;
+	if (loc->loc_cv->jval_type == JSON_VAL_OBJECT)
+		return &loc->loc_cv->jval_object->jobj_tuples[loc->loc_pos]
+			.jtup_val;
+	return &loc->loc_cv->jval_array->jarr_values[loc->loc_pos];
+}
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                               Containers                                 //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/**
+ * Insert a value into an array.
+ */
+static int
+_array_insert(struct json_doc * const doc, struct json_value * const cv,
+	      unsigned const pos, struct json_value const * const val)
+{
+	struct json_array * const arr = cv->jval_array;
+	unsigned const n = arr->jarr_length;
+	struct json_value * const v = arr->jarr_values;
+	unsigned size;
+	int err;
+
+	if (n < arr->jarr_size) {
+		if (   (err = _save(doc, arr, sizeof(*arr)))
+		    || (err = _save(doc, &v[pos], sizeof(*v) * (n - pos))))
+			return err;
+		memmove(&v[pos + 1], &v[pos], sizeof(*v) * (n - pos));
+		v[pos] = *val;
+		arr->jarr_length++;
+		return 0;
+	}
+
+	/* move it, with room to grow */
+	struct json_array * moved;
+	if (   (err = _grow(n, &size))
+	    || (err = _gcmalloc(doc, sizeof(*moved) + sizeof(*v) * size,
+				&moved)))
+		return err;
+	moved->jarr_length = n + 1;
+	moved->jarr_size   = size;
+	memcpy(moved->jarr_values, v, sizeof(*v) * pos);
+	moved->jarr_values[pos] = *val;
+	memcpy(&moved->jarr_values[pos + 1], &v[pos], sizeof(*v) * (n - pos));
+
+	if ((err = _save(doc, &cv->jval_array, sizeof(cv->jval_array))))
+		return err;
+	cv->jval_array = moved;
+	return 0;
+}
+
+/**
+ * Remove a value from an array.
+ */
+static int
+_array_remove(struct json_doc * const doc, struct json_value * const cv,
+	      unsigned const pos)
+{
+	struct json_array * const arr = cv->jval_array;
+	unsigned const n = arr->jarr_length;
+	struct json_value * const v = arr->jarr_values;
+	int err;
+
+	if (   (err = _save(doc, arr, sizeof(*arr)))
+	    || (err = _save(doc, &v[pos], sizeof(*v) * (n - pos))))
+		return err;
+	memmove(&v[pos], &v[pos + 1], sizeof(*v) * (n - pos - 1));
+	arr->jarr_length--;
+	return 0;
+}
+
+/* Fill a key index, as the parser does */
+static void
+_fill_index(struct json_object const * const obj, uint32_t * const slots,
+	    unsigned const size )
+{
+	memset(slots, 0, sizeof(*slots) * size);
+	for (unsigned i = 0; i < obj->jobj_length; i++) {
+		uint32_t h = obj->jobj_tuples[i].jtup_hash & (size - 1);
+		while (slots[h])
+			h = (h + 1) & (size - 1);
+		slots[h] = i + 1;
+	}
+}
+
+/**
+ * Index the keys of an object into a new table.
+ *
+ * The header of the object must have been saved.
+ */
+static int
+_new_index(struct json_doc * const doc, struct json_object * const obj)
+{
+	unsigned size = 2 * JSON_KEY_INDEX_MIN;
+	uint32_t * slots;
+	int err;
+
+	while (size < 2 * obj->jobj_length)
+		size *= 2;
+	if ((err = _gcmalloc(doc, sizeof(*slots) * size, &slots)))
+		return err;
+	_fill_index(obj, slots, size);
+
+	obj->jobj_mask  = size - 1;
+	obj->jobj_slots = slots;
+	return 0;
+}
+
+/**
+ * Index the last tuple of an object, which was just added.
+ *
+ * The header of the object must have been saved.
+ */
+static int
+_index_last(struct json_doc * const doc, struct json_object * const obj)
+{
+	unsigned const n = obj->jobj_length;
+	int err;
+
+	/* wide enough for an index now, or the index is too full */
+	if (obj->jobj_slots == NULL)
+		return n >= JSON_KEY_INDEX_MIN ? _new_index(doc, obj) : 0;
+	if (2 * n > obj->jobj_mask + 1)
+		return _new_index(doc, obj);
+
+	uint32_t h = obj->jobj_tuples[n - 1].jtup_hash & obj->jobj_mask;
+	while (obj->jobj_slots[h])
+		h = (h + 1) & obj->jobj_mask;
+	if ((err = _save(doc, &obj->jobj_slots[h], sizeof(uint32_t))))
+		return err;
+	obj->jobj_slots[h] = n;
+	return 0;
+}
+
+/* Position of a new key in a sorted object */
+static unsigned
+_sorted_pos(struct json_object const * const obj,
+	    char const * const key, size_t const len)
+{
+	unsigned lo = 0, hi = obj->jobj_length;
+
+	while (lo < hi) {
+		unsigned const mid = lo + (hi - lo) / 2;
+		struct json_tuple const * const tup = &obj->jobj_tuples[mid];
+		if (json_key_compare(tup->jtup_key, tup->jtup_keylen,
+				     key, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * Add a tuple to an object: last in document order, and in key order too if
+ * the object is sorted.
+ */
+static int
+_object_add(struct json_doc * const doc, struct json_value * const cv,
+	    struct json_tuple const * const tup)
+{
+	struct json_object * const obj = cv->jval_object;
+	unsigned const n = obj->jobj_length;
+	struct json_tuple * const t = obj->jobj_tuples;
+	uint32_t * const order = obj->jobj_order;
+	unsigned const pos = order ? _sorted_pos(obj, tup->jtup_key,
+						 tup->jtup_keylen) : n;
+	unsigned size;
+	int err;
+
+	if (n < obj->jobj_size) {
+		if (   (err = _save(doc, obj, sizeof(*obj)))
+		    || (err = _save(doc, &t[pos], sizeof(*t) * (n - pos)))
+		    || (order && (err = _save(doc, order,
+					      sizeof(*order) * n))))
+			return err;
+		memmove(&t[pos + 1], &t[pos], sizeof(*t) * (n - pos));
+		t[pos] = *tup;
+		if (order) {
+			for (unsigned i = 0; i < n; i++)
+				order[i] += order[i] >= pos;
+			order[n] = pos;
+		}
+		obj->jobj_length++;
+		return order ? 0 : _index_last(doc, obj);
+	}
+
+	/* move it, with room to grow */
+	struct json_object * moved;
+	if (   (err = _grow(n, &size))
+	    || (err = _gcmalloc(doc, sizeof(*moved) + sizeof(*t) * size,
+				&moved)))
+		return err;
+	*moved = *obj;
+	moved->jobj_length = n + 1;
+	moved->jobj_size   = size;
+	memcpy(moved->jobj_tuples, t, sizeof(*t) * pos);
+	moved->jobj_tuples[pos] = *tup;
+	memcpy(&moved->jobj_tuples[pos + 1], &t[pos], sizeof(*t) * (n - pos));
+	if (order) {
+		if ((err = _gcmalloc(doc, sizeof(*order) * size,
+				     &moved->jobj_order)))
+			return err;
+		for (unsigned i = 0; i < n; i++)
+			moved->jobj_order[i] = order[i] + (order[i] >= pos);
+		moved->jobj_order[n] = pos;
+	} else if ((err = _index_last(doc, moved)))
+		return err;
+
+	if ((err = _save(doc, &cv->jval_object, sizeof(cv->jval_object))))
+		return err;
+	cv->jval_object = moved;
+	return 0;
+}
+
+/**
+ * Remove a tuple from an object.
+ */
+static int
+_object_remove(struct json_doc * const doc, struct json_value * const cv,
+	       unsigned const pos)
+{
+	struct json_object * const obj = cv->jval_object;
+	unsigned const n = obj->jobj_length;
+	struct json_tuple * const t = obj->jobj_tuples;
+	uint32_t * const order = obj->jobj_order;
+	int err;
+
+	if (   (err = _save(doc, obj, sizeof(*obj)))
+	    || (err = _save(doc, &t[pos], sizeof(*t) * (n - pos)))
+	    || (order && (err = _save(doc, order, sizeof(*order) * n)))
+	    || (obj->jobj_slots && (err = _save(doc, obj->jobj_slots,
+			sizeof(uint32_t) * (obj->jobj_mask + 1)))))
+		return err;
+
+	memmove(&t[pos], &t[pos + 1], sizeof(*t) * (n - pos - 1));
+	obj->jobj_length--;
+
+	/* drop it from the document order */
+	if (order) {
+		unsigned j = 0;
+		for (unsigned i = 0; i < n; i++)
+			if (order[i] != pos)
+				order[j++] = order[i] - (order[i] > pos);
+	}
+
+	/* tuples after it have moved: index them again */
+	if (obj->jobj_slots)
+		_fill_index(obj, obj->jobj_slots, obj->jobj_mask + 1);
+	return 0;
+}
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                               Operations                                 //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/**
+ * Replace the value at a location that exists.
+ */
+static int
+_replace(struct json_doc * const doc, struct json_value * const root,
+	 struct _loc const * const loc, struct json_value const * const val)
+{
+	struct json_value * const dst = _value(root, loc);
+	int err;
+
+	/* the root is an object */
+	if (loc->loc_cv == NULL && val->jval_type != JSON_VAL_OBJECT)
+		return EINVAL;
+	if ((err = _save(doc, dst, sizeof(*dst))))
+		return err;
+	*dst = *val;
+	return 0;
+}
+
+/**
+ * Add a value at a location: insert it into an array, or set it in an
+ * object.
+ */
+static int
+_add(struct json_doc * const doc, struct json_value * const root,
+     struct _loc const * const loc, struct json_value const * const val)
+{
+	char const * key;
+	int err;
+
+	if (loc->loc_cv && loc->loc_cv->jval_type == JSON_VAL_ARRAY)
+		return _array_insert(doc, loc->loc_cv, loc->loc_pos, val);
+	if (loc->loc_found)
+		return _replace(doc, root, loc, val);
+
+	if (loc->loc_keylen > UINT_MAX)
+		return EINVAL;
+	if ((err = json_doc_string(doc, loc->loc_key, loc->loc_keylen, &key)))
+		return err;
+	struct json_tuple const tup = {
+		.jtup_key    = key,
+		.jtup_keylen = loc->loc_keylen,
+		.jtup_hash   = loc->loc_hash,
+		.jtup_val    = *val,
+	};
+	return _object_add(doc, loc->loc_cv, &tup);
+}
+
+/**
+ * Remove the value at a location, which is not the root.
+ */
+static int
+_remove(struct json_doc * const doc, struct _loc const * const loc)
+{
+	if (loc->loc_cv == NULL)
+		return EINVAL;
+	if (!loc->loc_found)
+		return ENOENT;
+	if (loc->loc_cv->jval_type == JSON_VAL_ARRAY)
+		return _array_remove(doc, loc->loc_cv, loc->loc_pos);
+	return _object_remove(doc, loc->loc_cv, loc->loc_pos);
+}
+
+/**
+ * Check whether a path is that of a value inside the value at another.
+ */
+static bool
+_inside(char const * const path, char const * const from)
+{
+	size_t const len = strlen(from);
+
+	return strncasecmp(path, from, len) == 0 && path[len] == '/';
+}
+
+/**
+ * Compare an integer with a double exactly: the double must be integral and
+ * in range, and is then compared as an integer.
+ */
+static bool
+_int_double_equal(struct json_value const * const a, double const d)
+{
+	if (a->jval_lit_type == JSON_LIT_INT)
+		return d >= -0x1p63 && d < 0x1p63
+		    && (double) (int64_t) d == d && (int64_t) d == a->jval_int;
+	return d >= 0 && d < 0x1p64
+	    && (double) (uint64_t) d == d && (uint64_t) d == a->jval_uint;
+}
+
+/**
+ * Compare literals. Numbers compare by value.
+ */
+static bool
+_literal_equal(struct json_value const * const a,
+	       struct json_value const * const b)
+{
+	enum json_literal_type const ta = a->jval_lit_type;
+	enum json_literal_type const tb = b->jval_lit_type;
+
+	if (ta == JSON_LIT_STRING || tb == JSON_LIT_STRING)
+		return ta == tb && strcmp(a->jval_lit, b->jval_lit) == 0;
+	if (ta == JSON_LIT_BOOL || tb == JSON_LIT_BOOL)
+		return ta == tb && a->jval_bool == b->jval_bool;
+	if (ta == JSON_LIT_NULL || tb == JSON_LIT_NULL)
+		return ta == tb;
+	if (ta == tb)
+		return ta == JSON_LIT_INT  ? a->jval_int  == b->jval_int
+		     : ta == JSON_LIT_UINT ? a->jval_uint == b->jval_uint
+		     : a->jval_double == b->jval_double;
+
+	/* mixed numbers: only doubles can equal integers */
+	if (ta == JSON_LIT_DOUBLE)
+		return _int_double_equal(b, a->jval_double);
+	if (tb == JSON_LIT_DOUBLE)
+		return _int_double_equal(a, b->jval_double);
+	return false;
+}
+
+/* Compare values, but not the values in containers */
+static bool
+_shallow_equal(struct json_value const * const a,
+	       struct json_value const * const b )
+{
+	if (a->jval_type != b->jval_type)
+		return false;
+
+	switch (a->jval_type) {
+	case JSON_VAL_LITERAL:
+		return _literal_equal(a, b);
+	case JSON_VAL_OBJECT:
+		return a->jval_object->jobj_length == b->jval_object->jobj_length;
+	case JSON_VAL_ARRAY:
+		return a->jval_array->jarr_length == b->jval_array->jarr_length;
+	}
+	return false;
+}
+
+/**
+ * Compare values: 0 if equal, ECANCELED if not.
+ *
+ * Objects compare regardless of the order of their keys. Nested containers
+ * are walked with a stack of frames.
+ */
+static int
+_equal(struct json_doc * const doc, struct json_value const * a,
+       struct json_value const * b )
+{
+	struct _pair inline_pairs[JSON_STACK_INLINE];
+	struct json_stack st;
+	int err = 0;
+
+	json_stack_init(&st, inline_pairs, sizeof(*inline_pairs),
+			doc->jdoc_alloc);
+	for (;;) {
+		if (!_shallow_equal(a, b)) {
+			err = ECANCELED;
+			break;
+		}
+		if (a->jval_type != JSON_VAL_LITERAL) {
+			struct _pair * const pr = json_stack_push(&st);
+			if (pr == NULL) {
+				err = errno;
+				break;
+			}
+			*pr = (struct _pair) { a, b, 0 };
+		}
+
+		/* next pair of values, past the containers compared */
+		struct _pair * pr;
+		while ((pr = json_stack_top(&st))) {
+			unsigned const len = pr->pr_a->jval_type == JSON_VAL_OBJECT
+				? pr->pr_a->jval_object->jobj_length
+				: pr->pr_a->jval_array->jarr_length;
+			if (pr->pr_next < len)
+				break;
+			json_stack_pop(&st);
+		}
+		if (pr == NULL)
+			break;
+
+		unsigned const i = pr->pr_next++;
+		if (pr->pr_a->jval_type == JSON_VAL_OBJECT) {
+			struct json_tuple const * const t =
+				&pr->pr_a->jval_object->jobj_tuples[i];
+			struct json_tuple const * const u = json_object_find(
+				pr->pr_b->jval_object, t->jtup_key,
+				t->jtup_keylen, t->jtup_hash);
+			if (u == NULL) {
+				err = ECANCELED;
+				break;
+			}
+			a = &t->jtup_val;
+			b = &u->jtup_val;
+		} else {
+			a = &pr->pr_a->jval_array->jarr_values[i];
+			b = &pr->pr_b->jval_array->jarr_values[i];
+		}
+	}
+
+	json_stack_release(&st);
+	return err;
+}
+
+/**
+ * Patch operations.
+ */
+enum _op {
+	OP_ADD,
+	OP_REMOVE,
+	OP_REPLACE,
+	OP_MOVE,
+	OP_COPY,
+	OP_TEST,
+};
+
+/**
+ * Run an operation, journaled.
+ *
+ * The value, if any, is copied into the document unless it is moved there.
+ * The root object is held in a value of the caller's, which outlives the
+ * journal, so that the root can be replaced like any other value.
+ */
+static int
+_op(struct json_doc * const doc, struct json_value * const root,
+    enum _op const op, char const * const path, char const * const from,
+    struct json_value const * const val)
+{
+	struct json_value v;
+	struct _loc loc;
+	int err = 0;
+
+	switch (op) {
+	case OP_ADD:
+	case OP_REPLACE:
+		if ((err = json_doc_copy_value(doc, val, &v)))
+			return err;
+		if ((err = _resolve(doc, root, path, &loc)))
+			return err;
+		if (op == OP_ADD)
+			err = _add(doc, root, &loc, &v);
+		else if (!loc.loc_found)
+			err = ENOENT;
+		else
+			err = _replace(doc, root, &loc, &v);
+		break;
+
+	case OP_REMOVE:
+		if ((err = _resolve(doc, root, path, &loc)))
+			return err;
+		err = _remove(doc, &loc);
+		break;
+
+	case OP_MOVE:
+	case OP_COPY:
+		if ((err = _resolve(doc, root, from, &loc)))
+			return err;
+		if (!loc.loc_found)
+			return ENOENT;
+		if (op == OP_MOVE && strcasecmp(from, path) == 0)
+			return 0;
+		if (op == OP_MOVE && _inside(path, from))
+			return EINVAL;
+		if (op == OP_COPY)
+			err = json_doc_copy_value(doc, _value(root, &loc), &v);
+		else {
+			v = *_value(root, &loc);
+			err = _remove(doc, &loc);
+		}
+		if (   err
+		    || (err = _resolve(doc, root, path, &loc)))
+			return err;
+		err = _add(doc, root, &loc, &v);
+		break;
+
+	case OP_TEST:
+		if ((err = _resolve(doc, root, path, &loc)))
+			return err;
+		if (!loc.loc_found)
+			return ENOENT;
+		return _equal(doc, _value(root, &loc), val);
+	}
+
+	/* the root may have been replaced or moved */
+	if (err == 0 && root->jval_object != doc->jdoc_obj
+	    && (err = _save(doc, &doc->jdoc_obj, sizeof(doc->jdoc_obj))) == 0)
+		doc->jdoc_obj = root->jval_object;
+	return err;
+}
+
+/**
+ * Run a single operation, all or nothing.
+ */
+static int
+_edit(struct json_doc * const doc, enum _op const op, char const * const path,
+      char const * const from, struct json_value const * const val)
+{
+	struct json_value root = {
+		.jval_type   = JSON_VAL_OBJECT,
+		.jval_object = doc->jdoc_obj,
+	};
+	int const err = _op(doc, &root, op, path, from, val);
+
+	if (err)
+		_undo(doc, 0);
+	doc->jdoc_undo_len = 0;
+	return err;
+}
+
+int
+json_doc_insert(struct json_doc * const doc, char const * const path,
+		struct json_value const * const val)
+{
+	return _edit(doc, OP_ADD, path, NULL, val);
+}
+
+int
+json_doc_set(struct json_doc * const doc, char const * const path,
+	     struct json_value const * const val)
+{
+	return _edit(doc, OP_REPLACE, path, NULL, val);
+}
+
+int
+json_doc_remove(struct json_doc * const doc, char const * const path)
+{
+	return _edit(doc, OP_REMOVE, path, NULL, NULL);
+}
+
+int
+json_doc_move(struct json_doc * const doc, char const * const from,
+	      char const * const path)
+{
+	return _edit(doc, OP_MOVE, path, from, NULL);
+}
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                                 Patch                                    //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/* Operation names */
+static char const * const _op_names[] = {
+	[OP_ADD]     = "add",
+	[OP_REMOVE]  = "remove",
+	[OP_REPLACE] = "replace",
+	[OP_MOVE]    = "move",
+	[OP_COPY]    = "copy",
+	[OP_TEST]    = "test",
+};
+
+/* Member of a patch operation */
+static struct json_value const *
+_member(struct json_object const * const obj, char const * const name)
+{
+	size_t const len = strlen(name);
+	struct json_tuple const * const tup =
+		json_object_find(obj, name, len, json_key_hash(name, len));
+
+	return tup ? &tup->jtup_val : NULL;
+}
+
+/* String member of a patch operation */
+static char const *
+_string(struct json_object const * const obj, char const * const name)
+{
+	struct json_value const * const val = _member(obj, name);
+
+	return val && val->jval_type == JSON_VAL_LITERAL
+	    && val->jval_lit_type == JSON_LIT_STRING ? val->jval_lit : NULL;
+}
+
+/**
+ * Decode and run a patch operation.
+ */
+static int
+_patch_op(struct json_doc * const doc, struct json_value * const root,
+	  struct json_value const * const opv)
+{
+	struct json_object const * obj;
+	char const * name;
+	char const * path;
+	char const * from = NULL;
+	struct json_value const * val = NULL;
+	unsigned op;
+
+	if (opv->jval_type != JSON_VAL_OBJECT)
+		return EINVAL;
+	obj = opv->jval_object;
+	if (   (name = _string(obj, "op"))   == NULL
+	    || (path = _string(obj, "path")) == NULL)
+		return EINVAL;
+
+	for (op = 0; op < sizeof(_op_names) / sizeof(*_op_names); op++)
+		if (strcmp(name, _op_names[op]) == 0)
+			break;
+	switch (op) {
+	case OP_ADD:
+	case OP_REPLACE:
+	case OP_TEST:
+		if ((val = _member(obj, "value")) == NULL)
+			return EINVAL;
+		break;
+	case OP_MOVE:
+	case OP_COPY:
+		if ((from = _string(obj, "from")) == NULL)
+			return EINVAL;
+		break;
+	case OP_REMOVE:
+		break;
+	default:
+		return EINVAL;
+	}
+
+	return _op(doc, root, op, path, from, val);
+}
+
+int
+json_patch_apply(struct json_doc * const doc,
+		 struct json_array const * const patch)
+{
+	struct json_value root = {
+		.jval_type   = JSON_VAL_OBJECT,
+		.jval_object = doc->jdoc_obj,
+	};
+	int err = 0;
+
+	for (unsigned i = 0; i < patch->jarr_length && err == 0; i++)
+		err = _patch_op(doc, &root, &patch->jarr_values[i]);
+
+	if (err)
+		_undo(doc, 0);
+	doc->jdoc_undo_len = 0;
+	return err;
+}
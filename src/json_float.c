@@ -0,0 +1,328 @@
+/*
+ * json_float.c
+ *
+ * Simple JSON parser.
+ *
+ * https://github.com/e03213ac/libjson
+ *
+ * This work belongs to the Public Domain. Everyone is free to use, modify,
+ * republish, sell or give away this work without prior consent from anybody.
+ *
+ * This software is provided on an "AS IS" basis, without warranty of any kind.
+ * Use at your own risk! Under no circumstances shall the author(s) or
+ * contributor(s) be liable for damages resulting directly or indirectly from
+ * the use or non-use of this documentation.
+ */
+
+/*
+ * Decimal to binary64 conversion.
+ *
+ * The first 19 significant digits of the decimal mantissa are accumulated,
+ * eight at a time where possible. Small values that are exactly
+ * representable take Clinger's fast path: a single multiplication or
+ * division, correctly rounded by the FPU. Everything else goes through the
+ * Eisel-Lemire algorithm, which multiplies the mantissa by a 128-bit
+ * approximation of the power of ten; this always rounds correctly for
+ * mantissas of up to 19 digits.
+ *
+ * Longer mantissas are truncated. If rounding the truncated mantissa and its
+ * successor gives the same result, that is the answer; otherwise, which is
+ * very rare, the conversion falls back on strtod() in the C locale.
+ */
+
+#include <float.h>
+#include <locale.h>
+#include <math.h>
+
+/* Private API */
+#include "json_private.h"
+
+/* Binary64 format */
+#define MANTISSA_BITS   52
+#define EXPONENT_BIAS   1023
+#define EXPONENT_INF    0x7ff
+
+/* Smallest 19-digit integer */
+#define NINETEEN_DIGITS 1000000000000000000ull
+
+/* Exactly representable powers of ten */
+static double const _pow10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/**
+ * A decimal number, w * 10^q.
+ */
+struct _decimal {
+	uint64_t               w;             // significant digits
+	int64_t                q;             // decimal exponent
+	bool                   neg;           // negative
+	bool                   truncated;     // more significant digits follow
+};
+
+/**
+ * A binary64 number, before its sign is applied.
+ */
+struct _binary {
+	uint64_t               m;             // mantissa
+	int32_t                e;             // biased exponent
+};
+
+/* Load eight characters, first one in the low byte */
+static inline uint64_t
+_load8(char const * const p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+/* Check whether eight characters are all digits */
+static inline bool
+_is_eight_digits(uint64_t const v)
+{
+	return !(((v + 0x4646464646464646ull) | (v - 0x3030303030303030ull))
+		 & 0x8080808080808080ull);
+}
+
+/* Convert eight digits */
+static inline uint32_t
+_eight_digits(uint64_t v)
+{
+	uint64_t const mask = 0x000000ff000000ffull;
+	uint64_t const mul1 = 100 + (1000000ull << 32);
+	uint64_t const mul2 = 1 + (10000ull << 32);
+
+	v -= 0x3030303030303030ull;
+	v = v * 10 + (v >> 8);                  // pairs of digits
+	v = ((v & mask) * mul1 + (v >> 16 & mask) * mul2) >> 32;
+	return v;
+}
+
+/* Accumulate a run of digits, eight at a time while possible */
+static inline char const *
+_digits(char const * p, char const * const e, uint64_t * const w)
+{
+	uint64_t x = *w;
+
+	while (e - p >= 8 && _is_eight_digits(_load8(p))) {
+		x = x * 100000000 + _eight_digits(_load8(p));
+		p += 8;
+	}
+	for (; p < e && *p >= '0' && *p <= '9'; p++)
+		x = x * 10 + (*p - '0');
+
+	*w = x;
+	return p;
+}
+
+/**
+ * Parse a decimal number.
+ *
+ * The syntax is that of strtod(), without the leading whitespace,
+ * hexadecimal numbers, infinities and NaNs.
+ */
+static int
+_parse_decimal(char const * p, char const * const e, struct _decimal * const d)
+{
+	char const * digits;
+	char const * frac = NULL;
+	size_t nint, nfrac = 0, n;
+	int64_t x = 0;
+
+	*d = (struct _decimal) { 0 };
+	if (p < e && (*p == '-' || *p == '+'))
+		d->neg = *p++ == '-';
+
+	/* integer part */
+	digits = p;
+	p = _digits(p, e, &d->w);
+	nint = p - digits;
+
+	/* fractional part */
+	if (p < e && *p == '.') {
+		frac = ++p;
+		p = _digits(p, e, &d->w);
+		nfrac = p - frac;
+	}
+	if (nint + nfrac == 0)
+		return EINVAL;
+
+	/* exponent, saturated well beyond the range of doubles */
+	if (p < e && (*p == 'e' || *p == 'E')) {
+		bool neg = false;
+		if (++p < e && (*p == '-' || *p == '+'))
+			neg = *p++ == '-';
+		if (p == e || *p < '0' || *p > '9')
+			return EINVAL;
+		for (; p < e && *p >= '0' && *p <= '9'; p++)
+			if (x < 100000000)
+				x = x * 10 + (*p - '0');
+		if (neg)
+			x = -x;
+	}
+	if (p != e)
+		return EINVAL;
+	d->q = x - (int64_t) nfrac;
+
+	/* the mantissa may have wrapped around: count significant digits */
+	n = nint + nfrac;
+	if (n <= 19)
+		return 0;
+	for (char const * s = digits; s < p && (*s == '0' || *s == '.'); s++)
+		if (*s == '0')
+			n--;
+	if (n <= 19)
+		return 0;
+
+	/* keep the first 19 significant digits */
+	char const * s = digits;
+	d->w = 0;
+	for (; d->w < NINETEEN_DIGITS && s < digits + nint; s++)
+		d->w = d->w * 10 + (*s - '0');
+	if (d->w >= NINETEEN_DIGITS)
+		d->q = x + (digits + nint - s);
+	else {
+		for (s = frac; d->w < NINETEEN_DIGITS && s < frac + nfrac; s++)
+			d->w = d->w * 10 + (*s - '0');
+		d->q = x - (s - frac);
+	}
+	d->truncated = true;
+	return 0;
+}
+
+/**
+ * Round w * 10^q to binary64 with the Eisel-Lemire algorithm.
+ */
+static struct _binary
+_eisel_lemire(int64_t const q, uint64_t w)
+{
+	uint64_t const * pow5;
+
+	if (w == 0 || q < JSON_POW5_MIN)
+		return (struct _binary) { 0, 0 };
+	if (q > JSON_POW5_MAX)
+		return (struct _binary) { 0, EXPONENT_INF };
+
+	/* normalize the mantissa */
+	int const lz = __builtin_clzll(w);
+	w <<= lz;
+
+	/* multiply by the power of five; refine if the low bits are unsure */
+	pow5 = json_pow5[q - JSON_POW5_MIN];
+	unsigned __int128 const p = (unsigned __int128) w * pow5[0];
+	uint64_t hi = p >> 64;
+	uint64_t lo = p;
+	if ((hi & 0x1ff) == 0x1ff) {
+		uint64_t const hi2 = (unsigned __int128) w * pow5[1] >> 64;
+		lo += hi2;
+		if (hi2 > lo)
+			hi++;
+	}
+
+	/* keep one bit beyond the mantissa, for rounding */
+	int const upper = hi >> 63;
+	int const shift = upper + 64 - MANTISSA_BITS - 3;
+	uint64_t m = hi >> shift;
+	int32_t  e = ((152170 + 65536) * q >> 16) + 63 + upper - lz
+		   + EXPONENT_BIAS;
+
+	/* subnormal */
+	if (e <= 0) {
+		if (-e + 1 >= 64)
+			return (struct _binary) { 0, 0 };
+		m >>= -e + 1;
+		m += m & 1;
+		m >>= 1;
+		e = m < (1ull << MANTISSA_BITS) ? 0 : 1;
+		return (struct _binary) { m, e };
+	}
+
+	/* exactly halfway: round to even rather than up */
+	if (lo <= 1 && q >= -4 && q <= 23 && (m & 3) == 1
+	    && m << shift == hi)
+		m &= ~1ull;
+
+	m += m & 1;
+	m >>= 1;
+	if (m >= 2ull << MANTISSA_BITS) {
+		m = 1ull << MANTISSA_BITS;
+		e++;
+	}
+	m &= ~(1ull << MANTISSA_BITS);
+	if (e >= EXPONENT_INF)
+		return (struct _binary) { 0, EXPONENT_INF };
+	return (struct _binary) { m, e };
+}
+
+/**
+ * Convert with strtod() in the C locale.
+ */
+static int
+_slow_path(char const * const s, size_t const len, double * const val)
+{
+	static locale_t c_locale;
+	char buf[128];
+	char * str = buf;
+	locale_t loc;
+
+	/* strtod() needs a terminated string */
+	if (len >= sizeof(buf) && (str = malloc(len + 1)) == NULL)
+		return errno;
+	memcpy(str, s, len);
+	str[len] = '\0';
+
+	if ((loc = __atomic_load_n(&c_locale, __ATOMIC_ACQUIRE)) == NULL) {
+		locale_t const nloc = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+		if (nloc && !__atomic_compare_exchange_n(&c_locale, &loc, nloc,
+				false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			freelocale(nloc);
+		else
+			loc = nloc;
+	}
+	*val = loc ? strtod_l(str, NULL, loc) : strtod(str, NULL);
+
+	if (str != buf)
+		free(str);
+	return isinf(*val) ? ERANGE : 0;
+}
+
+int
+json_str2double(char const * const s, size_t const len, double * const val)
+{
+	struct _decimal d;
+	struct _binary b;
+	int err;
+
+	if ((err = _parse_decimal(s, s + len, &d)))
+		return err;
+
+#if FLT_EVAL_METHOD == 0
+	/* both operands exact: the FPU rounds correctly */
+	if (!d.truncated && d.q >= -22 && d.q <= 22
+	    && d.w <= 1ull << (MANTISSA_BITS + 1)) {
+		double const v = d.q < 0 ? (double) d.w / _pow10[-d.q]
+					 : (double) d.w * _pow10[d.q];
+		*val = d.neg ? -v : v;
+		return 0;
+	}
+#endif
+
+	b = _eisel_lemire(d.q, d.w);
+	if (d.truncated) {
+		struct _binary const b1 = _eisel_lemire(d.q, d.w + 1);
+		if (b1.m != b.m || b1.e != b.e)
+			return _slow_path(s, len, val);
+	}
+
+	uint64_t const bits = b.m
+			    | (uint64_t) b.e << MANTISSA_BITS
+			    | (uint64_t) d.neg << 63;
+	memcpy(val, &bits, sizeof(*val));
+	return b.e == EXPONENT_INF ? ERANGE : 0;
+}
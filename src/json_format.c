@@ -0,0 +1,324 @@
+/*
+ * json_format.c
+ *
+ * Simple JSON parser.
+ *
+ * https://github.com/e03213ac/libjson
+ *
+ * This work belongs to the Public Domain. Everyone is free to use, modify,
+ * republish, sell or give away this work without prior consent from anybody.
+ *
+ * This software is provided on an "AS IS" basis, without warranty of any kind.
+ * Use at your own risk! Under no circumstances shall the author(s) or
+ * contributor(s) be liable for damages resulting directly or indirectly from
+ * the use or non-use of this documentation.
+ */
+
+/*
+ * Number to text conversion.
+ *
+ * Integers are written backwards, two digits at a time, from a table of all
+ * the pairs of digits.
+ *
+ * Doubles are written with the fewest significant digits that read back to
+ * the same value, closest to it on ties, with the Ryu algorithm: the value
+ * and the halfway points to its neighbours are scaled by a power of ten, one
+ * 64x128-bit multiplication each, and digits are removed for as long as the
+ * scaled halfway points still differ. The multipliers come from the table of
+ * powers of five of the parser, which has more precision than Ryu needs.
+ */
+
+/* Private API */
+#include "json_private.h"
+
+/* Binary64 format */
+#define MANTISSA_BITS   52
+#define EXPONENT_BIAS   1023
+#define EXPONENT_INF    0x7ff
+
+/* The table has reciprocals of powers of five rounded up up to 5^-27 only */
+#define POW5_INV_ROUNDED 27
+
+/* Largest exponent written without an exponent part */
+#define FIXED_MAX       21
+
+/* Pairs of digits */
+static char const _pairs[200] =
+	"00010203040506070809" "10111213141516171819"
+	"20212223242526272829" "30313233343536373839"
+	"40414243444546474849" "50515253545556575859"
+	"60616263646566676869" "70717273747576777879"
+	"80818283848586878889" "90919293949596979899";
+
+/* Number of decimal digits */
+static inline unsigned
+_length(uint64_t const v)
+{
+	unsigned n = 1;
+
+	for (uint64_t p = 10; n < 20 && v >= p; p *= 10)
+		n++;
+	return n;
+}
+
+/**
+ * Write the digits of an integer, backwards from e.
+ */
+static inline void
+_digits(uint64_t v, char * e)
+{
+	while (v >= 100) {
+		unsigned const r = v % 100;
+		v /= 100;
+		e -= 2;
+		memcpy(e, &_pairs[r * 2], 2);
+	}
+	if (v >= 10)
+		memcpy(e - 2, &_pairs[v * 2], 2);
+	else
+		e[-1] = '0' + v;
+}
+
+size_t
+json_format_uint64(uint64_t const v, char * const buf)
+{
+	unsigned const n = _length(v);
+
+	_digits(v, buf + n);
+	return n;
+}
+
+size_t
+json_format_int64(int64_t const v, char * const buf)
+{
+	if (v >= 0)
+		return json_format_uint64(v, buf);
+
+	*buf = '-';
+	return json_format_uint64(-(uint64_t) v, buf + 1) + 1;
+}
+
+/* ceil(log2(5^e)), or 1 for e = 0 */
+static inline int32_t
+_pow5bits(int32_t const e)
+{
+	return ((uint32_t) e * 1217359 >> 19) + 1;
+}
+
+/* floor(log10(2^e)) */
+static inline int32_t
+_log10pow2(int32_t const e)
+{
+	return (uint32_t) e * 78913 >> 18;
+}
+
+/* floor(log10(5^e)) */
+static inline int32_t
+_log10pow5(int32_t const e)
+{
+	return (uint32_t) e * 732923 >> 20;
+}
+
+/* Check whether v is a multiple of 5^p */
+static inline bool
+_multiple_of_pow5(uint64_t v, int32_t const p)
+{
+	int32_t n = 0;
+
+	for (; v % 5 == 0; v /= 5)
+		n++;
+	return n >= p;
+}
+
+/* Check whether v is a multiple of 2^p */
+static inline bool
+_multiple_of_pow2(uint64_t const v, int32_t const p)
+{
+	return (v & ((1ull << p) - 1)) == 0;
+}
+
+/* floor(m * mul / 2^j), for a 128-bit mul, high half first */
+static inline uint64_t
+_mulshift(uint64_t const m, uint64_t const mul[2], int32_t const j)
+{
+	unsigned __int128 const lo = (unsigned __int128) m * mul[1];
+	unsigned __int128 const hi = (unsigned __int128) m * mul[0];
+
+	return (hi + (lo >> 64)) >> (j - 64);
+}
+
+/**
+ * Find the shortest decimal w * 10^q that reads back as the given binary64,
+ * of mantissa and biased exponent ieee_m and ieee_e.
+ */
+static void
+_shortest(uint64_t const ieee_m, int32_t const ieee_e,
+	  uint64_t * const w, int32_t * const q10 )
+{
+	int32_t  e2;
+	uint64_t m2;
+
+	if (ieee_e == 0) {
+		e2 = 1 - EXPONENT_BIAS - MANTISSA_BITS - 2;
+		m2 = ieee_m;
+	} else {
+		e2 = ieee_e - EXPONENT_BIAS - MANTISSA_BITS - 2;
+		m2 = (1ull << MANTISSA_BITS) | ieee_m;
+	}
+
+	/* integers need no scaling */
+	if (e2 + 2 <= 0 && e2 + 2 >= -MANTISSA_BITS
+	    && _multiple_of_pow2(m2, -(e2 + 2))) {
+		uint64_t v = m2 >> -(e2 + 2);
+		int32_t  q = 0;
+		for (; v % 10 == 0; v /= 10)
+			q++;
+		*w = v;
+		*q10 = q;
+		return;
+	}
+
+	/* the value, and the halfway points to its neighbours, times 4 */
+	bool const even = (m2 & 1) == 0;
+	uint64_t const mv = 4 * m2;
+	uint32_t const mm_shift = ieee_m != 0 || ieee_e <= 1;
+	uint64_t vr, vp, vm;
+	int32_t e10;
+	bool vm_zeros = false;      // vm is exact and ends in zeros
+	bool vr_zeros = false;      // so does vr, and what was removed
+
+	if (e2 >= 0) {
+		/* divide by 10^q: multiply by the reciprocal of 5^q */
+		int32_t const q = _log10pow2(e2) - (e2 > 3);
+		int32_t const j = 127 + _pow5bits(q) - (q == 0) - e2 + q;
+		uint64_t const * const t = json_pow5[-q - JSON_POW5_MIN];
+		uint64_t mul[2] = { t[0], t[1] };
+		if (q > POW5_INV_ROUNDED && ++mul[1] == 0)
+			mul[0]++;
+		e10 = q;
+		vr = _mulshift(mv, mul, j);
+		vp = _mulshift(mv + 2, mul, j);
+		vm = _mulshift(mv - 1 - mm_shift, mul, j);
+		if (q <= 21) {
+			if (mv % 5 == 0)
+				vr_zeros = _multiple_of_pow5(mv, q);
+			else if (even)
+				vm_zeros = _multiple_of_pow5(mv - 1 - mm_shift, q);
+			else
+				vp -= _multiple_of_pow5(mv + 2, q);
+		}
+	} else {
+		/* multiply by 5^i, divide by 2^q */
+		int32_t const q = _log10pow5(-e2) - (-e2 > 1);
+		int32_t const i = -e2 - q;
+		int32_t const j = q + 128 - _pow5bits(i);
+		uint64_t const * const mul = json_pow5[i - JSON_POW5_MIN];
+		e10 = q + e2;
+		vr = _mulshift(mv, mul, j);
+		vp = _mulshift(mv + 2, mul, j);
+		vm = _mulshift(mv - 1 - mm_shift, mul, j);
+		if (q <= 1) {
+			vr_zeros = true;
+			if (even)
+				vm_zeros = mm_shift == 1;
+			else
+				vp--;
+		} else if (q < 63)
+			vr_zeros = _multiple_of_pow2(mv, q);
+	}
+
+	/* remove digits while the interval tells them apart */
+	int32_t removed = 0;
+	unsigned last = 0;
+	uint64_t out;
+	if (vm_zeros || vr_zeros) {
+		for (; vp / 10 > vm / 10; removed++) {
+			vm_zeros &= vm % 10 == 0;
+			vr_zeros &= last == 0;
+			last = vr % 10;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+		}
+		if (vm_zeros)
+			for (; vm % 10 == 0; removed++) {
+				vr_zeros &= last == 0;
+				last = vr % 10;
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+			}
+		/* exactly halfway: round to even */
+		if (vr_zeros && last == 5 && vr % 2 == 0)
+			last = 4;
+		out = vr + ((vr == vm && (!even || !vm_zeros)) || last >= 5);
+	} else {
+		bool up = false;
+		for (; vp / 10 > vm / 10; removed++) {
+			up = vr % 10 >= 5;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+		}
+		out = vr + (vr == vm || up);
+	}
+
+	*w = out;
+	*q10 = e10 + removed;
+}
+
+size_t
+json_format_double(double const d, char * const buf)
+{
+	uint64_t bits;
+	uint64_t w;
+	int32_t q;
+	char * p = buf;
+
+	memcpy(&bits, &d, sizeof(bits));
+	uint64_t const ieee_m = bits & ((1ull << MANTISSA_BITS) - 1);
+	int32_t const ieee_e = bits >> MANTISSA_BITS & EXPONENT_INF;
+	if (ieee_e == EXPONENT_INF)
+		return 0;
+
+	if (bits >> 63)
+		*p++ = '-';
+	if (ieee_e == 0 && ieee_m == 0) {
+		memcpy(p, "0.0", 3);
+		return p + 3 - buf;
+	}
+	_shortest(ieee_m, ieee_e, &w, &q);
+
+	/* always with a point or an exponent, to read back as a double */
+	int32_t const n = _length(w);
+	int32_t const dp = n + q;               // position of the point
+	if (n <= dp && dp <= FIXED_MAX) {
+		/* ddd000.0 */
+		_digits(w, p + n);
+		memset(p + n, '0', dp - n);
+		memcpy(p + dp, ".0", 2);
+		p += dp + 2;
+	} else if (0 < dp && dp < n) {
+		/* ddd.ddd */
+		_digits(w, p + n + 1);
+		memmove(p, p + 1, dp);
+		p[dp] = '.';
+		p += n + 1;
+	} else if (-6 < dp && dp <= 0) {
+		/* 0.000ddd */
+		memcpy(p, "0.", 2);
+		memset(p + 2, '0', -dp);
+		p += 2 - dp + n;
+		_digits(w, p);
+	} else {
+		/* d.ddde-ddd */
+		_digits(w, p + n + 1);
+		p[0] = p[1];
+		p[1] = '.';
+		p += n == 1 ? 1 : n + 1;
+		*p++ = 'e';
+		p += json_format_int64(dp - 1, p);
+	}
+
+	return p - buf;
+}
@@ -0,0 +1,308 @@
+/*
+ * json_index.c
+ *
+ * Simple JSON parser.
+ *
+ * https://github.com/e03213ac/libjson
+ *
+ * This work belongs to the Public Domain. Everyone is free to use, modify,
+ * republish, sell or give away this work without prior consent from anybody.
+ *
+ * This software is provided on an "AS IS" basis, without warranty of any kind.
+ * Use at your own risk! Under no circumstances shall the author(s) or
+ * contributor(s) be liable for damages resulting directly or indirectly from
+ * the use or non-use of this documentation.
+ */
+
+/*
+ * Structural index.
+ *
+ * The input is classified 64 bytes at a time into bitmasks of whitespace,
+ * punctuation, quotes and backslashes. Bitwise arithmetic on those masks
+ * then finds which bytes lie inside strings, and yields the offset of every
+ * token start: punctuation and opening quotes outside strings, and the first
+ * character of every unquoted literal.
+ *
+ * The classification step is vectorized (SSE2, AVX2 or AVX-512, selected at
+ * run time) with a portable scalar fallback.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+/* Private API */
+#include "json_private.h"
+
+/* Size of a block */
+#define BLOCK 64
+
+/**
+ * Character classes of a block, one bit per byte.
+ */
+struct _block {
+	uint64_t               ws;            // whitespace
+	uint64_t               op;            // { } [ ] : ,
+	uint64_t               quote;         // "
+	uint64_t               bslash;        // backslash
+};
+
+/**
+ * State carried from one block to the next.
+ */
+struct _carry {
+	uint64_t               escaped;       // first byte is escaped
+	uint64_t               in_string;     // all ones inside a string
+	uint64_t               scalar;        // last byte was a literal char
+};
+
+/* Prefix XOR: bit i is the parity of bits 0..i */
+static inline uint64_t
+_prefix_xor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+/**
+ * Find escaped characters.
+ *
+ * A backslash escapes the next character unless it is itself escaped.
+ * Backslashes are rare, so this walks them one at a time.
+ */
+static inline uint64_t
+_escaped(uint64_t const bslash, struct _carry * const cy)
+{
+	uint64_t esc = cy->escaped;
+	uint64_t bs = bslash & ~esc;
+
+	cy->escaped = 0;
+	while (bs) {
+		uint64_t const bit  = bs & -bs;
+		uint64_t const next = bit << 1;
+		if (next == 0)
+			cy->escaped = 1;
+		esc |= next;
+		bs &= ~(bit | next);
+	}
+
+	return esc;
+}
+
+/**
+ * Turn the character classes of a block into token starts.
+ */
+static inline uint64_t
+_token_starts(struct _block const * const b, struct _carry * const cy)
+{
+	uint64_t const esc = b->bslash || cy->escaped
+			   ? _escaped(b->bslash, cy) : 0;
+	uint64_t const quote = b->quote & ~esc;
+
+	/* bytes from an opening quote up to its closing quote */
+	uint64_t const in_string = _prefix_xor(quote) ^ cy->in_string;
+	cy->in_string = (uint64_t) ((int64_t) in_string >> 63);
+
+	/* unquoted literals: runs of anything else */
+	uint64_t const scalar = ~(b->ws | b->op | b->quote | in_string);
+	uint64_t const scalar_start = scalar & ~(scalar << 1 | cy->scalar);
+	cy->scalar = scalar >> 63;
+
+	return (b->op & ~in_string) | (quote & in_string) | scalar_start;
+}
+
+/* Portable classifier */
+static inline void
+_classify_scalar(char const * const p, struct _block * const b)
+{
+	*b = (struct _block) { 0 };
+	for (unsigned i = 0; i < BLOCK; i++) {
+		uint64_t const bit = (uint64_t) 1 << i;
+		switch (p[i]) {
+		case ' ': case '\t': case '\n': case '\v': case '\f': case '\r':
+			b->ws |= bit;
+			break;
+		case '{': case '}': case '[': case ']': case ':': case ',':
+			b->op |= bit;
+			break;
+		case '"':
+			b->quote |= bit;
+			break;
+		case '\\':
+			b->bslash |= bit;
+			break;
+		}
+	}
+}
+
+#ifdef HAVE_X86
+/* SSE2 classifier */
+static inline void
+_classify_sse2(char const * const p, struct _block * const b)
+{
+	*b = (struct _block) { 0 };
+	for (unsigned i = 0; i < BLOCK; i += 16) {
+		__m128i const c = _mm_loadu_si128((__m128i const *) (p + i));
+#define EQ(x) _mm_cmpeq_epi8(c, _mm_set1_epi8(x))
+		__m128i const ws = _mm_or_si128(EQ(' '), _mm_and_si128(
+			_mm_cmpgt_epi8(c, _mm_set1_epi8('\t' - 1)),
+			_mm_cmplt_epi8(c, _mm_set1_epi8('\r' + 1))));
+		__m128i const op = _mm_or_si128(
+			_mm_or_si128(_mm_or_si128(EQ('{'), EQ('}')),
+				     _mm_or_si128(EQ('['), EQ(']'))),
+			_mm_or_si128(EQ(':'), EQ(',')));
+		b->ws     |= (uint64_t) (uint16_t) _mm_movemask_epi8(ws) << i;
+		b->op     |= (uint64_t) (uint16_t) _mm_movemask_epi8(op) << i;
+		b->quote  |= (uint64_t) (uint16_t)
+			     _mm_movemask_epi8(EQ('"')) << i;
+		b->bslash |= (uint64_t) (uint16_t)
+			     _mm_movemask_epi8(EQ('\\')) << i;
+#undef EQ
+	}
+}
+
+/* AVX2 classifier */
+static inline __attribute__((target("avx2"))) void
+_classify_avx2(char const * const p, struct _block * const b)
+{
+	*b = (struct _block) { 0 };
+	for (unsigned i = 0; i < BLOCK; i += 32) {
+		__m256i const c = _mm256_loadu_si256((__m256i const *) (p + i));
+#define EQ(x) _mm256_cmpeq_epi8(c, _mm256_set1_epi8(x))
+		__m256i const ws = _mm256_or_si256(EQ(' '), _mm256_and_si256(
+			_mm256_cmpgt_epi8(c, _mm256_set1_epi8('\t' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), c)));
+		__m256i const op = _mm256_or_si256(
+			_mm256_or_si256(_mm256_or_si256(EQ('{'), EQ('}')),
+					_mm256_or_si256(EQ('['), EQ(']'))),
+			_mm256_or_si256(EQ(':'), EQ(',')));
+		b->ws     |= (uint64_t) (uint32_t)
+			     _mm256_movemask_epi8(ws) << i;
+		b->op     |= (uint64_t) (uint32_t)
+			     _mm256_movemask_epi8(op) << i;
+		b->quote  |= (uint64_t) (uint32_t)
+			     _mm256_movemask_epi8(EQ('"')) << i;
+		b->bslash |= (uint64_t) (uint32_t)
+			     _mm256_movemask_epi8(EQ('\\')) << i;
+#undef EQ
+	}
+}
+
+/* AVX-512 classifier */
+static inline __attribute__((target("avx512f,avx512bw"))) void
+_classify_avx512(char const * const p, struct _block * const b)
+{
+	__m512i const c = _mm512_loadu_si512((void const *) p);
+#define EQ(x) _mm512_cmpeq_epi8_mask(c, _mm512_set1_epi8(x))
+	b->ws     = EQ(' ')
+		  | (  _mm512_cmpgt_epi8_mask(c, _mm512_set1_epi8('\t' - 1))
+		     & _mm512_cmplt_epi8_mask(c, _mm512_set1_epi8('\r' + 1)));
+	b->op     = EQ('{') | EQ('}') | EQ('[') | EQ(']') | EQ(':') | EQ(',');
+	b->quote  = EQ('"');
+	b->bslash = EQ('\\');
+#undef EQ
+}
+#endif
+
+/**
+ * Index a window of the input.
+ *
+ * Whole blocks are classified in place; the final partial block is padded
+ * with whitespace.
+ */
+#define DEFINE_INDEX(name, attr, classify) \
+static attr size_t \
+name(char const * const p, size_t const n, uint32_t * const out) \
+{ \
+	struct _carry cy = { 0 }; \
+	struct _block b; \
+	uint32_t * o = out; \
+	size_t i; \
+\
+	for (i = 0; i < n; i += BLOCK) { \
+		char tail[BLOCK]; \
+		char const * q = p + i; \
+		if (n - i < BLOCK) { \
+			memset(tail, ' ', BLOCK); \
+			memcpy(tail, q, n - i); \
+			q = tail; \
+		} \
+		classify(q, &b); \
+		for (uint64_t s = _token_starts(&b, &cy); s; s &= s - 1) \
+			*o++ = i + __builtin_ctzll(s); \
+	} \
+\
+	return o - out; \
+}
+
+DEFINE_INDEX(_index_scalar, , _classify_scalar)
+#ifdef HAVE_X86
+DEFINE_INDEX(_index_sse2, , _classify_sse2)
+DEFINE_INDEX(_index_avx2, __attribute__((target("avx2"))), _classify_avx2)
+DEFINE_INDEX(_index_avx512, __attribute__((target("avx512f,avx512bw"))),
+	     _classify_avx512)
+#endif
+
+/* Selected implementation */
+static size_t (*_index)(char const *, size_t, uint32_t *);
+
+/**
+ * Select the best implementation for this CPU.
+ */
+static size_t
+_index_select(char const * const p, size_t const n, uint32_t * const out)
+{
+	size_t (*fn)(char const *, size_t, uint32_t *) = _index_scalar;
+
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512bw"))
+		fn = _index_avx512;
+	else if (__builtin_cpu_supports("avx2"))
+		fn = _index_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		fn = _index_sse2;
+#endif
+
+	__atomic_store_n(&_index, fn, __ATOMIC_RELAXED);
+	return fn(p, n, out);
+}
+
+/**
+ * Index the window of the input starting at p.
+ *
+ * The window must start outside of any string.
+ */
+int
+json_index_window(struct json_index * const ix,
+		  struct json_allocator const * const alloc,
+		  char const * const p, char const * const e )
+{
+	size_t (*fn)(char const *, size_t, uint32_t *) =
+		__atomic_load_n(&_index, __ATOMIC_RELAXED) ? : _index_select;
+	size_t const len = e - p;
+	size_t const n = len < JSON_INDEX_WINDOW ? len : JSON_INDEX_WINDOW;
+
+	/* there are at most as many token starts as there are bytes */
+	if (ix->jix_size < n) {
+		uint32_t * const pos = json_mem_alloc(alloc,
+						      sizeof(uint32_t) * n);
+		if (pos == NULL)
+			return errno;
+		json_mem_free(alloc, ix->jix_pos);
+		ix->jix_pos  = pos;
+		ix->jix_size = n;
+	}
+
+	ix->jix_base = p;
+	ix->jix_end  = p + n;
+	ix->jix_p    = ix->jix_pos;
+	ix->jix_e    = ix->jix_pos + fn(p, n, ix->jix_pos);
+	return 0;
+}
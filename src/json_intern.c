@@ -0,0 +1,168 @@
+/*
+ * json_intern.c
+ *
+ * Simple JSON parser.
+ *
+ * https://github.com/e03213ac/libjson
+ *
+ * This work belongs to the Public Domain. Everyone is free to use, modify,
+ * republish, sell or give away this work without prior consent from anybody.
+ *
+ * This software is provided on an "AS IS" basis, without warranty of any kind.
+ * Use at your own risk! Under no circumstances shall the author(s) or
+ * contributor(s) be liable for damages resulting directly or indirectly from
+ * the use or non-use of this documentation.
+ */
+
+/* Private API */
+#include "json_private.h"
+
+/* Initial number of slots */
+#define INTERN_MIN_SLOTS 256
+
+/* Default maximum number of strings */
+#define INTERN_DEFAULT_MAX 65536
+
+int
+json_intern_new(unsigned const max, struct json_intern ** const newintern)
+{
+	return json_intern_new_alloc(max, NULL, newintern);
+}
+
+int
+json_intern_new_alloc(
+	unsigned                      const max,
+	struct json_allocator const * const alloc,
+	struct json_intern         ** const newintern )
+{
+	struct json_intern * in;
+	size_t const size = sizeof(*in->jint_slots) * INTERN_MIN_SLOTS;
+	int err;
+
+	if ((in = json_mem_alloc(alloc, sizeof(*in))) == NULL) {
+		err = errno;
+		goto fail;
+	}
+	*in = (struct json_intern) {
+		.jint_mask  = INTERN_MIN_SLOTS - 1,
+		.jint_max   = max ? max : INTERN_DEFAULT_MAX,
+		.jint_alloc = alloc,
+	};
+	if ((in->jint_slots = json_mem_alloc(alloc, size)) == NULL) {
+		err = errno;
+		goto fail_1;
+	}
+	memset(in->jint_slots, 0, size);
+	json_arena_init(&in->jint_arena, false, alloc);
+
+	*newintern = in;
+	return 0;
+
+fail_1:	json_mem_free(alloc, in);
+fail:	*newintern = NULL;
+	return err;
+}
+
+void
+json_intern_free(struct json_intern * const in)
+{
+	if (in == NULL)
+		return;
+	json_arena_release(&in->jint_arena);
+	json_mem_free(in->jint_alloc, in->jint_slots);
+	json_mem_free(in->jint_alloc, in);
+}
+
+/**
+ * Double the number of slots.
+ */
+static int
+_rehash(struct json_intern * const in)
+{
+	unsigned const size = 2 * (in->jint_mask + 1);
+	struct json_intern_slot * const slots =
+		json_mem_alloc(in->jint_alloc, sizeof(*slots) * size);
+
+	if (slots == NULL)
+		return errno;
+	memset(slots, 0, sizeof(*slots) * size);
+
+	for (unsigned i = 0; i <= in->jint_mask; i++) {
+		struct json_intern_slot const * const sl = &in->jint_slots[i];
+		if (sl->jis_str == NULL)
+			continue;
+		uint32_t h = sl->jis_hash & (size - 1);
+		while (slots[h].jis_str)
+			h = (h + 1) & (size - 1);
+		slots[h] = *sl;
+	}
+
+	json_mem_free(in->jint_alloc, in->jint_slots);
+	in->jint_slots = slots;
+	in->jint_mask = size - 1;
+	return 0;
+}
+
+int
+json_intern_lookup(
+	struct json_intern * const in,
+	char const * const s,
+	size_t const len,
+	uint32_t const hash,
+	char const ** const out )
+{
+	struct json_intern_slot * sl;
+	char * str;
+	uint32_t h;
+	int err;
+
+	/* look for the string */
+	for (h = hash & in->jint_mask;
+	     (sl = &in->jint_slots[h])->jis_str;
+	     h = (h + 1) & in->jint_mask) {
+		if (   sl->jis_hash == hash && sl->jis_len == len
+		    && !memcmp(sl->jis_str, s, len)) {
+			*out = sl->jis_str;
+			return 0;
+		}
+	}
+
+	/* add it, unless the table is full */
+	if (in->jint_count == in->jint_max)
+		return ENOSPC;
+
+	/* keep the table at most half full */
+	if (in->jint_count + 1 > (in->jint_mask + 1) / 2) {
+		if ((err = _rehash(in)))
+			return err;
+		for (h = hash & in->jint_mask;
+		     in->jint_slots[h].jis_str;
+		     h = (h + 1) & in->jint_mask)
+			;
+		sl = &in->jint_slots[h];
+	}
+
+	if ((err = json_arena_alloc(&in->jint_arena, len + 1, (void **) &str)))
+		return err;
+	memcpy(str, s, len);
+	str[len] = '\0';
+	*sl = (struct json_intern_slot) {
+		.jis_str  = str,
+		.jis_len  = len,
+		.jis_hash = hash,
+	};
+	in->jint_count++;
+
+	*out = str;
+	return 0;
+}
+
+int
+json_intern_string(
+	struct json_intern * const in,
+	char const * const s,
+	char const ** const out )
+{
+	size_t const len = strlen(s);
+	return json_intern_lookup(in, s, len, json_key_hash(s, len), out);
+}
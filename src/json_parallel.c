@@ -0,0 +1,345 @@
+/*
+ * json_parallel.c
+ *
+ * Simple JSON parser.
+ *
+ * https://github.com/e03213ac/libjson
+ *
+ * This work belongs to the Public Domain. Everyone is free to use, modify,
+ * republish, sell or give away this work without prior consent from anybody.
+ *
+ * This software is provided on an "AS IS" basis, without warranty of any kind.
+ * Use at your own risk! Under no circumstances shall the author(s) or
+ * contributor(s) be liable for damages resulting directly or indirectly from
+ * the use or non-use of this documentation.
+ */
+
+/*
+ * Parallel record parsing.
+ *
+ * The input is cut into chunks at newlines, lazily: each worker claims the
+ * next chunk when it is done with the previous one, and is then left alone
+ * with it. Every worker has a record reader of its own, rewound onto each
+ * chunk it claims, so workers share no memory but the input.
+ *
+ * Unordered, records are handed out as soon as they are parsed. Ordered, a
+ * worker parses its whole chunk first, keeping the records, then waits for
+ * the chunks before it to be handed out, and hands out its own. Chunks are
+ * numbered as they are claimed, so the order is that of the input.
+ *
+ * The first failure, in input order, stops the workers that are past it.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+/* Private API */
+#include "json_private.h"
+
+/* Chunk size bounds */
+#define CHUNK_MIN ((size_t) 64 << 10)
+#define CHUNK_MAX ((size_t) 16 << 20)
+
+/* Chunks per thread, for load balancing */
+#define CHUNKS_PER_THREAD 8
+
+/* Most threads */
+#define THREADS_MAX 256
+
+/* No failure yet */
+#define NO_FAILURE UINT_MAX
+
+/**
+ * State shared by the workers.
+ */
+struct _pool {
+	pthread_mutex_t        pl_lock;
+	pthread_cond_t         pl_turn_cond;
+	char                 * pl_p;          // rest of the input
+	char                 * pl_e;
+	size_t                 pl_chunk;      // chunk size
+	unsigned               pl_next;       // number of the next chunk
+	unsigned               pl_turn;       // next chunk to hand out
+	unsigned               pl_fail;       // first failed chunk
+	int                    pl_err;        // and its error
+	bool                   pl_ordered;
+	struct json_parse_options const * pl_opts;
+	int                 (* pl_fn)(void *, struct json_doc const *);
+	void                 * pl_arg;
+};
+
+/**
+ * A worker.
+ */
+struct _worker {
+	struct _pool         * wk_pool;
+	struct json_records  * wk_rc;
+	struct json_object  ** wk_roots;      // records of the chunk, ordered
+	size_t                 wk_roots_len;
+	size_t                 wk_roots_size;
+};
+
+/**
+ * Record a failure in the given chunk.
+ *
+ * Called with the lock held.
+ */
+static void
+_fail(struct _pool * const pl, unsigned const seq, int const err)
+{
+	if (seq < pl->pl_fail) {
+		__atomic_store_n(&pl->pl_fail, seq, __ATOMIC_RELAXED);
+		pl->pl_err  = err;
+		pthread_cond_broadcast(&pl->pl_turn_cond);
+	}
+}
+
+/* Chunks past the first failure are not worth parsing */
+static inline bool
+_stopped(struct _pool * const pl, unsigned const seq)
+{
+	return seq > __atomic_load_n(&pl->pl_fail, __ATOMIC_RELAXED);
+}
+
+/**
+ * Claim the next chunk, up to and including a newline.
+ */
+static bool
+_claim(struct _pool * const pl, char ** const p, size_t * const size,
+       unsigned * const seq )
+{
+	bool claimed = false;
+
+	pthread_mutex_lock(&pl->pl_lock);
+	if (pl->pl_p < pl->pl_e && pl->pl_next <= pl->pl_fail) {
+		char * e = pl->pl_e;
+		if ((size_t) (e - pl->pl_p) > pl->pl_chunk) {
+			char * const nl = memchr(pl->pl_p + pl->pl_chunk, '\n',
+					 e - pl->pl_p - pl->pl_chunk);
+			if (nl)
+				e = nl + 1;
+		}
+		*p    = pl->pl_p;
+		*size = e - pl->pl_p;
+		*seq  = pl->pl_next++;
+		pl->pl_p = e;
+		claimed = true;
+	}
+	pthread_mutex_unlock(&pl->pl_lock);
+
+	return claimed;
+}
+
+/**
+ * Keep the root of a record until the chunk is handed out.
+ */
+static int
+_keep(struct _worker * const wk, struct json_object * const root)
+{
+	if (wk->wk_roots_len == wk->wk_roots_size) {
+		size_t const n = wk->wk_roots_size ? wk->wk_roots_size * 2 : 64;
+		struct json_object ** const p =
+			json_mem_realloc(wk->wk_rc->jrc_doc.jdoc_alloc,
+					 wk->wk_roots, sizeof(*p) * n);
+		if (p == NULL)
+			return errno;
+		wk->wk_roots = p;
+		wk->wk_roots_size = n;
+	}
+
+	wk->wk_roots[wk->wk_roots_len++] = root;
+	return 0;
+}
+
+/**
+ * Parse a chunk, handing out records as they come.
+ */
+static int
+_unordered(struct _worker * const wk, unsigned const seq)
+{
+	struct _pool * const pl = wk->wk_pool;
+	struct json_doc const * doc;
+	int err;
+
+	while ((err = json_records_next(wk->wk_rc, &doc)) == 0 && doc) {
+		if ((err = pl->pl_fn(pl->pl_arg, doc)))
+			break;
+		if (_stopped(pl, seq))
+			break;
+	}
+	return err;
+}
+
+/**
+ * Parse a chunk, then hand out its records once it is its turn.
+ */
+static int
+_ordered(struct _worker * const wk, unsigned const seq)
+{
+	struct _pool * const pl = wk->wk_pool;
+	struct json_doc * const doc = &wk->wk_rc->jrc_doc;
+	struct json_doc const * rec;
+	int err;
+
+	/* records that parse before an error are still handed out */
+	wk->wk_roots_len = 0;
+	while ((err = json_records_next(wk->wk_rc, &rec)) == 0 && rec) {
+		if ((err = _keep(wk, doc->jdoc_obj)))
+			break;
+		if (_stopped(pl, seq))
+			return 0;
+	}
+
+	/* wait for the previous chunks */
+	pthread_mutex_lock(&pl->pl_lock);
+	while (pl->pl_turn != seq && seq <= pl->pl_fail)
+		pthread_cond_wait(&pl->pl_turn_cond, &pl->pl_lock);
+	bool const stopped = seq > pl->pl_fail;
+	pthread_mutex_unlock(&pl->pl_lock);
+	if (stopped)
+		return 0;
+
+	for (size_t i = 0; i < wk->wk_roots_len; i++) {
+		int cberr;
+		doc->jdoc_obj = wk->wk_roots[i];
+		if ((cberr = pl->pl_fn(pl->pl_arg, doc))) {
+			err = cberr;
+			break;
+		}
+	}
+
+	/* on to the next chunk, unless this one failed */
+	pthread_mutex_lock(&pl->pl_lock);
+	if (err)
+		_fail(pl, seq, err);
+	pl->pl_turn++;
+	pthread_cond_broadcast(&pl->pl_turn_cond);
+	pthread_mutex_unlock(&pl->pl_lock);
+	return err;
+}
+
+/**
+ * Worker thread.
+ */
+static void *
+_work(void * const arg)
+{
+	struct _worker * const wk = arg;
+	struct _pool * const pl = wk->wk_pool;
+	unsigned seq = 0;
+	char * p;
+	size_t size;
+	int err;
+
+	while (_claim(pl, &p, &size, &seq)) {
+		json_records_rewind(wk->wk_rc, p, size);
+		err = pl->pl_ordered ? _ordered(wk, seq) : _unordered(wk, seq);
+		if (err) {
+			pthread_mutex_lock(&pl->pl_lock);
+			_fail(pl, seq, err);
+			pthread_mutex_unlock(&pl->pl_lock);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Set up a worker.
+ */
+static int
+_worker_init(struct _worker * const wk, struct _pool * const pl)
+{
+	int const err = json_records_new_data(pl->pl_e, 0, pl->pl_opts,
+					      &wk->wk_rc);
+
+	if (err)
+		return err;
+	wk->wk_pool = pl;
+	wk->wk_rc->jrc_keep = pl->pl_ordered;
+	return 0;
+}
+
+/* Tear down a worker */
+static void
+_worker_fini(struct _worker * const wk)
+{
+	json_mem_free(wk->wk_rc->jrc_doc.jdoc_alloc, wk->wk_roots);
+	json_records_free(wk->wk_rc);
+}
+
+int
+json_records_parallel(
+	void                            * const buf,
+	size_t                            const size,
+	struct json_parse_options const * const opts,
+	unsigned                                nthreads,
+	bool                              const ordered,
+	int (* const fn)(void *, struct json_doc const *),
+	void                            * const arg )
+{
+	struct _pool pl = {
+		.pl_p       = buf,
+		.pl_e       = (char *) buf + size,
+		.pl_fail    = NO_FAILURE,
+		.pl_ordered = ordered,
+		.pl_opts    = opts,
+		.pl_fn      = fn,
+		.pl_arg     = arg,
+	};
+	pthread_t threads[THREADS_MAX];
+	struct _worker * wk;
+	unsigned n;
+	int err;
+
+	/* intern tables are not thread safe */
+	if (opts && opts->jopt_intern)
+		return EINVAL;
+
+	if (nthreads == 0) {
+		long const ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpu > 0 ? ncpu : 1;
+	}
+	if (nthreads > THREADS_MAX)
+		nthreads = THREADS_MAX;
+
+	pl.pl_chunk = size / ((size_t) nthreads * CHUNKS_PER_THREAD);
+	if (pl.pl_chunk < CHUNK_MIN)
+		pl.pl_chunk = CHUNK_MIN;
+	if (pl.pl_chunk > CHUNK_MAX)
+		pl.pl_chunk = CHUNK_MAX;
+
+	wk = json_mem_alloc(json_opts_allocator(opts), sizeof(*wk) * nthreads);
+	if (wk == NULL)
+		return errno;
+	memset(wk, 0, sizeof(*wk) * nthreads);
+	if ((err = pthread_mutex_init(&pl.pl_lock, NULL)))
+		goto fail_1;
+	if ((err = pthread_cond_init(&pl.pl_turn_cond, NULL)))
+		goto fail_2;
+
+	/* the calling thread is the first worker; fewer threads will do */
+	if ((err = _worker_init(&wk[0], &pl)))
+		goto fail_3;
+	for (n = 1; n < nthreads; n++) {
+		if (_worker_init(&wk[n], &pl))
+			break;
+		if (pthread_create(&threads[n], NULL, _work, &wk[n])) {
+			_worker_fini(&wk[n]);
+			break;
+		}
+	}
+	_work(&wk[0]);
+	_worker_fini(&wk[0]);
+	while (--n) {
+		pthread_join(threads[n], NULL);
+		_worker_fini(&wk[n]);
+	}
+
+	err = pl.pl_fail != NO_FAILURE ? pl.pl_err : 0;
+
+fail_3:	pthread_cond_destroy(&pl.pl_turn_cond);
+fail_2:	pthread_mutex_destroy(&pl.pl_lock);
+fail_1:	json_mem_free(json_opts_allocator(opts), wk);
+	return err;
+}
@@ -17,10 +17,6 @@
 /* Private API */
 #include "json_private.h"
 
-/* Forward declarations */
-static int _Array  (struct json_doc *, struct json_array **);
-static int _Object (struct json_doc *, struct json_object **);
-
 /** Return a syntax error */
 #define RETURN_PARSE_ERROR() \
 do { \
@@ -49,239 +45,491 @@ _match(struct json_doc * const doc,
 }
 
 /**
- * Parse a literal, object, or array.
+ * Push a key/value pair onto the scratch stack.
  */
-static int
-_Value(struct json_doc * const doc, struct json_value * const val)
+static inline int
+_push(struct json_doc         * const doc,
+      struct json_tuple const * const tup )
 {
-	struct json_token tok;
-	int err;
+	if (doc->jdoc_stack_len == doc->jdoc_stack_size) {
+		unsigned const n = doc->jdoc_stack_size
+				 ? doc->jdoc_stack_size * 2 : 64;
+		struct json_tuple * const p =
+			json_mem_realloc(doc->jdoc_alloc, doc->jdoc_stack,
+					 sizeof(*p) * n);
+		if (p == NULL)
+			return errno;
+		doc->jdoc_stack = p;
+		doc->jdoc_stack_size = n;
+	}
 
-	if ((err = json_consume_token(doc, &tok)))
-		return err;
+	doc->jdoc_stack[doc->jdoc_stack_len++] = *tup;
+	return 0;
+}
 
-	switch (tok.tok_id) {
-	case JSON_TOK_LIT:
-		val->jval_type = JSON_VAL_LITERAL;
-		val->jval_lit  = tok.tok_s;
-		break;
-	case JSON_TOK_OBJECT_BEGIN:
-		val->jval_type = JSON_VAL_OBJECT;
-		if ((err = _Object(doc, &val->jval_object)))
-			return err;
-		break;
-	case JSON_TOK_ARRAY_BEGIN:
-		val->jval_type = JSON_VAL_ARRAY;
-		if ((err = _Array(doc, &val->jval_array)))
-			return err;
-		break;
-	default:
-		RETURN_PARSE_ERROR();
+/**
+ * Open a container.
+ *
+ * The key is that of the container in its parent object, if any.
+ */
+static inline int
+_open(struct json_doc         * const doc,
+      enum json_value_type      const type,
+      struct json_tuple const * const key )
+{
+	if (doc->jdoc_depth == doc->jdoc_max_depth)
+		return EOVERFLOW;
+
+	if (doc->jdoc_depth == doc->jdoc_frames_size) {
+		unsigned const n = doc->jdoc_frames_size
+				 ? doc->jdoc_frames_size * 2 : 16;
+		struct json_frame * const p =
+			json_mem_realloc(doc->jdoc_alloc, doc->jdoc_frames,
+					 sizeof(*p) * n);
+		if (p == NULL)
+			return errno;
+		doc->jdoc_frames = p;
+		doc->jdoc_frames_size = n;
 	}
 
+	doc->jdoc_frames[doc->jdoc_depth++] = (struct json_frame) {
+		.jfr_type   = type,
+		.jfr_base   = doc->jdoc_stack_len,
+		.jfr_key    = key->jtup_key,
+		.jfr_keylen = key->jtup_keylen,
+		.jfr_hash   = key->jtup_hash,
+	};
 	return 0;
 }
 
 /**
- * Parse array.
+ * Index the keys of a wide object.
+ *
+ * The table is at most half full. Equal keys are probed in the order of
+ * the tuples, so lookups find the first one, as a linear scan would.
  */
 static int
-_Array_r(
-	struct json_doc      * const doc,
-	int unsigned           const ix,
-	struct json_array   ** const newarray )
-{
-	struct json_token      tok;
-	struct json_array    * array;
-	struct json_value      val;
-	size_t                 size;
-	int                    err;
-
-	/* value */
-	if ((err = _Value(doc, &val)))
-		return err;
+_index_keys(struct json_doc * const doc, struct json_object * const obj)
+{
+	unsigned const n = obj->jobj_length;
+	unsigned size = 2 * JSON_KEY_INDEX_MIN;
+	uint32_t * slots;
+	int err;
 
-	/* , or ] */
-	if ((err = json_consume_token(doc, &tok)))
+	while (size < 2 * n)
+		size *= 2;
+	if ((err = _gcmalloc(doc, sizeof(*slots) * size, &slots)))
 		return err;
-	switch (tok.tok_id) {
-	case JSON_TOK_COMMA:
-		/* continue parsing values in the array... */
-		if ((err = _Array_r(doc, ix + 1, &array)))
-			return err;
-		break;
-	case JSON_TOK_ARRAY_END:
-		/* finalize array */
-		size = sizeof(struct json_array) +
-		       sizeof(struct json_value) * (ix + 1);
-		if ((err = _gcmalloc(doc, size, &array)))
-			return err;
-		*array = (struct json_array) {
-			.jarr_length = ix + 1,
-		};
-		break;
-	default:
-		RETURN_PARSE_ERROR();
+	memset(slots, 0, sizeof(*slots) * size);
+
+	for (unsigned i = 0; i < n; i++) {
+		uint32_t h = obj->jobj_tuples[i].jtup_hash & (size - 1);
+		while (slots[h])
+			h = (h + 1) & (size - 1);
+		slots[h] = i + 1;
 	}
 
-	/* store value in array */
-	array->jarr_values[ix] = val;
-	*newarray = array;
+	obj->jobj_mask  = size - 1;
+	obj->jobj_slots = slots;
 	return 0;
 }
 
+/* Order tuples on the scratch stack by key */
 static int
-_Array(
-	struct json_doc    * const doc,
-	struct json_array ** const newarray )
+_tuple_compare(void const * const a, void const * const b, void * const arg)
 {
-	struct json_token    tok;
-	int                  err;
-
-	/* empty array? */
-	if ((err = json_peek_token(doc, &tok)))
-		return err;
-	if (tok.tok_id == JSON_TOK_ARRAY_END) {
-		(void) json_consume_token(doc, &tok);
-		size_t const size = sizeof(struct json_array);
-		if ((err = _gcmalloc(doc, size, newarray)))
-			return err;
-		memset(*newarray, 0, size);
-		return 0;
-	}
+	struct json_tuple const * const tuples = arg;
+	struct json_tuple const * const x = &tuples[*(uint32_t const *) a];
+	struct json_tuple const * const y = &tuples[*(uint32_t const *) b];
 
-	return _Array_r(doc, 0, newarray);
+	return json_key_compare(x->jtup_key, x->jtup_keylen,
+				y->jtup_key, y->jtup_keylen);
 }
 
 /**
- * Parse object.
+ * Store the tuples of an object sorted by key.
+ *
+ * The tuples are sorted through a scratch permutation, whose inverse gives
+ * the document order. Keys that compare equal are duplicates.
  */
 static int
-_Object_r(
-	struct json_doc      * const doc,
-	int unsigned           const ix,
-	struct json_object  ** const newobj )
-{
-	struct json_token      tok;
-	struct json_object   * obj;
-	char const           * key;
-	struct json_value      val;
-	size_t                 size;
-	int                    err;
-
-	/* key */
-	if ((err = _match(doc, JSON_TOK_LIT, &tok)))
+_sort_keys(struct json_doc         * const doc,
+	   struct json_object      * const obj,
+	   struct json_tuple const * const tuples )
+{
+	unsigned const n = obj->jobj_length;
+	uint32_t * perm;
+	int err;
+
+	/* never NULL, even for empty objects: it marks them as sorted */
+	size_t const size = sizeof(uint32_t) * (n ? n : 1);
+	if ((err = _gcmalloc(doc, size, &obj->jobj_order)))
 		return err;
+	if (n == 0)
+		return 0;
 
-	key = tok.tok_s;
+	if (n > doc->jdoc_perm_size) {
+		perm = json_mem_alloc(doc->jdoc_alloc, sizeof(*perm) * n);
+		if (perm == NULL)
+			return errno;
+		json_mem_free(doc->jdoc_alloc, doc->jdoc_perm);
+		doc->jdoc_perm = perm;
+		doc->jdoc_perm_size = n;
+	}
+	perm = doc->jdoc_perm;
 
-	/* : */
-	if ((err = _match(doc, JSON_TOK_COLON, NULL)))
-		return err;
+	for (unsigned i = 0; i < n; i++)
+		perm[i] = i;
+	qsort_r(perm, n, sizeof(*perm), _tuple_compare, (void *) tuples);
 
-	/* value */
-	if ((err = _Value(doc, &val)))
-		return err;
+	for (unsigned i = 0; i < n; i++) {
+		struct json_tuple const * const tup = &tuples[perm[i]];
+		if (i && _tuple_compare(&perm[i - 1], &perm[i],
+					(void *) tuples) == 0)
+			return EINVAL;
+		obj->jobj_tuples[i] = *tup;
+		obj->jobj_order[perm[i]] = i;
+	}
+	return 0;
+}
 
-	/* , or } */
-	if ((err = json_consume_token(doc, &tok)))
-		return err;
-	switch (tok.tok_id) {
-	case JSON_TOK_COMMA:
-		/* continue parsing tuples in this object... */
-		if ((err = _Object_r(doc, ix + 1, &obj)))
-			return err;
-		break;
-	case JSON_TOK_OBJECT_END:
-		/* allocate object */
+/**
+ * Close the innermost container.
+ *
+ * The values collected since the container was opened are moved off the
+ * scratch stack into a container allocated at its final size. The container
+ * is returned along with its key in its parent object, if any.
+ */
+static inline int
+_close(struct json_doc   * const doc,
+       struct json_tuple * const tup )
+{
+	struct json_frame const * const fr =
+		&doc->jdoc_frames[--doc->jdoc_depth];
+	struct json_tuple const * const tuples =
+		&doc->jdoc_stack[fr->jfr_base];
+	unsigned const n = doc->jdoc_stack_len - fr->jfr_base;
+	struct json_value * const val = &tup->jtup_val;
+	size_t size;
+	int err;
+
+	*val = (struct json_value) { .jval_type = fr->jfr_type };
+	switch (fr->jfr_type) {
+	case JSON_VAL_OBJECT:
 		size = sizeof(struct json_object) +
-		       sizeof(struct json_tuple ) * (ix + 1);
-		if ((err = _gcmalloc(doc, size, &obj)))
+		       sizeof(struct json_tuple ) * n;
+		if ((err = _gcmalloc(doc, size, &val->jval_object)))
 			return err;
-		*obj = (struct json_object) {
-			.jobj_length = ix + 1,
+		*val->jval_object = (struct json_object) {
+			.jobj_length = n,
+			.jobj_size   = n,
 		};
+		if (doc->jdoc_flags & JSON_PARSE_SORTKEYS) {
+			if ((err = _sort_keys(doc, val->jval_object, tuples)))
+				return err;
+			break;
+		}
+		if (n)
+			memcpy(val->jval_object->jobj_tuples, tuples,
+			       sizeof(struct json_tuple) * n);
+		if (n >= JSON_KEY_INDEX_MIN
+		    && (err = _index_keys(doc, val->jval_object)))
+			return err;
+		break;
+	case JSON_VAL_ARRAY:
+		size = sizeof(struct json_array) +
+		       sizeof(struct json_value) * n;
+		if ((err = _gcmalloc(doc, size, &val->jval_array)))
+			return err;
+		val->jval_array->jarr_length = n;
+		val->jval_array->jarr_size   = n;
+		for (unsigned i = 0; i < n; i++)
+			val->jval_array->jarr_values[i] = tuples[i].jtup_val;
 		break;
 	default:
-		RETURN_PARSE_ERROR();
+		assert(0);
 	}
 
-	/* store tuple in object */
-	obj->jobj_tuples[ix] = (struct json_tuple) { key, val };
-	*newobj = obj;
+	tup->jtup_key    = fr->jfr_key;
+	tup->jtup_keylen = fr->jfr_keylen;
+	tup->jtup_hash   = fr->jfr_hash;
+	doc->jdoc_stack_len = fr->jfr_base;
 	return 0;
 }
 
-static int
-_Object(
-	struct json_doc     * const doc,
-	struct json_object ** const newobject )
+/* Call an event callback, if any */
+#define EVENT(ev, cb, ...) ((ev)->cb ? (ev)->cb(__VA_ARGS__) : 0)
+
+/**
+ * Parse document.
+ *
+ * The grammar is driven iteratively: open containers are tracked in an
+ * explicit stack of frames, and their values accumulate on a scratch stack
+ * until the closing bracket. The C stack depth is therefore constant,
+ * whatever the width or depth of the document.
+ *
+ * With events, nothing accumulates: each key, literal and bracket is handed
+ * to its callback as soon as it is read. The function is specialized for
+ * both modes.
+ *
+ * A partial parse stops at the end of the input, and picks up from there
+ * when called again with more.
+ */
+static inline __attribute__((always_inline)) int
+_grammar(struct json_doc                * const doc,
+	 struct json_parse_events const * const ev,
+	 void                           * const arg,
+	 struct json_grammar            * const g,
+	 bool                             const partial )
 {
-	struct json_token     tok;
-	int                   err;
+	enum json_grammar_state state = g->jgr_state;
+	struct json_tuple  tup = g->jgr_tup;
+	struct json_token  tok;
+	int                err;
 
-	/* empty object? */
-	if ((err = json_peek_token(doc, &tok)))
-		return err;
-	if (tok.tok_id == JSON_TOK_OBJECT_END) {
-		(void) json_consume_token(doc, &tok);
-		size_t const size = sizeof(struct json_object);
-		if ((err = _gcmalloc(doc, size, newobject)))
+	for (;;) {
+		if ((err = json_consume_token(doc, &tok)))
 			return err;
-		memset(*newobject, 0, size);
-		return 0;
+
+		/* out of input for now: save state until there is more */
+		if (partial && tok.tok_id == JSON_TOK_EOF) {
+			g->jgr_state = state;
+			g->jgr_tup   = tup;
+			return 0;
+		}
+
+		switch (state) {
+		case S_START:
+			if (tok.tok_id != JSON_TOK_OBJECT_BEGIN)
+				RETURN_PARSE_ERROR();
+			if ((err = _open(doc, JSON_VAL_OBJECT, &tup)))
+				return err;
+			if (ev && (err = EVENT(ev, jev_object_begin, arg)))
+				return err;
+			state = S_OBJECT_FIRST;
+			continue;
+
+		case S_OBJECT_FIRST:
+			if (tok.tok_id == JSON_TOK_OBJECT_END)
+				goto close;
+			/* fall through */
+		case S_OBJECT_KEY:
+			/* key : */
+			if (tok.tok_id != JSON_TOK_LIT)
+				RETURN_PARSE_ERROR();
+			if (ev)
+				err = EVENT(ev, jev_key, arg,
+					    tok.tok_val.jval_lit, tok.tok_len);
+			else {
+				tup.jtup_key    = tok.tok_val.jval_lit;
+				tup.jtup_keylen = tok.tok_len;
+				tup.jtup_hash   = json_key_hash(tup.jtup_key,
+								tok.tok_len);
+			}
+			if (err || (err = _match(doc, JSON_TOK_COLON, NULL)))
+				return err;
+			state = S_VALUE;
+			continue;
+
+		case S_ARRAY_FIRST:
+			if (tok.tok_id == JSON_TOK_ARRAY_END)
+				goto close;
+			tup = (struct json_tuple) { 0 };
+			/* fall through */
+		case S_VALUE:
+			switch (tok.tok_id) {
+			case JSON_TOK_LIT:
+				if (ev)
+					err = EVENT(ev, jev_value, arg,
+						    &tok.tok_val);
+				else {
+					tup.jtup_val = tok.tok_val;
+					err = _push(doc, &tup);
+				}
+				if (err)
+					return err;
+				state = S_NEXT;
+				continue;
+			case JSON_TOK_OBJECT_BEGIN:
+				if ((err = _open(doc, JSON_VAL_OBJECT, &tup)))
+					return err;
+				if (ev && (err = EVENT(ev, jev_object_begin,
+						       arg)))
+					return err;
+				state = S_OBJECT_FIRST;
+				continue;
+			case JSON_TOK_ARRAY_BEGIN:
+				if ((err = _open(doc, JSON_VAL_ARRAY, &tup)))
+					return err;
+				if (ev && (err = EVENT(ev, jev_array_begin,
+						       arg)))
+					return err;
+				state = S_ARRAY_FIRST;
+				continue;
+			default:
+				RETURN_PARSE_ERROR();
+			}
+
+		case S_NEXT: {
+			enum json_value_type const type =
+				doc->jdoc_frames[doc->jdoc_depth - 1].jfr_type;
+			if (tok.tok_id == JSON_TOK_COMMA) {
+				tup = (struct json_tuple) { 0 };
+				state = type == JSON_VAL_OBJECT
+					? S_OBJECT_KEY : S_VALUE;
+				continue;
+			}
+			if (   (type == JSON_VAL_OBJECT
+			        && tok.tok_id == JSON_TOK_OBJECT_END)
+			    || (type == JSON_VAL_ARRAY
+			        && tok.tok_id == JSON_TOK_ARRAY_END))
+				goto close;
+			RETURN_PARSE_ERROR();
+		}
+
+		case S_DONE:
+			assert(0);
+		}
+
+	close:
+		/* build container and store it in its parent */
+		if (ev) {
+			enum json_value_type const type =
+				doc->jdoc_frames[--doc->jdoc_depth].jfr_type;
+			err = type == JSON_VAL_OBJECT
+			    ? EVENT(ev, jev_object_end, arg)
+			    : EVENT(ev, jev_array_end, arg);
+			if (err)
+				return err;
+			if (doc->jdoc_depth == 0)
+				break;
+		} else {
+			if ((err = _close(doc, &tup)))
+				return err;
+			if (doc->jdoc_depth == 0)
+				break;
+			if ((err = _push(doc, &tup)))
+				return err;
+		}
+		state = S_NEXT;
 	}
 
-	return _Object_r(doc, 0, newobject);
+	g->jgr_state = S_DONE;
+	g->jgr_tup   = tup;
+	return 0;
 }
 
-/**
- * Entry point for parsing.
- */
+/* Parse document into a tree */
 static int
 _Start(struct json_doc     * const doc,
        struct json_object ** const newobj )
 {
-	struct json_object * obj;
-	int err;
+	struct json_grammar g = { S_START };
+	int const err = _grammar(doc, NULL, NULL, &g, false);
 
-	if ((err = _match(doc, JSON_TOK_OBJECT_BEGIN, NULL)))
-		return err;
+	*newobj = g.jgr_tup.jtup_val.jval_object;
+	return err;
+}
 
-	if ((err = _Object(doc, &obj)))
-		return err;
+/* Parse document into events */
+static int
+_Events(struct json_doc                * const doc,
+	struct json_parse_events const * const ev,
+	void                           * const arg )
+{
+	struct json_grammar g = { S_START };
 
-	*newobj = obj;
-	return 0;
+	return _grammar(doc, ev, arg, &g, false);
+}
+
+/* Parse part of a document into a tree */
+static int
+_Continue(struct json_doc     * const doc,
+	  struct json_grammar * const g,
+	  bool                  const partial )
+{
+	return _grammar(doc, NULL, NULL, g, partial);
+}
+
+/**
+ * Release the scratch space, which is only needed while parsing.
+ */
+static void
+_release_scratch(struct json_doc * const doc)
+{
+	json_mem_free(doc->jdoc_alloc, doc->jdoc_index.jix_pos);
+	json_mem_free(doc->jdoc_alloc, doc->jdoc_buf);
+	json_mem_free(doc->jdoc_alloc, doc->jdoc_lit);
+	json_mem_free(doc->jdoc_alloc, doc->jdoc_stack);
+	json_mem_free(doc->jdoc_alloc, doc->jdoc_perm);
+	json_mem_free(doc->jdoc_alloc, doc->jdoc_frames);
+	json_mem_free(doc->jdoc_alloc, doc->jdoc_undo);
+	doc->jdoc_index = (struct json_index) { 0 };
+	doc->jdoc_buf = NULL;
+	doc->jdoc_buf_size = 0;
+	doc->jdoc_lit = NULL;
+	doc->jdoc_lit_size = 0;
+	doc->jdoc_stack = NULL;
+	doc->jdoc_stack_size = 0;
+	doc->jdoc_perm = NULL;
+	doc->jdoc_perm_size = 0;
+	doc->jdoc_frames = NULL;
+	doc->jdoc_frames_size = 0;
+	doc->jdoc_undo = NULL;
+	doc->jdoc_undo_size = 0;
+}
+
+/**
+ * Point a parser handle at new input, forgetting the previous document.
+ *
+ * Scratch space and arena memory are kept for the next document.
+ */
+static void
+_rewind(struct json_doc * const doc, FILE * const f,
+	char const * const p, size_t const size )
+{
+	doc->jdoc_f = f;
+	doc->jdoc_p = p;
+	doc->jdoc_e = p + size;
+
+	/* the structural index refers to the previous input */
+	doc->jdoc_index.jix_base = NULL;
+	doc->jdoc_index.jix_end  = NULL;
+	doc->jdoc_index.jix_p    = doc->jdoc_index.jix_e;
+
+	doc->jdoc_lineno = 1;
+	doc->jdoc_nextc_avail = false;
+	doc->jdoc_lookahead_avail = false;
+	doc->jdoc_stack_len = 0;
+	doc->jdoc_depth = 0;
+	doc->jdoc_obj = NULL;
+	json_arena_reset(&doc->jdoc_arena);
 }
 
 void
 json_free(struct json_doc * const doc)
 {
-	struct json_gc * next;
-	for (struct json_gc * p = doc->jdoc_head; p; p = next) {
-		next = p->jgc_next;
-		free(p);
-	}
-	free(doc);
+	if (doc == NULL)
+		return;
+	_release_scratch(doc);
+	json_arena_release(&doc->jdoc_arena);
+	json_mem_free(doc->jdoc_alloc, doc);
 }
 
-int
-json_parse(FILE * const f, struct json_doc ** newdoc)
+/**
+ * Parse a document using a freshly initialized parser handle.
+ *
+ * The handle is released on failure.
+ */
+static int
+_parse(struct json_doc * const doc, struct json_doc ** const newdoc)
 {
-	struct json_doc * doc;
 	int err;
 
-	if ((doc = malloc(sizeof(*doc))) == NULL) {
-		err = errno;
-		goto fail_malloc;
-	}
-	*doc = (struct json_doc) {
-		.jdoc_f      = f,
-		.jdoc_lineno = 1,
-	};
+	err = _Start(doc, &doc->jdoc_obj);
+	_release_scratch(doc);
 
-	if ((err = _Start(doc, &doc->jdoc_obj)))
+	if (err)
 		goto fail_parse;
 
 	*newdoc = doc;
@@ -289,93 +537,1048 @@ json_parse(FILE * const f, struct json_doc ** newdoc)
 
 fail_parse:
 	json_free(doc);
-fail_malloc:
 	*newdoc = NULL;
 	return err;
 }
 
-#ifdef __APPLE__
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-parameter"
+int
+json_parse(FILE * const f, struct json_doc ** newdoc)
+{
+	return json_parse_opts(f, NULL, newdoc);
+}
+
+int
+json_parse_opts(
+	FILE                            * const f,
+	struct json_parse_options const * const opts,
+	struct json_doc                ** const newdoc )
+{
+	struct json_doc * doc;
+
+	doc = json_mem_alloc(json_opts_allocator(opts), sizeof(*doc));
+	if (doc == NULL) {
+		*newdoc = NULL;
+		return errno;
+	}
+	*doc = (struct json_doc) {
+		.jdoc_f         = f,
+		.jdoc_flags     = opts ? opts->jopt_flags : 0,
+		.jdoc_max_depth = opts && opts->jopt_max_depth
+				? opts->jopt_max_depth : JSON_DEFAULT_MAX_DEPTH,
+		.jdoc_intern    = opts ? opts->jopt_intern : NULL,
+		.jdoc_alloc     = json_opts_allocator(opts),
+		.jdoc_lineno    = 1,
+	};
+	json_arena_init(&doc->jdoc_arena,
+			doc->jdoc_flags & JSON_PARSE_HUGEPAGES,
+			doc->jdoc_alloc);
+
+	/* literals can only be stored in place in an input buffer */
+	doc->jdoc_flags &= ~JSON_PARSE_INSITU;
+
+	return _parse(doc, newdoc);
+}
+
 int
 json_parse_string(char const * str, struct json_doc ** newdoc)
 {
-	*newdoc = null;
-	return enosys;
+	return json_parse_data((void *) str, strlen(str), newdoc);
 }
+
 int
 json_parse_data(void * buf, size_t size, struct json_doc ** newdoc)
 {
-	*newdoc = null;
-	return enosys;
+	return json_parse_data_opts(buf, size, NULL, newdoc);
 }
-#pragma GCC diagnostic pop
-#else
+
 int
-json_parse_string(char const * str, struct json_doc ** newdoc)
+json_parse_data_opts(
+	void                            * const buf,
+	size_t                            const size,
+	struct json_parse_options const * const opts,
+	struct json_doc                ** const newdoc )
+{
+	struct json_doc * doc;
+
+	doc = json_mem_alloc(json_opts_allocator(opts), sizeof(*doc));
+	if (doc == NULL) {
+		*newdoc = NULL;
+		return errno;
+	}
+	*doc = (struct json_doc) {
+		.jdoc_p         = buf,
+		.jdoc_e         = (char const *) buf + size,
+		.jdoc_flags     = opts ? opts->jopt_flags : 0,
+		.jdoc_max_depth = opts && opts->jopt_max_depth
+				? opts->jopt_max_depth : JSON_DEFAULT_MAX_DEPTH,
+		.jdoc_intern    = opts ? opts->jopt_intern : NULL,
+		.jdoc_alloc     = json_opts_allocator(opts),
+		.jdoc_lineno    = 1,
+	};
+	json_arena_init(&doc->jdoc_arena,
+			doc->jdoc_flags & JSON_PARSE_HUGEPAGES,
+			doc->jdoc_alloc);
+
+	return _parse(doc, newdoc);
+}
+
+int
+json_doc_new(
+	struct json_parse_options const * const opts,
+	struct json_doc                ** const newdoc )
+{
+	struct json_doc * doc;
+
+	doc = json_mem_alloc(json_opts_allocator(opts), sizeof(*doc));
+	if (doc == NULL) {
+		*newdoc = NULL;
+		return errno;
+	}
+	*doc = (struct json_doc) {
+		.jdoc_flags     = opts ? opts->jopt_flags : 0,
+		.jdoc_max_depth = opts && opts->jopt_max_depth
+				? opts->jopt_max_depth : JSON_DEFAULT_MAX_DEPTH,
+		.jdoc_intern    = opts ? opts->jopt_intern : NULL,
+		.jdoc_alloc     = json_opts_allocator(opts),
+		.jdoc_lineno    = 1,
+	};
+	json_arena_init(&doc->jdoc_arena,
+			doc->jdoc_flags & JSON_PARSE_HUGEPAGES,
+			doc->jdoc_alloc);
+
+	*newdoc = doc;
+	return 0;
+}
+
+/**
+ * Parse into a document, replacing its contents.
+ *
+ * Scratch space is kept for the next parse. The document is left empty on
+ * failure.
+ */
+static int
+_reparse(struct json_doc * const doc)
+{
+	int const err = _Start(doc, &doc->jdoc_obj);
+
+	if (err) {
+		doc->jdoc_obj = NULL;
+		json_arena_reset(&doc->jdoc_arena);
+	}
+	return err;
+}
+
+int
+json_doc_parse(struct json_doc * const doc, FILE * const f)
+{
+	_rewind(doc, f, NULL, 0);
+	return _reparse(doc);
+}
+
+int
+json_doc_parse_data(struct json_doc * const doc,
+		    void * const buf, size_t const size)
+{
+	_rewind(doc, NULL, buf, size);
+	return _reparse(doc);
+}
+
+void
+json_doc_reset(struct json_doc * const doc)
 {
+	_rewind(doc, NULL, NULL, 0);
+}
+
+void
+json_doc_trim(struct json_doc * const doc)
+{
+	_release_scratch(doc);
+
+	/* an empty document needs no memory at all */
+	if (doc->jdoc_obj == NULL)
+		json_arena_release(&doc->jdoc_arena);
+}
+
+/**
+ * Parse a document into events, using a parser handle on the stack.
+ */
+static int
+_parse_events(struct json_doc                * const doc,
+	      struct json_parse_events const * const ev,
+	      void                           * const arg )
+{
+	int err;
+
+	err = _Events(doc, ev, arg);
+	_release_scratch(doc);
+	json_arena_release(&doc->jdoc_arena);
+	return err;
+}
+
+int
+json_parse_events(
+	FILE                            * const f,
+	struct json_parse_options const * const opts,
+	struct json_parse_events  const * const events,
+	void                            * const arg )
+{
+	struct json_doc doc = {
+		.jdoc_f         = f,
+		.jdoc_flags     = opts ? opts->jopt_flags : 0,
+		.jdoc_max_depth = opts && opts->jopt_max_depth
+				? opts->jopt_max_depth : JSON_DEFAULT_MAX_DEPTH,
+		.jdoc_intern    = opts ? opts->jopt_intern : NULL,
+		.jdoc_alloc     = json_opts_allocator(opts),
+		.jdoc_lineno    = 1,
+	};
+
+	doc.jdoc_flags &= ~(JSON_PARSE_INSITU | JSON_PARSE_SORTKEYS);
+	doc.jdoc_flags |= JSON_PARSE_TRANSIENT;
+	json_arena_init(&doc.jdoc_arena, false, doc.jdoc_alloc);
+
+	return _parse_events(&doc, events, arg);
+}
+
+int
+json_parse_events_data(
+	void                            * const buf,
+	size_t                            const size,
+	struct json_parse_options const * const opts,
+	struct json_parse_events  const * const events,
+	void                            * const arg )
+{
+	struct json_doc doc = {
+		.jdoc_p         = buf,
+		.jdoc_e         = (char const *) buf + size,
+		.jdoc_flags     = opts ? opts->jopt_flags : 0,
+		.jdoc_max_depth = opts && opts->jopt_max_depth
+				? opts->jopt_max_depth : JSON_DEFAULT_MAX_DEPTH,
+		.jdoc_intern    = opts ? opts->jopt_intern : NULL,
+		.jdoc_alloc     = json_opts_allocator(opts),
+		.jdoc_lineno    = 1,
+	};
+
+	doc.jdoc_flags &= ~JSON_PARSE_SORTKEYS;
+	doc.jdoc_flags |= JSON_PARSE_TRANSIENT;
+	json_arena_init(&doc.jdoc_arena, false, doc.jdoc_alloc);
+
+	return _parse_events(&doc, events, arg);
+}
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                             Push parser                                  //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/*
+ * Chunks are cut after their last punctuation character outside of any
+ * string. Everything before the cut is made of whole tokens, and is parsed
+ * straight from the chunk; the rest is carried over, and parsed once the
+ * chunk completing it has arrived. Only the bytes of each new chunk are
+ * scanned for the cut, so the carried part is never scanned twice, however
+ * long the token it holds.
+ */
+
+/**
+ * Push parser.
+ */
+struct json_parser {
+	struct json_allocator const * jps_alloc;
+	struct json_doc      * jps_doc;       // document being built
+	struct json_grammar    jps_gram;
+	char                 * jps_carry;     // incomplete tokens
+	size_t                 jps_carry_len;
+	size_t                 jps_carry_size;
+	bool                   jps_in_string; // state at the end of the carry
+	bool                   jps_escaped;
+	int                    jps_err;       // first error, or 0
+};
+
+int
+json_parser_new(
+	struct json_parse_options const * const opts,
+	struct json_parser             ** const newparser )
+{
+	struct json_allocator const * const alloc = json_opts_allocator(opts);
+	struct json_parser * ps;
+	struct json_doc * doc;
 	int err;
 
-	/* duplicate input stream and open as a FILE stream */
-	char * const dup = strdup(str);
-	if (dup == NULL) {
+	if ((ps = json_mem_alloc(alloc, sizeof(*ps))) == NULL) {
 		err = errno;
-		goto fail_strdup;
+		goto fail;
 	}
-	FILE * const f = fmemopen(dup, strlen(str), "r");
-	if (f == NULL) {
+	if ((doc = json_mem_alloc(alloc, sizeof(*doc))) == NULL) {
 		err = errno;
-		goto fail_fmemopen;
+		goto fail_1;
 	}
+	*doc = (struct json_doc) {
+		.jdoc_flags     = opts ? opts->jopt_flags : 0,
+		.jdoc_max_depth = opts && opts->jopt_max_depth
+				? opts->jopt_max_depth : JSON_DEFAULT_MAX_DEPTH,
+		.jdoc_intern    = opts ? opts->jopt_intern : NULL,
+		.jdoc_alloc     = alloc,
+		.jdoc_lineno    = 1,
+	};
+	json_arena_init(&doc->jdoc_arena,
+			doc->jdoc_flags & JSON_PARSE_HUGEPAGES, alloc);
 
-	/* parse document */
-	struct json_doc * doc;
-	if ((err = json_parse(f, &doc)))
-		goto fail_parse;
+	/* chunks belong to the caller */
+	doc->jdoc_flags &= ~JSON_PARSE_INSITU;
 
-	doc->jdoc_f = NULL;
-	fclose(f);
-	free(dup);
+	*ps = (struct json_parser) {
+		.jps_alloc = alloc,
+		.jps_doc   = doc,
+		.jps_gram  = { S_START },
+	};
+	*newparser = ps;
+	return 0;
 
-	*newdoc = doc;
+fail_1:	json_mem_free(alloc, ps);
+fail:	*newparser = NULL;
+	return err;
+}
+
+void
+json_parser_free(struct json_parser * const ps)
+{
+	if (ps == NULL)
+		return;
+	json_free(ps->jps_doc);
+	json_mem_free(ps->jps_alloc, ps->jps_carry);
+	json_mem_free(ps->jps_alloc, ps);
+}
+
+/**
+ * Append to the carry.
+ */
+static int
+_carry(struct json_parser * const ps, char const * const p, size_t const len)
+{
+	if (ps->jps_carry_size - ps->jps_carry_len < len) {
+		size_t size = ps->jps_carry_size ? : 256;
+		while (size - ps->jps_carry_len < len)
+			size *= 2;
+		char * const carry = json_mem_realloc(ps->jps_alloc,
+						      ps->jps_carry, size);
+		if (carry == NULL)
+			return errno;
+		ps->jps_carry = carry;
+		ps->jps_carry_size = size;
+	}
+
+	if (len)
+		memcpy(ps->jps_carry + ps->jps_carry_len, p, len);
+	ps->jps_carry_len += len;
 	return 0;
+}
+
+/**
+ * Find where to cut a chunk: past its last punctuation character outside of
+ * any string, or at its start if there is none.
+ */
+static size_t
+_cut(struct json_parser * const ps, char const * const p, size_t const len)
+{
+	bool in_string = ps->jps_in_string;
+	bool escaped = ps->jps_escaped;
+	size_t cut = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		char const c = p[i];
+		if (in_string) {
+			if (escaped)
+				escaped = false;
+			else if (c == '\\')
+				escaped = true;
+			else if (c == '"')
+				in_string = false;
+			continue;
+		}
+		switch (c) {
+		case '"':
+			in_string = true;
+			break;
+		case '{': case '}': case '[': case ']': case ':': case ',':
+			cut = i + 1;
+			break;
+		}
+	}
+
+	ps->jps_in_string = in_string;
+	ps->jps_escaped = escaped;
+	return cut;
+}
+
+/**
+ * Parse a run of whole tokens.
+ */
+static int
+_region(struct json_parser * const ps, char const * const p, size_t const len,
+	bool const partial )
+{
+	struct json_doc * const doc = ps->jps_doc;
+
+	/* the structural index refers to the previous region */
+	doc->jdoc_p = p;
+	doc->jdoc_e = p + len;
+	doc->jdoc_index.jix_base = NULL;
+	doc->jdoc_index.jix_end  = NULL;
+	doc->jdoc_index.jix_p    = doc->jdoc_index.jix_e;
+
+	return _Continue(doc, &ps->jps_gram, partial);
+}
+
+int
+json_parser_feed(
+	struct json_parser * const ps,
+	void const         * const chunk,
+	size_t               const len )
+{
+	char const * const p = chunk;
+	size_t cut;
+	int err;
+
+	if (ps->jps_err)
+		return ps->jps_err;
+	/* anything past the document is ignored, as by json_parse() */
+	if (ps->jps_doc == NULL || ps->jps_gram.jgr_state == S_DONE)
+		return 0;
+
+	/* whole tokens, completing those carried over if any */
+	if ((cut = _cut(ps, p, len)) == 0)
+		err = _carry(ps, p, len);
+	else if (ps->jps_carry_len == 0)
+		err = _region(ps, p, cut, true);
+	else if ((err = _carry(ps, p, cut)) == 0) {
+		err = _region(ps, ps->jps_carry, ps->jps_carry_len, true);
+		ps->jps_carry_len = 0;
+	}
+
+	/* then carry the rest over */
+	if (err == 0 && cut)
+		err = _carry(ps, p + cut, len - cut);
+
+	if (err)
+		ps->jps_err = err;
+	return err;
+}
+
+int
+json_parser_finish(struct json_parser * const ps,
+		   struct json_doc ** const newdoc )
+{
+	struct json_doc * const doc = ps->jps_doc;
+	int err = ps->jps_err;
 
-fail_parse:
-	fclose(f);
-fail_fmemopen:
-	free(dup);
-fail_strdup:
 	*newdoc = NULL;
+	if (doc == NULL)
+		return EINVAL;
+
+	/* the end of input completes whatever was carried over */
+	if (err == 0 && ps->jps_gram.jgr_state != S_DONE)
+		err = _region(ps, ps->jps_carry ? : "", ps->jps_carry_len,
+			      false);
+	if (err) {
+		ps->jps_err = err;
+		return err;
+	}
+
+	_release_scratch(doc);
+	doc->jdoc_obj = ps->jps_gram.jgr_tup.jtup_val.jval_object;
+	doc->jdoc_p = NULL;
+	doc->jdoc_e = NULL;
+	ps->jps_doc = NULL;
+
+	*newdoc = doc;
+	return 0;
+}
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                               Records                                    //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/*
+ * A single parser handle parses all the records in turn. Its scratch space
+ * is kept from one record to the next, and so is the largest chunk of its
+ * arena, so that records stop allocating memory once the largest of them
+ * has been seen.
+ */
+
+/**
+ * Create a record reader around a parser handle initialized by the caller.
+ */
+static int
+_records_new(struct json_doc const * const doc,
+	     struct json_records  ** const newrc )
+{
+	struct json_records * rc;
+
+	if ((rc = json_mem_alloc(doc->jdoc_alloc, sizeof(*rc))) == NULL) {
+		*newrc = NULL;
+		return errno;
+	}
+	*rc = (struct json_records) {
+		.jrc_doc = *doc,
+	};
+	json_arena_init(&rc->jrc_doc.jdoc_arena,
+			doc->jdoc_flags & JSON_PARSE_HUGEPAGES,
+			doc->jdoc_alloc);
+
+	*newrc = rc;
+	return 0;
+}
+
+int
+json_records_new(
+	FILE                            * const f,
+	struct json_parse_options const * const opts,
+	struct json_records            ** const newrecords )
+{
+	struct json_doc const doc = {
+		.jdoc_f         = f,
+		.jdoc_flags     = (opts ? opts->jopt_flags : 0)
+				& ~JSON_PARSE_INSITU,
+		.jdoc_max_depth = opts && opts->jopt_max_depth
+				? opts->jopt_max_depth : JSON_DEFAULT_MAX_DEPTH,
+		.jdoc_intern    = opts ? opts->jopt_intern : NULL,
+		.jdoc_alloc     = json_opts_allocator(opts),
+		.jdoc_lineno    = 1,
+	};
+
+	return _records_new(&doc, newrecords);
+}
+
+int
+json_records_new_data(
+	void                            * const buf,
+	size_t                            const size,
+	struct json_parse_options const * const opts,
+	struct json_records            ** const newrecords )
+{
+	struct json_doc const doc = {
+		.jdoc_p         = buf,
+		.jdoc_e         = (char const *) buf + size,
+		.jdoc_flags     = opts ? opts->jopt_flags : 0,
+		.jdoc_max_depth = opts && opts->jopt_max_depth
+				? opts->jopt_max_depth : JSON_DEFAULT_MAX_DEPTH,
+		.jdoc_intern    = opts ? opts->jopt_intern : NULL,
+		.jdoc_alloc     = json_opts_allocator(opts),
+		.jdoc_lineno    = 1,
+	};
+
+	return _records_new(&doc, newrecords);
+}
+
+void
+json_records_free(struct json_records * const rc)
+{
+	if (rc == NULL)
+		return;
+	_release_scratch(&rc->jrc_doc);
+	json_arena_release(&rc->jrc_doc.jdoc_arena);
+	json_mem_free(rc->jrc_doc.jdoc_alloc, rc);
+}
+
+int
+json_records_next(struct json_records * const rc,
+		  struct json_doc const ** const record )
+{
+	struct json_doc * const doc = &rc->jrc_doc;
+	struct json_token tok;
+	int err;
+
+	*record = NULL;
+	if (rc->jrc_err)
+		return rc->jrc_err;
+
+	/* the previous record is over: recycle its memory */
+	if (!rc->jrc_keep)
+		json_arena_reset(&doc->jdoc_arena);
+	doc->jdoc_obj = NULL;
+
+	/* whatever whitespace separates records, if any, is skipped here */
+	if ((err = json_peek_token(doc, &tok)))
+		goto fail;
+	if (tok.tok_id == JSON_TOK_EOF)
+		return 0;
+
+	if ((err = _Start(doc, &doc->jdoc_obj)))
+		goto fail;
+
+	*record = doc;
+	return 0;
+
+fail:	rc->jrc_err = err;
 	return err;
 }
 
+void
+json_records_rewind(struct json_records * const rc,
+		    char const * const p, size_t const size)
+{
+	_rewind(&rc->jrc_doc, NULL, p, size);
+	rc->jrc_err = 0;
+}
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                               Builder                                    //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/*
+ * The builder drives the same machinery as the grammar: containers are
+ * opened as frames, their values accumulate on the scratch stack, and they
+ * are moved into containers of their final size when they are closed. Built
+ * documents are therefore laid out exactly like parsed ones, key index and
+ * sorted keys included.
+ */
+
+/**
+ * Document builder.
+ */
+struct json_builder {
+	struct json_allocator const * jbd_alloc;
+	struct json_doc      * jbd_doc;       // document being built
+	struct json_tuple      jbd_tup;       // key of the next value
+	bool                   jbd_keyed;     // the key has been set
+	int                    jbd_err;       // first error, or 0
+};
+
 int
-json_parse_data(void * buf, size_t size, struct json_doc ** newdoc)
+json_builder_new(
+	struct json_parse_options const * const opts,
+	struct json_builder            ** const newbd )
 {
+	struct json_allocator const * const alloc = json_opts_allocator(opts);
+	struct json_builder * bd;
 	int err;
 
-	/* open as a FILE stream */
-	FILE * const f = fmemopen(buf, size, "rb");
-	if (f == NULL) {
-		err = errno;
-		goto fail_fmemopen;
+	if ((bd = json_mem_alloc(alloc, sizeof(*bd))) == NULL) {
+		*newbd = NULL;
+		return errno;
+	}
+	*bd = (struct json_builder) { .jbd_alloc = alloc };
+	if ((err = json_doc_new(opts, &bd->jbd_doc))) {
+		json_mem_free(alloc, bd);
+		*newbd = NULL;
+		return err;
 	}
 
-	/* parse document */
-	struct json_doc * doc;
-	if ((err = json_parse(f, &doc)))
-		goto fail_parse;
+	*newbd = bd;
+	return 0;
+}
 
-	doc->jdoc_f = NULL;
-	fclose(f);
+void
+json_builder_free(struct json_builder * const bd)
+{
+	if (bd == NULL)
+		return;
+	json_free(bd->jbd_doc);
+	json_mem_free(bd->jbd_alloc, bd);
+}
 
-	*newdoc = doc;
+/* Stop on error; the builder keeps returning it */
+static inline int
+_build_fail(struct json_builder * const bd, int const err)
+{
+	bd->jbd_err = err;
+	return err;
+}
+
+/**
+ * Check that a value may come next: in an array, or after a key in an
+ * object.
+ */
+static int
+_build_check(struct json_builder const * const bd)
+{
+	struct json_doc const * const doc = bd->jbd_doc;
+
+	if (bd->jbd_err)
+		return bd->jbd_err;
+	if (doc == NULL || doc->jdoc_depth == 0)
+		return EINVAL;
+	if ((doc->jdoc_frames[doc->jdoc_depth - 1].jfr_type
+	     == JSON_VAL_OBJECT) != bd->jbd_keyed)
+		return EINVAL;
 	return 0;
+}
+
+int
+json_doc_string(struct json_doc * const doc, char const * const s,
+		size_t const len, char const ** const out )
+{
+	char * p;
+	int err;
+
+	if (doc->jdoc_intern && len <= JSON_INTERN_MAX_LEN) {
+		err = json_intern_lookup(doc->jdoc_intern, s, len,
+					 json_key_hash(s, len), out);
+		if (err != ENOSPC)
+			return err;
+	}
+
+	if ((err = _gcmalloc(doc, len + 1, &p)))
+		return err;
+	if (len)
+		memcpy(p, s, len);
+	p[len] = '\0';
+	*out = p;
+	return 0;
+}
+
+/**
+ * Add a literal to the innermost container.
+ *
+ * Its text, if any, is copied into the document.
+ */
+static int
+_build_literal(struct json_builder * const bd, struct json_value val,
+	       char const * const text, size_t const len )
+{
+	struct json_doc * const doc = bd->jbd_doc;
+	int err;
+
+	if ((err = _build_check(bd)))
+		return _build_fail(bd, err);
+	if (text && (err = json_doc_string(doc, text, len, &val.jval_lit)))
+		return _build_fail(bd, err);
+
+	bd->jbd_tup.jtup_val = val;
+	if ((err = _push(doc, &bd->jbd_tup)))
+		return _build_fail(bd, err);
+	bd->jbd_tup = (struct json_tuple) { 0 };
+	bd->jbd_keyed = false;
+	return 0;
+}
+
+/**
+ * Open a container, in the innermost one or as the root.
+ */
+static int
+_build_begin(struct json_builder * const bd, enum json_value_type const type)
+{
+	struct json_doc * const doc = bd->jbd_doc;
+	int err;
+
+	/* the root is a single object */
+	if (doc && doc->jdoc_depth == 0 && bd->jbd_err == 0)
+		err = type == JSON_VAL_OBJECT && doc->jdoc_obj == NULL
+		    ? 0 : EINVAL;
+	else
+		err = _build_check(bd);
+	if (err || (err = _open(doc, type, &bd->jbd_tup)))
+		return _build_fail(bd, err);
+
+	bd->jbd_tup = (struct json_tuple) { 0 };
+	bd->jbd_keyed = false;
+	return 0;
+}
+
+int
+json_builder_begin_object(struct json_builder * const bd)
+{
+	return _build_begin(bd, JSON_VAL_OBJECT);
+}
+
+int
+json_builder_begin_array(struct json_builder * const bd)
+{
+	return _build_begin(bd, JSON_VAL_ARRAY);
+}
+
+int
+json_builder_end(struct json_builder * const bd)
+{
+	struct json_doc * const doc = bd->jbd_doc;
+	struct json_tuple tup;
+	int err;
+
+	if (bd->jbd_err)
+		return bd->jbd_err;
+	if (doc == NULL || doc->jdoc_depth == 0 || bd->jbd_keyed)
+		return _build_fail(bd, EINVAL);
+
+	if ((err = _close(doc, &tup)))
+		return _build_fail(bd, err);
+	if (doc->jdoc_depth == 0)
+		doc->jdoc_obj = tup.jtup_val.jval_object;
+	else if ((err = _push(doc, &tup)))
+		return _build_fail(bd, err);
+	return 0;
+}
+
+int
+json_builder_key(struct json_builder * const bd,
+		 char const * const key, size_t const len)
+{
+	struct json_doc * const doc = bd->jbd_doc;
+	int err;
+
+	if (bd->jbd_err)
+		return bd->jbd_err;
+	if (   doc == NULL || doc->jdoc_depth == 0 || bd->jbd_keyed
+	    || doc->jdoc_frames[doc->jdoc_depth - 1].jfr_type
+	       != JSON_VAL_OBJECT
+	    || len > UINT_MAX
+	    || (key ? memchr(key, '\0', len) != NULL : len != 0))
+		return _build_fail(bd, EINVAL);
+
+	if ((err = json_doc_string(doc, key ? key : "", len,
+				   &bd->jbd_tup.jtup_key)))
+		return _build_fail(bd, err);
+	bd->jbd_tup.jtup_keylen = len;
+	bd->jbd_tup.jtup_hash   = json_key_hash(bd->jbd_tup.jtup_key, len);
+	bd->jbd_keyed = true;
+	return 0;
+}
+
+int
+json_builder_string(struct json_builder * const bd,
+		    char const * const s, size_t const len)
+{
+	struct json_value const val = {
+		.jval_type     = JSON_VAL_LITERAL,
+		.jval_lit_type = JSON_LIT_STRING,
+	};
+
+	/*
+	 * strings always have their text, if only an empty one, and no NUL,
+	 * which the parser rejects as \u0000 too
+	 */
+	if (s ? memchr(s, '\0', len) != NULL : len != 0)
+		return bd->jbd_err ? : _build_fail(bd, EINVAL);
+	return _build_literal(bd, val, s ? s : "", len);
+}
+
+int
+json_builder_int(struct json_builder * const bd, int64_t const v)
+{
+	struct json_value const val = {
+		.jval_type     = JSON_VAL_LITERAL,
+		.jval_lit_type = JSON_LIT_INT,
+		.jval_int      = v,
+	};
+	char buf[JSON_FORMAT_SIZE];
+
+	return _build_literal(bd, val, buf, json_format_int64(v, buf));
+}
+
+int
+json_builder_uint(struct json_builder * const bd, uint64_t const v)
+{
+	struct json_value const val = {
+		.jval_type     = JSON_VAL_LITERAL,
+		.jval_lit_type = JSON_LIT_UINT,
+		.jval_uint     = v,
+	};
+	char buf[JSON_FORMAT_SIZE];
+
+	/* typed as the same number would be when parsed */
+	if (v <= INT64_MAX)
+		return json_builder_int(bd, v);
+	return _build_literal(bd, val, buf, json_format_uint64(v, buf));
+}
+
+int
+json_builder_double(struct json_builder * const bd, double const v)
+{
+	struct json_value const val = {
+		.jval_type     = JSON_VAL_LITERAL,
+		.jval_lit_type = JSON_LIT_DOUBLE,
+		.jval_double   = v,
+	};
+	char buf[JSON_FORMAT_SIZE];
+	size_t const len = json_format_double(v, buf);
+
+	/* JSON has no infinities nor NaNs */
+	if (len == 0 && bd->jbd_err == 0)
+		return _build_fail(bd, EINVAL);
+	return _build_literal(bd, val, buf, len);
+}
+
+int
+json_builder_bool(struct json_builder * const bd, bool const v)
+{
+	struct json_value const val = {
+		.jval_type     = JSON_VAL_LITERAL,
+		.jval_lit_type = JSON_LIT_BOOL,
+		.jval_lit      = v ? "true" : "false",
+		.jval_bool     = v,
+	};
+
+	return _build_literal(bd, val, NULL, 0);
+}
+
+int
+json_builder_null(struct json_builder * const bd)
+{
+	struct json_value const val = {
+		.jval_type     = JSON_VAL_LITERAL,
+		.jval_lit_type = JSON_LIT_NULL,
+		.jval_lit      = "null",
+	};
+
+	return _build_literal(bd, val, NULL, 0);
+}
+
+int
+json_builder_finish(struct json_builder * const bd,
+		    struct json_doc ** const newdoc )
+{
+	struct json_doc * const doc = bd->jbd_doc;
 
-fail_parse:
-	fclose(f);
-fail_fmemopen:
 	*newdoc = NULL;
+	if (bd->jbd_err)
+		return bd->jbd_err;
+	if (doc == NULL || doc->jdoc_obj == NULL)
+		return EINVAL;
+
+	_release_scratch(doc);
+	bd->jbd_doc = NULL;
+
+	*newdoc = doc;
+	return 0;
+}
+
+/**
+ * Container being copied, and the next of its values to copy.
+ */
+struct _copy_frame {
+	struct json_value const * cf_src;
+	unsigned               cf_next;
+};
+
+/**
+ * Copy a literal into the document.
+ *
+ * Numbers given without text have it made from their value. Strings must
+ * have their text, and doubles must be finite.
+ */
+static int
+_copy_literal(struct json_doc         * const doc,
+	      struct json_value       * const dst,
+	      struct json_value const * const src )
+{
+	char buf[JSON_FORMAT_SIZE];
+	char const * text = src->jval_lit;
+	size_t len;
+
+	*dst = *src;
+	switch (src->jval_lit_type) {
+	case JSON_LIT_BOOL:
+		dst->jval_lit = src->jval_bool ? "true" : "false";
+		return 0;
+	case JSON_LIT_NULL:
+		dst->jval_lit = "null";
+		return 0;
+	default:
+		break;
+	}
+
+	if (text)
+		len = strlen(text);
+	else {
+		switch (src->jval_lit_type) {
+		case JSON_LIT_INT:
+			len = json_format_int64(src->jval_int, buf);
+			break;
+		case JSON_LIT_UINT:
+			len = json_format_uint64(src->jval_uint, buf);
+			break;
+		case JSON_LIT_DOUBLE:
+			len = json_format_double(src->jval_double, buf);
+			break;
+		default:
+			len = 0;
+			break;
+		}
+		if (len == 0)
+			return EINVAL;
+		text = buf;
+	}
+	return json_doc_string(doc, text, len, &dst->jval_lit);
+}
+
+/**
+ * Copy a value, walking nested containers with a stack of frames.
+ * Containers are built on the scratch stack, as when parsing.
+ */
+int
+json_doc_copy_value(struct json_doc * const doc,
+		    struct json_value const * const src,
+		    struct json_value * const dst )
+{
+	unsigned const base  = doc->jdoc_stack_len;
+	unsigned const depth = doc->jdoc_depth;
+	struct _copy_frame inline_frames[JSON_STACK_INLINE];
+	struct json_stack st;
+	struct json_value const * val = src;
+	struct json_tuple tup = { 0 };
+	int err;
+
+	json_stack_init(&st, inline_frames, sizeof(*inline_frames),
+			doc->jdoc_alloc);
+	for (;;) {
+		/* a literal, or a container to open */
+		if (val->jval_type == JSON_VAL_LITERAL) {
+			if (   (err = _copy_literal(doc, &tup.jtup_val, val))
+			    || (err = _push(doc, &tup)))
+				goto done;
+		} else {
+			if ((err = _open(doc, val->jval_type, &tup)))
+				goto done;
+			struct _copy_frame * const fr = json_stack_push(&st);
+			if (fr == NULL) {
+				err = errno;
+				goto done;
+			}
+			*fr = (struct _copy_frame) { val, 0 };
+		}
+
+		/* close the containers that are complete */
+		struct _copy_frame * fr;
+		for (;;) {
+			if ((fr = json_stack_top(&st)) == NULL)
+				goto done;
+			unsigned const len =
+				fr->cf_src->jval_type == JSON_VAL_OBJECT
+				? fr->cf_src->jval_object->jobj_length
+				: fr->cf_src->jval_array->jarr_length;
+			if (fr->cf_next < len)
+				break;
+			if (   (err = _close(doc, &tup))
+			    || (err = _push(doc, &tup)))
+				goto done;
+			json_stack_pop(&st);
+		}
+
+		/* next value of the innermost one, in document order */
+		unsigned const i = fr->cf_next++;
+		if (fr->cf_src->jval_type == JSON_VAL_OBJECT) {
+			struct json_object const * const obj =
+				fr->cf_src->jval_object;
+			struct json_tuple const * const t = &obj->jobj_tuples[
+				obj->jobj_order ? obj->jobj_order[i] : i];
+			tup = (struct json_tuple) {
+				.jtup_keylen = t->jtup_keylen,
+				.jtup_hash   = t->jtup_hash,
+			};
+			if ((err = json_doc_string(doc, t->jtup_key,
+						   t->jtup_keylen,
+						   &tup.jtup_key)))
+				goto done;
+			val = &t->jtup_val;
+		} else {
+			tup = (struct json_tuple) { 0 };
+			val = &fr->cf_src->jval_array->jarr_values[i];
+		}
+	}
+
+done:
+	if (err == 0)
+		*dst = doc->jdoc_stack[base].jtup_val;
+	json_stack_release(&st);
+	doc->jdoc_stack_len = base;
+	doc->jdoc_depth = depth;
 	return err;
 }
-#endif
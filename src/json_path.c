@@ -0,0 +1,233 @@
+/*
+ * json_path.c
+ *
+ * Simple JSON parser.
+ *
+ * https://github.com/e03213ac/libjson
+ *
+ * This work belongs to the Public Domain. Everyone is free to use, modify,
+ * republish, sell or give away this work without prior consent from anybody.
+ *
+ * This software is provided on an "AS IS" basis, without warranty of any kind.
+ * Use at your own risk! Under no circumstances shall the author(s) or
+ * contributor(s) be liable for damages resulting directly or indirectly from
+ * the use or non-use of this documentation.
+ */
+
+/* Private API */
+#include "json_private.h"
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                              Compilation                                 //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+int
+json_path_compile(char const * const path, struct json_path ** const newpath)
+{
+	return json_path_compile_intern(path, NULL, newpath);
+}
+
+int
+json_path_compile_intern(
+	char const          * const path,
+	struct json_intern  * const intern,
+	struct json_path   ** const newpath )
+{
+	return json_path_compile_alloc(path, intern, NULL, newpath);
+}
+
+int
+json_path_compile_alloc(
+	char const                  * const path,
+	struct json_intern          * const intern,
+	struct json_allocator const * const alloc,
+	struct json_path           ** const newpath )
+{
+	size_t const len = strlen(path);
+	unsigned n = 1;
+	struct json_path * jpath;
+	char * keys;
+	int err;
+
+	/* count segments */
+	for (char const * p = path; *p; p++)
+		if (*p == '/')
+			n++;
+
+	/* segments, followed by a copy of the path they point into */
+	jpath = json_mem_alloc(alloc, sizeof(*jpath)
+			       + sizeof(struct json_segment) * n + len + 1);
+	if (jpath == NULL) {
+		err = errno;
+		goto fail;
+	}
+	keys = (char *) &jpath->jpath_segs[n];
+	memcpy(keys, path, len + 1);
+
+	jpath->jpath_alloc  = alloc;
+	jpath->jpath_length = n;
+	for (unsigned i = 0; i < n; i++) {
+		struct json_segment * const seg = &jpath->jpath_segs[i];
+		keys = (char *) json_path_segment(keys, seg) + 1;
+		if (seg->jseg_keylen == 0) {
+			err = EINVAL;
+			goto fail_1;
+		}
+		/* a full table only loses the pointer comparison */
+		if (intern) {
+			err = json_intern_lookup(intern, seg->jseg_key,
+						 seg->jseg_keylen,
+						 seg->jseg_hash,
+						 &seg->jseg_key);
+			if (err && err != ENOSPC)
+				goto fail_1;
+		}
+	}
+
+	*newpath = jpath;
+	return 0;
+
+fail_1:	json_mem_free(alloc, jpath);
+fail:	*newpath = NULL;
+	return err;
+}
+
+void
+json_path_free(struct json_path * const path)
+{
+	if (path)
+		json_mem_free(path->jpath_alloc, path);
+}
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                              Discovery                                   //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+struct json_value const *
+json_get_value_at(
+	struct json_object const * const obj,
+	struct json_path const * const path )
+{
+	struct json_value const root = {
+		.jval_type   = JSON_VAL_OBJECT,
+		.jval_object = (struct json_object *) obj,
+	};
+	struct json_value const * val = &root;
+
+	for (unsigned i = 0; i < path->jpath_length; i++)
+		if ((val = json_value_step(val, &path->jpath_segs[i])) == NULL)
+			return NULL;
+
+	/* compiled paths are never empty */
+	return val != &root ? val : NULL;
+}
+
+char const *
+json_get_literal_at(
+	struct json_object const * const obj,
+	struct json_path const * const path )
+{
+	struct json_value const * const val = json_get_value_at(obj, path);
+	return val && val->jval_type == JSON_VAL_LITERAL
+		? val->jval_lit : NULL;
+}
+
+struct json_object const *
+json_get_object_at(
+	struct json_object const * const obj,
+	struct json_path const * const path )
+{
+	struct json_value const * const val = json_get_value_at(obj, path);
+	return val && val->jval_type == JSON_VAL_OBJECT
+		? val->jval_object : NULL;
+}
+
+struct json_array const *
+json_get_array_at(
+	struct json_object const * const obj,
+	struct json_path const * const path )
+{
+	struct json_value const * const val = json_get_value_at(obj, path);
+	return val && val->jval_type == JSON_VAL_ARRAY
+		? val->jval_array : NULL;
+}
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                             Literal values                               //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/* Fetch literal value at given path */
+static inline struct json_value const *
+_get_literal_value_at(
+	struct json_object const * const obj,
+	struct json_path const * const path )
+{
+	struct json_value const * const val = json_get_value_at(obj, path);
+	return val && val->jval_type == JSON_VAL_LITERAL ? val : NULL;
+}
+
+int
+json_get_double_at(
+	struct json_object const * const obj,
+	struct json_path const * const path,
+	double * const val
+	)
+{
+	struct json_value const * const jval = _get_literal_value_at(obj, path);
+	return jval ? json_value_double(jval, val) : ENOENT;
+}
+
+int
+json_get_int_at(
+	struct json_object const * const obj,
+	struct json_path const * const path,
+	int * const val
+	)
+{
+	struct json_value const * const jval = _get_literal_value_at(obj, path);
+	return jval ? json_value_int(jval, val) : ENOENT;
+}
+
+int
+json_get_uint_at(
+	struct json_object const * const obj,
+	struct json_path const * const path,
+	unsigned * const val
+	)
+{
+	struct json_value const * const jval = _get_literal_value_at(obj, path);
+	return jval ? json_value_uint(jval, val) : ENOENT;
+}
+
+int
+json_get_int64_at(
+	struct json_object const * const obj,
+	struct json_path const * const path,
+	int64_t * const val
+	)
+{
+	struct json_value const * const jval = _get_literal_value_at(obj, path);
+	return jval ? json_value_int64(jval, val) : ENOENT;
+}
+
+int
+json_get_uint64_at(
+	struct json_object const * const obj,
+	struct json_path const * const path,
+	uint64_t * const val
+	)
+{
+	struct json_value const * const jval = _get_literal_value_at(obj, path);
+	return jval ? json_value_uint64(jval, val) : ENOENT;
+}
+
+int
+json_get_bool_at(
+	struct json_object const * const obj,
+	struct json_path const * const path,
+	bool * const val
+	)
+{
+	struct json_value const * const jval = _get_literal_value_at(obj, path);
+	return jval ? json_value_bool(jval, val) : ENOENT;
+}
@@ -12,6 +12,135 @@
 #include "json.h"
 #include "json_schema.h"
 
+/* Allocator of parse options, NULL for the standard one */
+static inline struct json_allocator const *
+json_opts_allocator(struct json_parse_options const * const opts)
+{
+	return opts ? opts->jopt_allocator : NULL;
+}
+
+/**
+ * Allocate memory.
+ *
+ * Like malloc(), which is used if the allocator is NULL. Sets errno on
+ * failure.
+ */
+static inline void *
+json_mem_alloc(struct json_allocator const * const a, size_t const size)
+{
+	void * p;
+
+	if (a == NULL)
+		return malloc(size);
+	if ((p = a->jalloc_malloc(a->jalloc_ctx, size)) == NULL)
+		errno = ENOMEM;
+	return p;
+}
+
+/* Resize memory, like realloc() */
+static inline void *
+json_mem_realloc(struct json_allocator const * const a,
+		 void * const p, size_t const size )
+{
+	void * q;
+
+	if (a == NULL)
+		return realloc(p, size);
+	if ((q = a->jalloc_realloc(a->jalloc_ctx, p, size)) == NULL)
+		errno = ENOMEM;
+	return q;
+}
+
+/* Free memory, like free() */
+static inline void
+json_mem_free(struct json_allocator const * const a, void * const p)
+{
+	if (a == NULL)
+		free(p);
+	else if (p)
+		a->jalloc_free(a->jalloc_ctx, p);
+}
+
+/* Frames of a stack held by its caller */
+#define JSON_STACK_INLINE 32
+
+/**
+ * Stack of frames, to walk nested containers without recursion.
+ *
+ * Frames are kept in an array of JSON_STACK_INLINE frames held by the
+ * caller until it is full, then in memory from the allocator, grown by
+ * doubling.
+ */
+struct json_stack {
+	char                 * jst_frames;
+	void                 * jst_inline;    // the caller's frames
+	size_t                 jst_frame_size;
+	unsigned               jst_size;      // room, in frames
+	unsigned               jst_depth;     // frames pushed
+	struct json_allocator const * jst_alloc; // or NULL
+};
+
+/* Start a stack in the caller's frames */
+static inline void
+json_stack_init(struct json_stack * const st, void * const frames,
+		size_t const frame_size, struct json_allocator const * const a)
+{
+	*st = (struct json_stack) {
+		.jst_frames     = frames,
+		.jst_inline     = frames,
+		.jst_frame_size = frame_size,
+		.jst_size       = JSON_STACK_INLINE,
+		.jst_alloc      = a,
+	};
+}
+
+/**
+ * Push a frame, for the caller to fill in.
+ *
+ * Returns NULL, with errno set, if memory runs out.
+ */
+static inline void *
+json_stack_push(struct json_stack * const st)
+{
+	if (st->jst_depth == st->jst_size) {
+		bool const inl = st->jst_frames == st->jst_inline;
+		size_t const size = st->jst_frame_size * st->jst_size;
+		char * const p = json_mem_realloc(st->jst_alloc,
+			inl ? NULL : st->jst_frames, size * 2);
+		if (p == NULL)
+			return NULL;
+		if (inl)
+			memcpy(p, st->jst_frames, size);
+		st->jst_frames = p;
+		st->jst_size *= 2;
+	}
+	return st->jst_frames + st->jst_frame_size * st->jst_depth++;
+}
+
+/* Top frame, or NULL if the stack is empty */
+static inline void *
+json_stack_top(struct json_stack const * const st)
+{
+	return st->jst_depth
+	     ? st->jst_frames + st->jst_frame_size * (st->jst_depth - 1)
+	     : NULL;
+}
+
+/* Pop the top frame */
+static inline void
+json_stack_pop(struct json_stack * const st)
+{
+	st->jst_depth--;
+}
+
+/* Release the frames */
+static inline void
+json_stack_release(struct json_stack * const st)
+{
+	if (st->jst_frames != st->jst_inline)
+		json_mem_free(st->jst_alloc, st->jst_frames);
+}
+
 /*
  * Tokens.
  */
@@ -29,52 +158,383 @@ enum json_token_id {
 
 /**
  * A token.
+ *
+ * Literal tokens carry their typed value.
  */
 struct json_token {
 	enum json_token_id     tok_id;
-	char const           * tok_s;
+	struct json_value      tok_val;       // JSON_TOK_LIT only
+	size_t                 tok_len;       // length of literal
+};
+
+/**
+ * Arena chunk.
+ */
+struct json_chunk {
+	struct json_chunk    * jchk_next;
+	size_t                 jchk_size;     // total size of the chunk
+	bool                   jchk_mapped;   // allocated with mmap()
+	char                   jchk_data[] __attribute__((aligned(8)));
+};
+
+/**
+ * Bump-pointer arena.
+ *
+ * Memory is carved out of a list of chunks of geometrically increasing size
+ * and is only ever released all at once.
+ */
+struct json_arena {
+	struct json_chunk    * jar_head;      // current chunk, then older ones
+	char                 * jar_p;         // next free byte
+	char                 * jar_e;         // end of current chunk
+	size_t                 jar_next;      // size of next chunk
+	bool                   jar_hugepages; // back large chunks by huge pages
+	struct json_allocator const * jar_alloc; // other chunks, or NULL
 };
 
 /**
- * Garbage collector.
+ * An open container, while parsing.
  */
-struct json_gc {
-	struct json_gc       * jgc_next;
-	char                   jgc_data[];
+struct json_frame {
+	enum json_value_type   jfr_type;      // JSON_VAL_OBJECT or _ARRAY
+	unsigned               jfr_base;      // first value on scratch stack
+	char const           * jfr_key;       // key in parent object
+	unsigned               jfr_keylen;
+	uint32_t               jfr_hash;
 };
 
+/**
+ * Grammar states.
+ */
+enum json_grammar_state {
+	S_START,         // before {
+	S_OBJECT_FIRST,  // after {
+	S_OBJECT_KEY,    // after , in object
+	S_ARRAY_FIRST,   // after [
+	S_VALUE,         // after : in object, or , in array
+	S_NEXT,          // after a value
+	S_DONE,          // after the document
+};
+
+/**
+ * Grammar state, between two parts of a document.
+ */
+struct json_grammar {
+	enum json_grammar_state jgr_state;
+	struct json_tuple      jgr_tup;       // value being built
+};
+
+/* Size of a structural index window */
+#define JSON_INDEX_WINDOW ((size_t) 64 << 10)
+
+/**
+ * Structural index of a window of buffer input.
+ */
+struct json_index {
+	uint32_t             * jix_pos;       // token starts, from jix_base
+	size_t                 jix_size;      // capacity of jix_pos
+	uint32_t const       * jix_p;         // next token start
+	uint32_t const       * jix_e;         // end of token starts
+	char const           * jix_base;      // start of window
+	char const           * jix_end;       // end of window
+};
+
+/**
+ * Interned string.
+ */
+struct json_intern_slot {
+	char const           * jis_str;       // NULL if the slot is free
+	size_t                 jis_len;
+	uint32_t               jis_hash;
+};
+
+/**
+ * String intern table.
+ *
+ * An open-addressing hash table of strings, which are allocated from an
+ * arena of the table's own and live as long as the table.
+ */
+struct json_intern {
+	struct json_intern_slot * jint_slots;
+	unsigned               jint_mask;     // number of slots, less one
+	unsigned               jint_count;    // number of strings
+	unsigned               jint_max;      // maximum number of strings
+	struct json_arena      jint_arena;
+	struct json_allocator const * jint_alloc; // or NULL
+};
+
+/* Longest literal worth interning */
+#define JSON_INTERN_MAX_LEN 64
+
+/* Literals only need to live until the next token (private parse flag) */
+#define JSON_PARSE_TRANSIENT 0x80000000u
+
+/* Default maximum nesting depth */
+#define JSON_DEFAULT_MAX_DEPTH 512
+
 /**
  * JSON parser handle.
  */
 struct json_doc {
-	FILE                 * jdoc_f;
+	FILE                 * jdoc_f;        // input stream, or NULL
+	char const           * jdoc_p;        // input cursor (buffer input)
+	char const           * jdoc_e;        // end of input (buffer input)
+	unsigned               jdoc_flags;    // JSON_PARSE_xxx
 	unsigned               jdoc_lineno;
 	bool                   jdoc_nextc_avail;
 	char                   jdoc_nextc;
 	bool                   jdoc_lookahead_avail;
 	struct json_token      jdoc_lookahead;
-	struct json_gc       * jdoc_head;
+	struct json_index      jdoc_index;    // structural index
+	char                 * jdoc_buf;      // scratch token buffer
+	size_t                 jdoc_buf_size;
+	char                 * jdoc_lit;      // transient literal
+	size_t                 jdoc_lit_size;
+	struct json_tuple    * jdoc_stack;    // scratch stack of values
+	unsigned               jdoc_stack_len;
+	unsigned               jdoc_stack_size;
+	uint32_t             * jdoc_perm;     // scratch permutation
+	unsigned               jdoc_perm_size;
+	struct json_frame    * jdoc_frames;   // open containers
+	unsigned               jdoc_depth;
+	unsigned               jdoc_frames_size;
+	char                 * jdoc_undo;     // undo journal of edits
+	size_t                 jdoc_undo_len;
+	size_t                 jdoc_undo_size;
+	unsigned               jdoc_max_depth;
+	struct json_arena      jdoc_arena;
+	struct json_intern   * jdoc_intern;   // shared intern table, or NULL
+	struct json_allocator const * jdoc_alloc; // or NULL
 	struct json_object   * jdoc_obj;
 };
 
 /**
- * Allocate using the garbage collector.
+ * Record reader.
+ */
+struct json_records {
+	struct json_doc        jrc_doc;       // current record
+	int                    jrc_err;       // first error, or 0
+	bool                   jrc_keep;      // records outlive the next one
+};
+
+/**
+ * Point a record reader at a new buffer.
+ *
+ * The records read so far are released, but not the memory they used.
+ */
+extern void json_records_rewind(struct json_records *,
+	char const * p, size_t size);
+
+/**
+ * Copy a string into a document.
+ *
+ * With an intern table, short strings are replaced by their canonical copy.
+ */
+extern int json_doc_string(struct json_doc *,
+	char const * s, size_t len, char const ** out);
+
+/**
+ * Copy a value into a document, strings and containers included.
+ *
+ * Copied containers are laid out like parsed ones, according to the parse
+ * flags of the document. Numbers without text have it made from their value;
+ * strings without text, and doubles that are not finite, give EINVAL.
+ */
+extern int json_doc_copy_value(struct json_doc *,
+	struct json_value const * src, struct json_value * dst);
+
+/* Arena allocation alignment */
+#define JSON_ARENA_ALIGN 8
+
+/* Arena methods.
+ */
+extern void json_arena_init(struct json_arena *, bool hugepages,
+	struct json_allocator const *);
+extern int  json_arena_grow(struct json_arena *, size_t size, void **);
+extern void json_arena_release(struct json_arena *);
+extern void json_arena_reset(struct json_arena *);
+
+/**
+ * Allocate from arena.
+ */
+static inline int
+json_arena_alloc(struct json_arena * const ar, size_t const size,
+		 void ** const p )
+{
+	uintptr_t const a = ((uintptr_t) ar->jar_p + JSON_ARENA_ALIGN - 1)
+			  & ~(uintptr_t) (JSON_ARENA_ALIGN - 1);
+
+	if (ar->jar_p && size <= (uintptr_t) ar->jar_e - a) {
+		ar->jar_p = (char *) a + size;
+		*p = (void *) a;
+		return 0;
+	}
+
+	return json_arena_grow(ar, size, p);
+}
+
+/**
+ * Allocate memory owned by the document.
  */
 #define _gcmalloc(doc, size, pp) \
 ({ \
-	struct json_doc * const _doc = (doc); \
-	struct json_gc * const _p = malloc(sizeof(struct json_gc) + (size)); \
- 	*(pp) = _p ? (void *) _p->jgc_data : NULL; \
-	if (_p) { \
-		_p->jgc_next = _doc->jdoc_head; \
-		_doc->jdoc_head = _p; \
-	} \
-	_p ? 0 : errno; \
+	void * _p; \
+	int const _err = json_arena_alloc(&(doc)->jdoc_arena, (size), &_p); \
+	*(pp) = _p; \
+	_err; \
 })
 
+/* Range of the table of powers of five */
+#define JSON_POW5_MIN (-342)
+#define JSON_POW5_MAX 325
+
+/* Powers of five, as 128-bit mantissas */
+extern uint64_t const json_pow5[][2];
+
+/* Longest number text, see json_format.c */
+#define JSON_FORMAT_SIZE 32
+
+/* Number to text; doubles that are not finite have none (0) */
+size_t json_format_uint64(uint64_t v, char * buf);
+size_t json_format_int64(int64_t v, char * buf);
+size_t json_format_double(double d, char * buf);
+
+/* Objects at least this wide get a key index */
+#define JSON_KEY_INDEX_MIN 16
+
+/* Initial key hash value */
+#define JSON_KEY_HASH_INIT 2166136261u
+
+/**
+ * Hash one more character of a key.
+ *
+ * Keys are matched regardless of ASCII case, so their hash is case-folded.
+ */
+static inline uint32_t
+json_key_hash_step(uint32_t const h, char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		c += 'a' - 'A';
+	return (h ^ (unsigned char) c) * 16777619u;
+}
+
+/* Hash a key */
+static inline uint32_t
+json_key_hash(char const * const key, size_t const len)
+{
+	uint32_t h = JSON_KEY_HASH_INIT;
+
+	for (size_t i = 0; i < len; i++)
+		h = json_key_hash_step(h, key[i]);
+	return h;
+}
+
+/**
+ * Compare keys regardless of ASCII case.
+ */
+static inline int
+json_key_compare(char const * const a, size_t const alen,
+		 char const * const b, size_t const blen)
+{
+	size_t const len = alen < blen ? alen : blen;
+
+	for (size_t i = 0; i < len; i++) {
+		unsigned char x = a[i];
+		unsigned char y = b[i];
+		if (x >= 'A' && x <= 'Z')
+			x += 'a' - 'A';
+		if (y >= 'A' && y <= 'Z')
+			y += 'a' - 'A';
+		if (x != y)
+			return x - y;
+	}
+	return (alen > blen) - (alen < blen);
+}
+
+/* Find a key in an object, given its length and hash */
+extern struct json_tuple const *json_object_find(
+	struct json_object const *, char const * key, size_t len, uint32_t hash);
+
+/* Not an array index */
+#define JSON_PATH_NOINDEX UINT_MAX
+
+/**
+ * Path segment.
+ *
+ * A segment made of digits is also an array index.
+ */
+struct json_segment {
+	char const           * jseg_key;
+	unsigned               jseg_keylen;
+	uint32_t               jseg_hash;
+	unsigned               jseg_index;    // or JSON_PATH_NOINDEX
+};
+
+/**
+ * Compiled path.
+ */
+struct json_path {
+	struct json_allocator const * jpath_alloc; // or NULL
+	unsigned               jpath_length;
+	struct json_segment    jpath_segs[];
+};
+
+/**
+ * Measure, hash and decode the path segment starting at s.
+ *
+ * Returns the end of the segment: a slash or the terminating NUL.
+ */
+static inline char const *
+json_path_segment(char const * const s, struct json_segment * const seg)
+{
+	uint32_t h = JSON_KEY_HASH_INIT;
+	uint64_t index = 0;
+	char const * e;
+
+	for (e = s; *e && *e != '/'; e++) {
+		h = json_key_hash_step(h, *e);
+		if (*e >= '0' && *e <= '9' && index < JSON_PATH_NOINDEX)
+			index = index * 10 + (*e - '0');
+		else
+			index = JSON_PATH_NOINDEX;
+	}
+
+	/* no leading zeros in indices */
+	if (e == s || (*s == '0' && e - s > 1))
+		index = JSON_PATH_NOINDEX;
+
+	*seg = (struct json_segment) {
+		.jseg_key    = s,
+		.jseg_keylen = e - s,
+		.jseg_hash   = h,
+		.jseg_index  = index < JSON_PATH_NOINDEX
+			     ? index : JSON_PATH_NOINDEX,
+	};
+	return e;
+}
+
+/* Follow one path segment from a value */
+extern struct json_value const *json_value_step(
+	struct json_value const *, struct json_segment const *);
+
+/**
+ * Find a string in an intern table, adding it if needed.
+ *
+ * The hash is that of json_key_hash(). Returns ENOSPC if the string is not
+ * there and the table is full.
+ */
+extern int json_intern_lookup(struct json_intern *,
+	char const * s, size_t len, uint32_t hash, char const ** out);
+
+/* Structural index methods.
+ */
+extern int json_index_window(struct json_index *,
+	struct json_allocator const *, char const *, char const *);
+
 /* Tokenizer methods.
  */
 extern int json_consume_token(struct json_doc *, struct json_token *);
 extern int json_peek_token(struct json_doc *, struct json_token *);
+extern int json_skip_container(struct json_doc *);
 
 #endif
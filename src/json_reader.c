@@ -0,0 +1,352 @@
+/*
+ * json_reader.c
+ *
+ * Simple JSON parser.
+ *
+ * https://github.com/e03213ac/libjson
+ *
+ * This work belongs to the Public Domain. Everyone is free to use, modify,
+ * republish, sell or give away this work without prior consent from anybody.
+ *
+ * This software is provided on an "AS IS" basis, without warranty of any kind.
+ * Use at your own risk! Under no circumstances shall the author(s) or
+ * contributor(s) be liable for damages resulting directly or indirectly from
+ * the use or non-use of this documentation.
+ */
+
+/* Private API */
+#include "json_private.h"
+
+/**
+ * Reader states: the grammar of json_parse.c, one event at a time.
+ */
+enum _state {
+	R_START,         // before the document
+	R_OBJECT_FIRST,  // after {
+	R_OBJECT_KEY,    // after , in object
+	R_COLON,         // after a key
+	R_ARRAY_FIRST,   // after [
+	R_VALUE,         // after : in object, or , in array
+	R_NEXT,          // after a value
+	R_DONE,          // after the document
+	R_ERROR,         // after an error
+};
+
+/**
+ * Pull reader.
+ */
+struct json_reader {
+	struct json_doc        jrd_doc;       // tokenizer state
+	enum _state            jrd_state;
+	int                    jrd_err;       // R_ERROR only
+	uint8_t              * jrd_types;     // types of open containers
+	unsigned               jrd_types_size;
+};
+
+/**
+ * Create a reader around a parser handle initialized by the caller.
+ */
+static int
+_new(struct json_doc const * const doc, struct json_reader ** const newrd)
+{
+	struct json_reader * rd;
+
+	if ((rd = json_mem_alloc(doc->jdoc_alloc, sizeof(*rd))) == NULL) {
+		*newrd = NULL;
+		return errno;
+	}
+	*rd = (struct json_reader) {
+		.jrd_doc   = *doc,
+		.jrd_state = R_START,
+	};
+
+	/* events only live until the next one */
+	rd->jrd_doc.jdoc_flags &= ~JSON_PARSE_SORTKEYS;
+	rd->jrd_doc.jdoc_flags |= JSON_PARSE_TRANSIENT;
+	json_arena_init(&rd->jrd_doc.jdoc_arena, false, doc->jdoc_alloc);
+
+	*newrd = rd;
+	return 0;
+}
+
+int
+json_reader_new(
+	FILE                            * const f,
+	struct json_parse_options const * const opts,
+	struct json_reader             ** const newrd )
+{
+	struct json_doc const doc = {
+		.jdoc_f         = f,
+		.jdoc_flags     = (opts ? opts->jopt_flags : 0)
+				& ~JSON_PARSE_INSITU,
+		.jdoc_max_depth = opts && opts->jopt_max_depth
+				? opts->jopt_max_depth : JSON_DEFAULT_MAX_DEPTH,
+		.jdoc_intern    = opts ? opts->jopt_intern : NULL,
+		.jdoc_alloc     = json_opts_allocator(opts),
+		.jdoc_lineno    = 1,
+	};
+
+	return _new(&doc, newrd);
+}
+
+int
+json_reader_new_data(
+	void                            * const buf,
+	size_t                            const size,
+	struct json_parse_options const * const opts,
+	struct json_reader             ** const newrd )
+{
+	struct json_doc const doc = {
+		.jdoc_p         = buf,
+		.jdoc_e         = (char const *) buf + size,
+		.jdoc_flags     = opts ? opts->jopt_flags : 0,
+		.jdoc_max_depth = opts && opts->jopt_max_depth
+				? opts->jopt_max_depth : JSON_DEFAULT_MAX_DEPTH,
+		.jdoc_intern    = opts ? opts->jopt_intern : NULL,
+		.jdoc_alloc     = json_opts_allocator(opts),
+		.jdoc_lineno    = 1,
+	};
+
+	return _new(&doc, newrd);
+}
+
+void
+json_reader_free(struct json_reader * const rd)
+{
+	struct json_doc * const doc = &rd->jrd_doc;
+
+	json_mem_free(doc->jdoc_alloc, doc->jdoc_index.jix_pos);
+	json_mem_free(doc->jdoc_alloc, doc->jdoc_buf);
+	json_mem_free(doc->jdoc_alloc, doc->jdoc_lit);
+	json_arena_release(&doc->jdoc_arena);
+	json_mem_free(doc->jdoc_alloc, rd->jrd_types);
+	json_mem_free(doc->jdoc_alloc, rd);
+}
+
+/**
+ * Open a container.
+ */
+static int
+_open(struct json_reader * const rd, enum json_value_type const type)
+{
+	struct json_doc * const doc = &rd->jrd_doc;
+
+	if (doc->jdoc_depth == doc->jdoc_max_depth)
+		return EOVERFLOW;
+
+	if (doc->jdoc_depth == rd->jrd_types_size) {
+		unsigned const n = rd->jrd_types_size
+				 ? rd->jrd_types_size * 2 : 16;
+		uint8_t * const p = json_mem_realloc(doc->jdoc_alloc,
+						     rd->jrd_types, n);
+		if (p == NULL)
+			return errno;
+		rd->jrd_types = p;
+		rd->jrd_types_size = n;
+	}
+
+	rd->jrd_types[doc->jdoc_depth++] = type;
+	return 0;
+}
+
+/* Type of the innermost container */
+static inline enum json_value_type
+_type(struct json_reader const * const rd)
+{
+	return rd->jrd_types[rd->jrd_doc.jdoc_depth - 1];
+}
+
+/* The value just read or skipped ends the document if it is the root */
+static inline enum _state
+_after_value(struct json_reader const * const rd)
+{
+	return rd->jrd_doc.jdoc_depth ? R_NEXT : R_DONE;
+}
+
+/* Stop on error; the reader keeps returning it */
+static inline int
+_fail(struct json_reader * const rd, int const err)
+{
+	rd->jrd_state = R_ERROR;
+	rd->jrd_err = err;
+	return err;
+}
+
+int
+json_reader_next(struct json_reader * const rd, struct json_read * const ev)
+{
+	struct json_doc * const doc = &rd->jrd_doc;
+	struct json_token tok;
+	int err;
+
+	*ev = (struct json_read) { JSON_READ_END };
+	if (rd->jrd_state == R_ERROR)
+		return rd->jrd_err;
+	if (rd->jrd_state == R_DONE)
+		return 0;
+
+	for (;;) {
+		if ((err = json_consume_token(doc, &tok)))
+			return _fail(rd, err);
+
+		switch (rd->jrd_state) {
+		case R_START:
+			if (tok.tok_id != JSON_TOK_OBJECT_BEGIN)
+				return _fail(rd, EINVAL);
+			goto open;
+
+		case R_OBJECT_FIRST:
+			if (tok.tok_id == JSON_TOK_OBJECT_END)
+				goto close;
+			/* fall through */
+		case R_OBJECT_KEY:
+			if (tok.tok_id != JSON_TOK_LIT)
+				return _fail(rd, EINVAL);
+			ev->jrd_type   = JSON_READ_KEY;
+			ev->jrd_key    = tok.tok_val.jval_lit;
+			ev->jrd_keylen = tok.tok_len;
+			rd->jrd_state  = R_COLON;
+			return 0;
+
+		case R_COLON:
+			if (tok.tok_id != JSON_TOK_COLON)
+				return _fail(rd, EINVAL);
+			rd->jrd_state = R_VALUE;
+			continue;
+
+		case R_ARRAY_FIRST:
+			if (tok.tok_id == JSON_TOK_ARRAY_END)
+				goto close;
+			/* fall through */
+		case R_VALUE:
+			if (tok.tok_id == JSON_TOK_LIT) {
+				ev->jrd_type  = JSON_READ_VALUE;
+				ev->jrd_val   = tok.tok_val;
+				rd->jrd_state = R_NEXT;
+				return 0;
+			}
+			if (   tok.tok_id != JSON_TOK_OBJECT_BEGIN
+			    && tok.tok_id != JSON_TOK_ARRAY_BEGIN)
+				return _fail(rd, EINVAL);
+			goto open;
+
+		case R_NEXT:
+			if (tok.tok_id == JSON_TOK_COMMA) {
+				rd->jrd_state = _type(rd) == JSON_VAL_OBJECT
+					      ? R_OBJECT_KEY : R_VALUE;
+				continue;
+			}
+			if (   (_type(rd) == JSON_VAL_OBJECT
+			        && tok.tok_id == JSON_TOK_OBJECT_END)
+			    || (_type(rd) == JSON_VAL_ARRAY
+			        && tok.tok_id == JSON_TOK_ARRAY_END))
+				goto close;
+			return _fail(rd, EINVAL);
+
+		default:
+			assert(0);
+		}
+	}
+
+open:
+	if (tok.tok_id == JSON_TOK_OBJECT_BEGIN) {
+		if ((err = _open(rd, JSON_VAL_OBJECT)))
+			return _fail(rd, err);
+		ev->jrd_type  = JSON_READ_OBJECT_BEGIN;
+		rd->jrd_state = R_OBJECT_FIRST;
+	} else {
+		if ((err = _open(rd, JSON_VAL_ARRAY)))
+			return _fail(rd, err);
+		ev->jrd_type  = JSON_READ_ARRAY_BEGIN;
+		rd->jrd_state = R_ARRAY_FIRST;
+	}
+	return 0;
+
+close:
+	ev->jrd_type = _type(rd) == JSON_VAL_OBJECT
+		     ? JSON_READ_OBJECT_END : JSON_READ_ARRAY_END;
+	doc->jdoc_depth--;
+	rd->jrd_state = _after_value(rd);
+	return 0;
+}
+
+int
+json_reader_skip(struct json_reader * const rd)
+{
+	struct json_doc * const doc = &rd->jrd_doc;
+	struct json_token tok;
+	int err;
+
+	if (rd->jrd_state == R_ERROR)
+		return rd->jrd_err;
+
+	/* get to the start of a value */
+	switch (rd->jrd_state) {
+	case R_NEXT:
+		if ((err = json_peek_token(doc, &tok)))
+			return _fail(rd, err);
+		if (tok.tok_id != JSON_TOK_COMMA)
+			return ENOENT;
+		doc->jdoc_lookahead_avail = false;
+		if (_type(rd) == JSON_VAL_ARRAY)
+			break;
+		/* fall through */
+	case R_OBJECT_FIRST:
+	case R_OBJECT_KEY:
+		if ((err = json_peek_token(doc, &tok)))
+			return _fail(rd, err);
+		if (   tok.tok_id == JSON_TOK_OBJECT_END
+		    && rd->jrd_state == R_OBJECT_FIRST) {
+			rd->jrd_state = R_NEXT;
+			return ENOENT;
+		}
+		doc->jdoc_lookahead_avail = false;
+		if (tok.tok_id != JSON_TOK_LIT)
+			return _fail(rd, EINVAL);
+		/* fall through */
+	case R_COLON:
+		if ((err = json_consume_token(doc, &tok)))
+			return _fail(rd, err);
+		if (tok.tok_id != JSON_TOK_COLON)
+			return _fail(rd, EINVAL);
+		break;
+	case R_ARRAY_FIRST:
+		if ((err = json_peek_token(doc, &tok)))
+			return _fail(rd, err);
+		if (tok.tok_id == JSON_TOK_ARRAY_END) {
+			rd->jrd_state = R_NEXT;
+			return ENOENT;
+		}
+		break;
+	case R_START:
+	case R_VALUE:
+		break;
+	case R_DONE:
+		return ENOENT;
+	default:
+		assert(0);
+	}
+
+	/* skip it */
+	if ((err = json_consume_token(doc, &tok)))
+		return _fail(rd, err);
+	switch (tok.tok_id) {
+	case JSON_TOK_LIT:
+		if (rd->jrd_state == R_START)
+			return _fail(rd, EINVAL);
+		break;
+	case JSON_TOK_OBJECT_BEGIN:
+	case JSON_TOK_ARRAY_BEGIN:
+		if (rd->jrd_state == R_START
+		    && tok.tok_id != JSON_TOK_OBJECT_BEGIN)
+			return _fail(rd, EINVAL);
+		if ((err = json_skip_container(doc)))
+			return _fail(rd, err);
+		break;
+	default:
+		return _fail(rd, EINVAL);
+	}
+
+	rd->jrd_state = _after_value(rd);
+	return 0;
+}
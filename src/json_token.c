@@ -14,38 +14,309 @@
  * the use or non-use of this documentation.
  */
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* Private API */
 #include "json_private.h"
 
 /* Return an error token */
 #define RETURN_TOKEN_ERROR(tok, err) \
 do { \
-	*(tok) = (struct json_token) { JSON_TOK_ERR, NULL }; \
+	*(tok) = (struct json_token) { JSON_TOK_ERR }; \
 	return (err); \
 } while(0)
 
 /* Return a punctuation token */
 #define RETURN_TOKEN(tok, id) \
 do { \
-	*(tok) = (struct json_token) { (id), NULL }; \
+	*(tok) = (struct json_token) { (id) }; \
 	return 0; \
 } while(0)
 
-/* Return a literal token */
-#define RETURN_TOKEN_LIT(tok, lit) \
+/* Return a literal token, given its length and the initializers of its value
+ */
+#define RETURN_TOKEN_LIT(tok, len, ...) \
 do { \
-	*(tok) = (struct json_token) { JSON_TOK_LIT, (lit) }; \
+	*(tok) = (struct json_token) { \
+		.tok_id  = JSON_TOK_LIT, \
+		.tok_val = { .jval_type = JSON_VAL_LITERAL, __VA_ARGS__ }, \
+		.tok_len = (len), \
+	}; \
 	return 0; \
 } while(0)
 
-/* Store character in buffer */
-#define WRITECHAR(s, e, c) \
+/* Store character in token buffer, growing the scratch buffer as needed */
+#define WRITECHAR(doc, s, e, c) \
 ({ \
-	bool const _ok = s < e; \
+	bool const _ok = s < e || _grow(doc, &s, &e); \
 	if (_ok) *s++ = c; \
 	_ok; \
 })
 
+/**
+ * Read next input character.
+ *
+ * In-memory documents are read straight from the caller's buffer; only
+ * stream documents go through stdio.
+ */
+static inline int
+_getc(struct json_doc * const doc)
+{
+	if (doc->jdoc_f == NULL)
+		return doc->jdoc_p < doc->jdoc_e
+			? (unsigned char) *doc->jdoc_p++ : EOF;
+	return getc(doc->jdoc_f);
+}
+
+/* Check if end of input was reached */
+static inline bool
+_eof(struct json_doc const * const doc)
+{
+	return doc->jdoc_f ? feof(doc->jdoc_f) : doc->jdoc_p == doc->jdoc_e;
+}
+
+/* Check if input stream is in error */
+static inline bool
+_error(struct json_doc const * const doc)
+{
+	return doc->jdoc_f ? ferror(doc->jdoc_f) : false;
+}
+
+/* Check whether literals are stored in place in the input buffer */
+static inline bool
+_insitu(struct json_doc const * const doc)
+{
+	return doc->jdoc_f == NULL && (doc->jdoc_flags & JSON_PARSE_INSITU);
+}
+
+/**
+ * Grow the scratch buffer, keeping the characters written so far.
+ *
+ * Tokens written in situ never need more room than they had in the input.
+ */
+static bool
+_grow(struct json_doc * const doc, char ** const s, char ** const e)
+{
+	char * const old = doc->jdoc_buf;
+	size_t const len = *s - old;
+	size_t const size = doc->jdoc_buf_size ? doc->jdoc_buf_size * 2 : 256;
+	char * buf;
+
+	if (_insitu(doc))
+		return false;
+	if ((buf = json_mem_alloc(doc->jdoc_alloc, size)) == NULL)
+		return false;
+	if (len)
+		memcpy(buf, old, len);
+	json_mem_free(doc->jdoc_alloc, old);
+
+	doc->jdoc_buf = buf;
+	doc->jdoc_buf_size = size;
+	*s = buf + len;
+	*e = buf + size;
+	return true;
+}
+
+/**
+ * Begin writing a decoded token.
+ *
+ * In situ, characters are written back into the input buffer from the given
+ * position; otherwise they go to the scratch buffer.
+ */
+static inline char *
+_tokbegin(struct json_doc * const doc, char * const insitu, char ** const e)
+{
+	if (_insitu(doc)) {
+		*e = (char *) doc->jdoc_e;
+		return insitu;
+	}
+	*e = doc->jdoc_buf + doc->jdoc_buf_size;
+	return doc->jdoc_buf;
+}
+
+/**
+ * Store a literal value of the given length.
+ *
+ * In situ, the literal is terminated where it lies in the input buffer if
+ * there is room for the terminating NUL. Otherwise it is copied, either out
+ * of the input or out of the scratch buffer, into the document or, if it
+ * is transient, into a buffer reused by the next literal.
+ */
+static inline int
+_store_literal(struct json_doc * const doc,
+	       char const * const start, size_t const len,
+	       char ** const lit )
+{
+	int err;
+
+	if (_insitu(doc) && start + len < doc->jdoc_e) {
+		*lit = (char *) start;
+		(*lit)[len] = '\0';
+		return 0;
+	}
+	if (doc->jdoc_flags & JSON_PARSE_TRANSIENT) {
+		if (len >= doc->jdoc_lit_size) {
+			size_t size = doc->jdoc_lit_size ? : 256;
+			while (size <= len)
+				size *= 2;
+			char * const p = json_mem_alloc(doc->jdoc_alloc, size);
+			if (p == NULL)
+				return errno ? : ENOMEM;
+			json_mem_free(doc->jdoc_alloc, doc->jdoc_lit);
+			doc->jdoc_lit = p;
+			doc->jdoc_lit_size = size;
+		}
+		*lit = doc->jdoc_lit;
+	} else if ((err = _gcmalloc(doc, len + 1, lit)))
+		return err;
+	if (len)
+		memcpy(*lit, start, len);
+	(*lit)[len] = '\0';
+	return 0;
+}
+
+/**
+ * Store a string literal of the given length.
+ *
+ * With an intern table, short strings are replaced by their canonical copy,
+ * and take no room in the document.
+ */
+static inline int
+_store_string(struct json_doc * const doc,
+	      char const * const start, size_t const len,
+	      char ** const lit )
+{
+	if (doc->jdoc_intern && len <= JSON_INTERN_MAX_LEN) {
+		char const * str;
+		int const err = json_intern_lookup(doc->jdoc_intern, start, len,
+						   json_key_hash(start, len),
+						   &str);
+		if (err == 0) {
+			*lit = (char *) str;
+			return 0;
+		}
+		if (err != ENOSPC)
+			return err;
+	}
+	return _store_literal(doc, start, len, lit);
+}
+
+/* End of a literal scanned directly from the input buffer */
+static inline char const *
+_spanend(struct json_doc const * const doc, int const c)
+{
+	/* the cursor is past the terminating character, if any */
+	return c == EOF && _eof(doc) ? doc->jdoc_p : doc->jdoc_p - 1;
+}
+
+/* Decode hexadecimal digit, or return -1 */
+static inline int
+_hexval(int const c)
+{
+	switch (c) {
+	case '0' ... '9': return c - '0';
+	case 'a' ... 'f': return c - 'a' + 10;
+	case 'A' ... 'F': return c - 'A' + 10;
+	default:          return -1;
+	}
+}
+
+/* Consume the four hexadecimal digits of a \u escape */
+static inline int
+_consume_hex4(struct json_doc * const doc, uint32_t * const val)
+{
+	uint32_t v = 0;
+
+	for (unsigned i = 0; i < 4; i++) {
+		int const x = _hexval(_getc(doc));
+		if (x < 0)
+			return EINVAL;
+		v = v << 4 | x;
+	}
+
+	*val = v;
+	return 0;
+}
+
+/**
+ * Consume an escape sequence, the backslash excluded.
+ *
+ * Surrogate pairs are combined into a single code point.
+ */
+static inline int
+_consume_escape(struct json_doc * const doc, uint32_t * const cp)
+{
+	uint32_t lo;
+	int err;
+
+	switch (_getc(doc)) {
+	case '"':  *cp = '"';  return 0;
+	case '\\': *cp = '\\'; return 0;
+	case '/':  *cp = '/';  return 0;
+	case 'b':  *cp = '\b'; return 0;
+	case 'f':  *cp = '\f'; return 0;
+	case 'n':  *cp = '\n'; return 0;
+	case 'r':  *cp = '\r'; return 0;
+	case 't':  *cp = '\t'; return 0;
+	case 'u':  break;
+	case EOF:  return _eof(doc) ? EINVAL : EIO;
+	default:   return EINVAL;
+	}
+
+	if ((err = _consume_hex4(doc, cp)))
+		return err;
+	/* NUL cannot be represented in a literal */
+	if (*cp == 0)
+		return EINVAL;
+	/* lone low surrogate */
+	if (*cp >= 0xdc00 && *cp <= 0xdfff)
+		return EINVAL;
+	if (*cp < 0xd800 || *cp > 0xdbff)
+		return 0;
+
+	/* high surrogate must be followed by a low surrogate */
+	if (_getc(doc) != '\\' || _getc(doc) != 'u')
+		return EINVAL;
+	if ((err = _consume_hex4(doc, &lo)))
+		return err;
+	if (lo < 0xdc00 || lo > 0xdfff)
+		return EINVAL;
+
+	*cp = 0x10000 + ((*cp - 0xd800) << 10) + (lo - 0xdc00);
+	return 0;
+}
+
+/* Store a code point in buffer, UTF-8 encoded */
+static inline bool
+_writeutf8(struct json_doc * const doc,
+	   char ** const sp, char ** const ep, uint32_t const cp )
+{
+	char * s = *sp;
+	char * e = *ep;
+	bool   ok;
+
+	if (cp < 0x80)
+		ok = WRITECHAR(doc, s, e, cp);
+	else if (cp < 0x800)
+		ok =   WRITECHAR(doc, s, e, 0xc0 | cp >> 6)
+		    && WRITECHAR(doc, s, e, 0x80 | (cp & 0x3f));
+	else if (cp < 0x10000)
+		ok =   WRITECHAR(doc, s, e, 0xe0 | cp >> 12)
+		    && WRITECHAR(doc, s, e, 0x80 | (cp >> 6 & 0x3f))
+		    && WRITECHAR(doc, s, e, 0x80 | (cp & 0x3f));
+	else
+		ok =   WRITECHAR(doc, s, e, 0xf0 | cp >> 18)
+		    && WRITECHAR(doc, s, e, 0x80 | (cp >> 12 & 0x3f))
+		    && WRITECHAR(doc, s, e, 0x80 | (cp >> 6 & 0x3f))
+		    && WRITECHAR(doc, s, e, 0x80 | (cp & 0x3f));
+
+	*sp = s;
+	*ep = e;
+	return ok;
+}
+
 /* Check if character belongs to unquoted literal */
 static inline bool
 _is_literal_char(char const c)
@@ -62,149 +333,411 @@ _is_literal_string_char(char const c)
 
 /**
  * Consume unquoted literal token.
+ *
+ * Literals read from a buffer are used straight from the input; only stream
+ * input goes through the scratch buffer. The names true, false and null are
+ * typed accordingly; any other name is a string.
  */
 static inline int
 _consume_literal(struct json_doc * const doc, char c,
 		 struct json_token * const tok )
 {
-	FILE * const f = doc->jdoc_f;
-	char   buf[64];
-	char * s = buf;
-	char * e = buf + sizeof(buf);
+	char const * const start = doc->jdoc_f ? NULL : doc->jdoc_p - 1;
+	char * s = doc->jdoc_buf;
+	char * e = doc->jdoc_buf + doc->jdoc_buf_size;
 	char * lit;
+	size_t len;
 	int    err;
 
-	/* consume first character */
-	(void) WRITECHAR(s, e, c);
-
-	/* consume remaining characters */
-	while ((c = getc(f)) != EOF
-	       && _is_literal_char(c)
-	       && WRITECHAR(s, e, c))
-		continue;
-
-	/* the terminating character */
-	if (!WRITECHAR(s, e, '\0'))
-		RETURN_TOKEN_ERROR(tok, EINVAL);
-
-	/* allocate string */
-	if ((err = _gcmalloc(doc, s - buf, &lit)))
+	/* consume characters */
+	do {
+		if (doc->jdoc_f && !WRITECHAR(doc, s, e, c))
+			RETURN_TOKEN_ERROR(tok, ENOMEM);
+	} while ((c = _getc(doc)) != EOF && _is_literal_char(c));
+
+	/* store string */
+	len = doc->jdoc_f ? (size_t) (s - doc->jdoc_buf)
+			  : (size_t) (_spanend(doc, c) - start);
+	err = _store_string(doc, doc->jdoc_f ? doc->jdoc_buf : start, len,
+			    &lit);
+	if (err)
 		RETURN_TOKEN_ERROR(tok, err);
-	memcpy(lit, buf, s - buf);
 
 	doc->jdoc_nextc = c;
 	doc->jdoc_nextc_avail = true;
-	RETURN_TOKEN_LIT(tok, lit);
+	if (!strcmp(lit, "true") || !strcmp(lit, "false"))
+		RETURN_TOKEN_LIT(tok, len, .jval_lit_type = JSON_LIT_BOOL,
+				 .jval_lit = lit, .jval_bool = *lit == 't');
+	if (!strcmp(lit, "null"))
+		RETURN_TOKEN_LIT(tok, len, .jval_lit_type = JSON_LIT_NULL,
+				 .jval_lit = lit);
+	RETURN_TOKEN_LIT(tok, len, .jval_lit_type = JSON_LIT_STRING,
+			 .jval_lit = lit);
 }
 
 /**
- * Consume quoted literal token.
+ * Consume the remainder of a quoted literal from a stream, decoding escape
+ * sequences into the scratch buffer.
  */
-static inline int
-_consume_literal_string(struct json_doc * const doc, char c,
-			struct json_token * const tok )
+static int
+_consume_literal_string_slow(struct json_doc * const doc,
+			     char * s, char * e,
+			     struct json_token * const tok )
 {
-	FILE * const f = doc->jdoc_f;
-	char   buf[64];
-	char * s = buf;
-	char * e = buf + sizeof(buf);
 	char * lit;
+	size_t len;
+	int    c;
 	int    err;
 
 	/* consume characters in string */
-	while ((c = getc(f)) != EOF && c != '"') {
-		// FIXME We are not parsing \x codes correctly.
-		if (c == '\\' && (c = getc(f)) == EOF)
-			break;
+	while ((c = _getc(doc)) != EOF && c != '"') {
+		if (c == '\\') {
+			uint32_t cp;
+			if ((err = _consume_escape(doc, &cp)))
+				RETURN_TOKEN_ERROR(tok, err);
+			if (!_writeutf8(doc, &s, &e, cp))
+				RETURN_TOKEN_ERROR(tok, ENOMEM);
+			continue;
+		}
 		if (!_is_literal_string_char(c))
 			RETURN_TOKEN_ERROR(tok, EINVAL);
-		if (!WRITECHAR(s, e, c))
-			RETURN_TOKEN_ERROR(tok, EINVAL);
+		if (!WRITECHAR(doc, s, e, c))
+			RETURN_TOKEN_ERROR(tok, ENOMEM);
 	}
 	/* unterminated string */
 	if (c == EOF)
-		RETURN_TOKEN_ERROR(tok, feof(f) ? EINVAL : EIO);
+		RETURN_TOKEN_ERROR(tok, _eof(doc) ? EINVAL : EIO);
 
-	/* the terminating character */
-	if (!WRITECHAR(s, e, '\0'))
-		RETURN_TOKEN_ERROR(tok, EINVAL);
+	/* store string; the scratch buffer may have moved */
+	len = s - doc->jdoc_buf;
+	if ((err = _store_string(doc, doc->jdoc_buf, len, &lit)))
+		RETURN_TOKEN_ERROR(tok, err);
+
+	RETURN_TOKEN_LIT(tok, len, .jval_lit_type = JSON_LIT_STRING,
+			 .jval_lit = lit);
+}
+
+/**
+ * Find the next character of a quoted literal that needs attention: a quote,
+ * a backslash, or anything that is not printable ASCII.
+ *
+ * Returns e if there is none.
+ */
+static inline char const *
+_scan_string(char const * p, char const * const e)
+{
+#ifdef __SSE2__
+	/* 16 characters at a time */
+	for (; e - p >= 16; p += 16) {
+		__m128i const c = _mm_loadu_si128((__m128i const *) p);
+		__m128i const stop = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('"')),
+				     _mm_cmpeq_epi8(c, _mm_set1_epi8('\\'))),
+			/* signed: catches bytes >= 0x80 too */
+			_mm_or_si128(_mm_cmplt_epi8(c, _mm_set1_epi8(0x20)),
+				     _mm_cmpeq_epi8(c, _mm_set1_epi8(0x7f))));
+		int const m = _mm_movemask_epi8(stop);
+		if (m)
+			return p + __builtin_ctz(m);
+	}
+#else
+	/* 8 characters at a time */
+	uint64_t const ones = 0x0101010101010101ull;
+	uint64_t const high = 0x8080808080808080ull;
+	for (; e - p >= 8; p += 8) {
+		uint64_t x;
+		memcpy(&x, p, sizeof(x));
+		uint64_t const q = x ^ (ones * '"');
+		uint64_t const b = x ^ (ones * '\\');
+		uint64_t const d = x ^ (ones * 0x7f);
+		uint64_t const stop = ((q - ones) & ~q)
+				    | ((b - ones) & ~b)
+				    | ((d - ones) & ~d)
+				    | ((x - ones * 0x20) & ~x)
+				    | x;
+		if (stop & high)
+			break;
+	}
+#endif
+	for (; p < e; p++)
+		if (*p == '"' || *p == '\\' || !_is_literal_string_char(*p))
+			return p;
+	return e;
+}
+
+/**
+ * Consume quoted literal token from buffer input.
+ *
+ * Runs of plain characters are found a vector at a time. A string without
+ * escape sequences is used straight from the input; otherwise the runs are
+ * copied in bulk, into the scratch buffer or (in situ) behind the cursor,
+ * and escape sequences are decoded at the stops in between.
+ */
+static inline int
+_consume_literal_string_buffer(struct json_doc * const doc,
+			       struct json_token * const tok )
+{
+	char * const start = (char *) doc->jdoc_p;
+	char const * p = start;
+	char * s = NULL;
+	char * e = NULL;
+	char * lit;
+	int    err;
+
+	for (;;) {
+		char const * const q = _scan_string(p, doc->jdoc_e);
+		size_t const len = q - p;
+
+		/* unterminated string, or bad character */
+		if (q == doc->jdoc_e)
+			RETURN_TOKEN_ERROR(tok, EINVAL);
+		if (*q != '"' && *q != '\\')
+			RETURN_TOKEN_ERROR(tok, EINVAL);
+
+		/* copy run of plain characters once decoding has begun */
+		if (s) {
+			while ((size_t) (e - s) < len)
+				if (!_grow(doc, &s, &e))
+					RETURN_TOKEN_ERROR(tok, ENOMEM);
+			if (len)
+				memmove(s, p, len);
+			s += len;
+		}
+
+		/* closing quote */
+		if (*q == '"') {
+			doc->jdoc_p = q + 1;
+			break;
+		}
+
+		/* first escape sequence: everything so far is plain */
+		if (s == NULL) {
+			s = _tokbegin(doc, start, &e);
+			while ((size_t) (e - s) < len)
+				if (!_grow(doc, &s, &e))
+					RETURN_TOKEN_ERROR(tok, ENOMEM);
+			if (!_insitu(doc) && len)
+				memcpy(s, start, len);
+			s += len;
+		}
+
+		/* decode escape sequence */
+		uint32_t cp;
+		doc->jdoc_p = q + 1;
+		if ((err = _consume_escape(doc, &cp)))
+			RETURN_TOKEN_ERROR(tok, err);
+		if (!_writeutf8(doc, &s, &e, cp))
+			RETURN_TOKEN_ERROR(tok, ENOMEM);
+		p = doc->jdoc_p;
+	}
 
-	/* allocate string */
-	if ((err = _gcmalloc(doc, s - buf, &lit)))
+	/* store string; the scratch buffer may have moved */
+	char const * const base = s == NULL || _insitu(doc)
+				? start : doc->jdoc_buf;
+	size_t const len = s == NULL ? doc->jdoc_p - 1 - start : s - base;
+	if ((err = _store_string(doc, base, len, &lit)))
 		RETURN_TOKEN_ERROR(tok, err);
-	memcpy(lit, buf, s - buf);
 
-	RETURN_TOKEN_LIT(tok, lit);
+	RETURN_TOKEN_LIT(tok, len, .jval_lit_type = JSON_LIT_STRING,
+			 .jval_lit = lit);
+}
+
+/**
+ * Consume quoted literal token.
+ */
+static inline int
+_consume_literal_string(struct json_doc * const doc, char c,
+			struct json_token * const tok )
+{
+	char * s;
+	char * e;
+
+	if (doc->jdoc_f == NULL)
+		return _consume_literal_string_buffer(doc, tok);
+
+	s = _tokbegin(doc, NULL, &e);
+	return _consume_literal_string_slow(doc, s, e, tok);
 }
 
 /**
  * Consume numeric literal token.
+ *
+ * Integers are accumulated as their digits go by. Those too large for 64
+ * bits, and numbers with a fraction or an exponent, are converted to doubles.
  */
 static inline int
 _consume_literal_number(
 	struct json_doc * const doc, char c,
 	struct json_token * const tok )
 {
-	FILE * const f = doc->jdoc_f;
-	char   buf[64];
-	char * s = buf;
-	char * e = buf + sizeof(buf);
+	char const * const start = doc->jdoc_f ? NULL : doc->jdoc_p - 1;
+	char * s = doc->jdoc_buf;
+	char * e = doc->jdoc_buf + doc->jdoc_buf_size;
 	char * lit;
+	size_t len;
 	int    err;
+	uint64_t u = 0;
+	bool   big = false;
+	bool   neg = c == '-';
 
 	/* States */
-	enum { ST, IN, ZR, DO, FR, XX };
+	enum { ST, MI, IN, ZR, DO, FR, EX, ES, EI, XX };
+
+	/* Inputs */
+	enum { I0, I1, IDOT, IMINUS, IPLUS, IEXP, IEND };
 
 	/* State transitions */
-	static int const st[5][11]  = {
-	/* State    Input ->  '0' '1' '2' '3' '4' '5' '6' '7' '8' '9' '.' */
-	/* -----              ------------------------------------------  */
-	/* START */ [ST] = {  ZR, IN, IN, IN, IN, IN, IN, IN, IN, IN, XX  },
-	/*   INT */ [IN] = {  IN, IN, IN, IN, IN, IN, IN, IN, IN, IN, DO  },
-	/*  ZERO */ [ZR] = {  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, DO  },
-	/*   DOT */ [DO] = {  FR, FR, FR, FR, FR, FR, FR, FR, FR, FR, XX  },
-	/*  FRAC */ [FR] = {  FR, FR, FR, FR, FR, FR, FR, FR, FR, FR, XX  },
+	static int const st[9][6] = {
+	/* State     Input ->  '0' 1-9 '.' '-' '+' e/E */
+	/* -----               ------------------------ */
+	/*    START */ [ST] = {  ZR, IN, XX, MI, XX, XX  },
+	/*    MINUS */ [MI] = {  ZR, IN, XX, XX, XX, XX  },
+	/*      INT */ [IN] = {  IN, IN, DO, XX, XX, EX  },
+	/*     ZERO */ [ZR] = {  XX, XX, DO, XX, XX, EX  },
+	/*      DOT */ [DO] = {  FR, FR, XX, XX, XX, XX  },
+	/*     FRAC */ [FR] = {  FR, FR, XX, XX, XX, EX  },
+	/*      EXP */ [EX] = {  EI, EI, XX, ES, ES, XX  },
+	/* EXP SIGN */ [ES] = {  EI, EI, XX, XX, XX, XX  },
+	/*  EXP INT */ [EI] = {  EI, EI, XX, XX, XX, XX  },
 	};
 
 	/* consume characters using the state machine */
 	int y = ST;
 	do {
-		/* next state */
-		if (isascii(c) && isdigit(c))
-			y = st[y][c - '0'];
-		else if (c == '.')
-			y = st[y][10];
-		else
+		int x;
+		switch (c) {
+		case '0':           x = I0;     break;
+		case '1' ... '9':   x = I1;     break;
+		case '.':           x = IDOT;   break;
+		case '-':           x = IMINUS; break;
+		case '+':           x = IPLUS;  break;
+		case 'e': case 'E': x = IEXP;   break;
+		default:            x = IEND;   break;
+		}
+		if (x == IEND)
 			break;
+		/* next state */
+		y = st[y][x];
 		/* error state */
 		if (y == XX)
 			RETURN_TOKEN_ERROR(tok, EINVAL);
-		/* write character to buffer */
-		if (!WRITECHAR(s, e, c))
-			RETURN_TOKEN_ERROR(tok, EINVAL);
+		/* accumulate integer part */
+		if (y == IN)
+			big =  big
+			    || __builtin_mul_overflow(u, 10, &u)
+			    || __builtin_add_overflow(u, c - '0', &u);
+		/* write character to buffer (stream input only) */
+		if (doc->jdoc_f && !WRITECHAR(doc, s, e, c))
+			RETURN_TOKEN_ERROR(tok, ENOMEM);
 
-	} while ((c = getc(f)) != EOF);
+	} while ((c = _getc(doc)) != EOF);
 
 	/* state machine must be in a valid end state */
-	if (y != IN && y != ZR && y != FR)
+	if (y != IN && y != ZR && y != FR && y != EI)
 		RETURN_TOKEN_ERROR(tok, EINVAL);
 	/* literal must be terminated by a space or punctuation character */
 	if (! (c == EOF || (isascii(c) && (isspace(c) || ispunct(c)))) )
 		RETURN_TOKEN_ERROR(tok, EINVAL);
 
-	/* finish literal value */
-	if (!WRITECHAR(s, e, '\0'))
-		RETURN_TOKEN_ERROR(tok, EINVAL);
-
-	/* duplicate literal value */
-	if ((err = _gcmalloc(doc, s - buf, &lit)))
+	/* store literal value */
+	len = doc->jdoc_f ? (size_t) (s - doc->jdoc_buf)
+			  : (size_t) (_spanend(doc, c) - start);
+	err = _store_literal(doc, doc->jdoc_f ? doc->jdoc_buf : start, len,
+			     &lit);
+	if (err)
 		RETURN_TOKEN_ERROR(tok, err);
-	memcpy(lit, buf, s - buf);
 
 	/* put back last character into stream */
 	doc->jdoc_nextc = c;
 	doc->jdoc_nextc_avail = true;
-	RETURN_TOKEN_LIT(tok, lit);
+
+	/* integers that fit */
+	if ((y == IN || y == ZR) && !big) {
+		if (neg && u <= (uint64_t) INT64_MAX + 1)
+			RETURN_TOKEN_LIT(tok, len, .jval_lit_type = JSON_LIT_INT,
+					 .jval_lit = lit, .jval_int = -u);
+		if (!neg && u > INT64_MAX)
+			RETURN_TOKEN_LIT(tok, len, .jval_lit_type = JSON_LIT_UINT,
+					 .jval_lit = lit, .jval_uint = u);
+		if (!neg)
+			RETURN_TOKEN_LIT(tok, len, .jval_lit_type = JSON_LIT_INT,
+					 .jval_lit = lit, .jval_int = u);
+	}
+
+	/* everything else; overflow leaves an infinity */
+	double d;
+	(void) json_str2double(lit, len, &d);
+	RETURN_TOKEN_LIT(tok, len, .jval_lit_type = JSON_LIT_DOUBLE,
+			 .jval_lit = lit, .jval_double = d);
+}
+
+/**
+ * Count the newlines in a run of whitespace, 8 characters at a time.
+ */
+static unsigned
+_count_newlines(char const * p, char const * const e)
+{
+	uint64_t const ones = 0x0101010101010101ull;
+	uint64_t const low  = 0x7f7f7f7f7f7f7f7full;
+	unsigned n = 0;
+
+	for (; e - p >= 8; p += 8) {
+		uint64_t x;
+		memcpy(&x, p, sizeof(x));
+		x ^= ones * '\n';
+		/* high bit set in every byte that is not a newline */
+		uint64_t const t = ((x & low) + low) | x;
+		n += __builtin_popcountll(~t & ~low);
+	}
+	for (; p < e; p++)
+		n += *p == '\n';
+	return n;
+}
+
+/**
+ * Skip a run of whitespace in buffer input.
+ *
+ * The cursor is just past a whitespace character, between two tokens. Rather
+ * than stepping over the rest of the run one byte at a time, jump straight to
+ * the next token start in the structural index, indexing further windows of
+ * the input as needed. Newlines in the run are still counted.
+ */
+static inline int
+_skip_whitespace(struct json_doc * const doc)
+{
+	struct json_index * const ix = &doc->jdoc_index;
+	char const * const start = doc->jdoc_p;
+	char const * p = start;
+	int err;
+
+	/* single spaces are not worth a lookup */
+	if (p == doc->jdoc_e || !(isascii(*p) && isspace(*p)))
+		return 0;
+
+	for (;;) {
+		if (p < ix->jix_end) {
+			uint32_t const off = p - ix->jix_base;
+			while (ix->jix_p < ix->jix_e && *ix->jix_p < off)
+				ix->jix_p++;
+			if (ix->jix_p < ix->jix_e) {
+				doc->jdoc_p = ix->jix_base + *ix->jix_p;
+				break;
+			}
+			/* the rest of the window is whitespace */
+			p = ix->jix_end;
+			if (p == doc->jdoc_e) {
+				doc->jdoc_p = p;
+				break;
+			}
+		}
+		/* the next window starts outside of any string */
+		if ((err = json_index_window(ix, doc->jdoc_alloc,
+					     p, doc->jdoc_e)))
+			return err;
+	}
+
+	doc->jdoc_lineno += _count_newlines(start, doc->jdoc_p);
+	return 0;
 }
 
 /**
@@ -213,8 +746,8 @@ _consume_literal_number(
 int
 json_consume_token(struct json_doc * const doc, struct json_token * const tok)
 {
-	FILE * const f = doc->jdoc_f;
 	int c;
+	int err;
 
 	/* use lookahead token if available */
 	if (doc->jdoc_lookahead_avail) {
@@ -224,14 +757,17 @@ json_consume_token(struct json_doc * const doc, struct json_token * const tok)
 	}
 
 	/* ignore whitespace */
-	c = doc->jdoc_nextc_avail ? doc->jdoc_nextc : getc(f);
+	c = doc->jdoc_nextc_avail ? doc->jdoc_nextc : _getc(doc);
 	doc->jdoc_nextc_avail = false;
-	for (; isascii(c) && isspace(c); c = getc(f))
+	for (; isascii(c) && isspace(c); c = _getc(doc)) {
 		if (c == '\n')
 			doc->jdoc_lineno++;
-	if (c == EOF && feof(f))
+		if (doc->jdoc_f == NULL && (err = _skip_whitespace(doc)))
+			RETURN_TOKEN_ERROR(tok, err);
+	}
+	if (c == EOF && _eof(doc))
 		RETURN_TOKEN(tok, JSON_TOK_EOF);
-	if (c == EOF && ferror(f))
+	if (c == EOF && _error(doc))
 		RETURN_TOKEN_ERROR(tok, EIO);
 	if (!isascii(c))
 		RETURN_TOKEN_ERROR(tok, EINVAL);
@@ -251,6 +787,7 @@ json_consume_token(struct json_doc * const doc, struct json_token * const tok)
 	case '"':
 		return _consume_literal_string(doc, c, tok);
 	case '0' ... '9':
+	case '-':
 		return _consume_literal_number(doc, c, tok);
 	default:
 		RETURN_TOKEN_ERROR(tok, EINVAL);
@@ -272,3 +809,116 @@ json_peek_token(struct json_doc * const doc, struct json_token * const tok)
 	doc->jdoc_lookahead = *tok;
 	return 0;
 }
+
+/**
+ * Skip the rest of a container in stream input, a token at a time.
+ */
+static int
+_skip_tokens(struct json_doc * const doc)
+{
+	struct json_token tok;
+	unsigned depth = 1;
+	int err;
+
+	while (depth) {
+		if ((err = json_consume_token(doc, &tok)))
+			return err;
+		switch (tok.tok_id) {
+		case JSON_TOK_OBJECT_BEGIN:
+		case JSON_TOK_ARRAY_BEGIN:
+			depth++;
+			break;
+		case JSON_TOK_OBJECT_END:
+		case JSON_TOK_ARRAY_END:
+			depth--;
+			break;
+		case JSON_TOK_EOF:
+			return EINVAL;
+		default:
+			break;
+		}
+	}
+	return 0;
+}
+
+/* Find the end of a quoted literal, given its first character */
+static inline char const *
+_string_end(char const * p, char const * const e)
+{
+	for (; p < e; p++) {
+		if (*p == '\\')
+			p++;
+		else if (*p == '"')
+			return p + 1;
+	}
+	return NULL;
+}
+
+/**
+ * Skip the rest of a container in buffer input.
+ *
+ * Only the brackets listed in the structural index are looked at; strings
+ * are stepped over as a whole, and nothing is decoded. A window that ends
+ * inside a string is followed by one starting past its closing quote.
+ */
+static int
+_skip_indexed(struct json_doc * const doc)
+{
+	struct json_index * const ix = &doc->jdoc_index;
+	char const * p = doc->jdoc_p;
+	bool covered = p >= ix->jix_base && p < ix->jix_end;
+	unsigned depth = 1;
+	int err;
+
+	for (;;) {
+		char const * last = NULL;
+
+		/* the window must start outside of any string */
+		if (!covered) {
+			if (p == doc->jdoc_e)
+				return EINVAL;
+			if ((err = json_index_window(ix, doc->jdoc_alloc,
+					     p, doc->jdoc_e)))
+				return err;
+		}
+		covered = false;
+
+		uint32_t const off = p - ix->jix_base;
+		while (ix->jix_p < ix->jix_e && *ix->jix_p < off)
+			ix->jix_p++;
+		for (; ix->jix_p < ix->jix_e; ix->jix_p++) {
+			last = ix->jix_base + *ix->jix_p;
+			switch (*last) {
+			case '{': case '[':
+				depth++;
+				break;
+			case '}': case ']':
+				if (--depth)
+					break;
+				ix->jix_p++;
+				doc->jdoc_p = last + 1;
+				return 0;
+			}
+		}
+
+		/* only whitespace and literal characters follow the last start */
+		p = last && *last == '"'
+		  ? _string_end(last + 1, doc->jdoc_e) : ix->jix_end;
+		if (p == NULL || p == doc->jdoc_e)
+			return EINVAL;
+	}
+}
+
+/**
+ * Skip the rest of the container whose opening bracket was just consumed,
+ * without storing anything.
+ *
+ * The skipped part is only checked for balanced brackets and strings.
+ */
+int
+json_skip_container(struct json_doc * const doc)
+{
+	assert(!doc->jdoc_lookahead_avail && !doc->jdoc_nextc_avail);
+
+	return doc->jdoc_f ? _skip_tokens(doc) : _skip_indexed(doc);
+}
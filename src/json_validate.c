@@ -17,6 +17,35 @@
 /* Private API */
 #include "json_private.h"
 
+/**
+ * Prefix the error message in the buffer with the key it was found under.
+ */
+static void
+_prefix(char * const buf, size_t const size, char const * const key)
+{
+	char const * const parts[] = { "in `", key, "': " };
+
+	if (size == 0)
+		return;
+
+	/* make room for the prefix, truncating the message if need be */
+	size_t const max  = size - 1;
+	size_t const plen = strlen(key) + sizeof("in `': ") - 1;
+	size_t const n    = plen < max ? plen : max;
+	size_t const mlen = strnlen(buf, max);
+	size_t const keep = mlen < max - n ? mlen : max - n;
+	memmove(buf + n, buf, keep);
+	buf[n + keep] = '\0';
+
+	size_t off = 0;
+	for (unsigned i = 0; i < 3 && off < n; i++) {
+		size_t const len = strlen(parts[i]);
+		size_t const cp  = len < n - off ? len : n - off;
+		memcpy(buf + off, parts[i], cp);
+		off += cp;
+	}
+}
+
 static int
 _recursive(
 	struct json_object const * const obj,
@@ -37,16 +66,14 @@ _recursive(
 	if (jval->jval_type != JSON_VAL_OBJECT)
 		goto fail_not_object;
 
-	/* take note of our new location in the error buffer */
-	size_t const len = snprintf(buf, size, "in `%s': ", key);
-	size_t const subsize = len < size ? size - len : 0;
-	char * const subbuf = buf + len;
-
-	/* recursively validate object */
+	/* recursively validate object, then note where the error was */
 	unsigned const subn = rec->jrec_n;
 	struct json_schema const * const subschema = rec->jrec_schema;
 	struct json_object const * const subobj = jval->jval_object;
-	return json_validate(subobj, subschema, subn, subbuf, subsize);
+	int const err = json_validate(subobj, subschema, subn, buf, size);
+	if (err)
+		_prefix(buf, size, key);
+	return err;
 
 fail_not_object:
 	snprintf(buf, size, "expected OBJECT value for key `%s'", key);
@@ -82,10 +109,14 @@ _ifeq(
 	       : 0;
 }
 
+/**
+ * Check the value of a key and store it.
+ */
 static int
-_define(
-	struct json_object const * const obj,
+_extract(
+	struct json_value  const * const jval,
 	struct json_schema const * const it,
+	struct json_allocator const * const alloc,
 	char                     * const buf,
 	size_t                     const size
 	)
@@ -95,15 +126,6 @@ _define(
 	void       * const valptr = def->jdef_valptr;
 	unsigned   * const lenptr = def->jdef_lenptr;
 
-	/* determine whether key exists */
-	struct json_value const * const jval = json_get_value(obj, key);
-	if (jval == NULL) {
-		if (def->jdef_required)
-			goto fail_missing;
-		else
-			return 0;
-	}
-
 	/* check key value */
 	switch (def->jdef_type) {
 
@@ -129,7 +151,8 @@ _define(
 		if (!valptr || !lenptr)
 			goto fail_schema;
 		struct json_array const * const jarr = jval->jval_array;
-		switch (json_get_array_of_text(jarr, valptr, lenptr)) {
+		switch (json_get_array_of_text_alloc(jarr, alloc, valptr,
+						     lenptr)) {
 		case 0:
 			return 0;
 		case ENOMEM:
@@ -144,7 +167,7 @@ _define(
 			goto fail_not_int;
 		if (!valptr || lenptr)
 			goto fail_schema;
-		if (str2int(jval->jval_lit, def->jdef_valptr))
+		if (json_value_int(jval, def->jdef_valptr))
 			goto fail_not_int;
 		return 0;
 
@@ -153,7 +176,7 @@ _define(
 			goto fail_not_uint;
 		if (!valptr || lenptr)
 			goto fail_schema;
-		if (str2uint(jval->jval_lit, def->jdef_valptr))
+		if (json_value_uint(jval, def->jdef_valptr))
 			goto fail_not_uint;
 		return 0;
 
@@ -162,7 +185,7 @@ _define(
 			goto fail_not_double;
 		if (!valptr || lenptr)
 			goto fail_schema;
-		if (str2double(jval->jval_lit, def->jdef_valptr))
+		if (json_value_double(jval, def->jdef_valptr))
 			goto fail_not_double;
 		return 0;
 
@@ -172,7 +195,8 @@ _define(
 		if (!valptr || !lenptr)
 			goto fail_schema;
 		struct json_array const * const jarr = jval->jval_array;
-		switch (json_get_array_of_uint32(jarr, valptr, lenptr)) {
+		switch (json_get_array_of_uint32_alloc(jarr, alloc, valptr,
+						       lenptr)) {
 		case 0:
 			return 0;
 		case ENOMEM:
@@ -188,7 +212,8 @@ _define(
 		if (!valptr || !lenptr)
 			goto fail_schema;
 		struct json_array const * const jarr = jval->jval_array;
-		switch (json_get_array_of_uint64(jarr, valptr, lenptr)) {
+		switch (json_get_array_of_uint64_alloc(jarr, alloc, valptr,
+						       lenptr)) {
 		case 0:
 			return 0;
 		case ENOMEM:
@@ -229,14 +254,33 @@ fail_not_object:
 fail_memory:
 	snprintf(buf, size, "cannot allocate memory for key `%s'", key);
 	return ENOMEM;
-fail_missing:
-	snprintf(buf, size, "missing required key `%s'", key);
-	return EINVAL;
 fail_schema:
 	snprintf(buf, size, "invalid schema definition");
 	return ENOTSUP;
 }
 
+static int
+_define(
+	struct json_object const * const obj,
+	struct json_schema const * const it,
+	char                     * const buf,
+	size_t                     const size
+	)
+{
+	struct json_schema_define const * const def = &it->jscm_define;
+
+	/* determine whether key exists */
+	struct json_value const * const jval = json_get_value(obj, def->jdef_key);
+	if (jval == NULL) {
+		if (!def->jdef_required)
+			return 0;
+		snprintf(buf, size, "missing required key `%s'", def->jdef_key);
+		return EINVAL;
+	}
+
+	return _extract(jval, it, NULL, buf, size);
+}
+
 int
 json_validate(
 	struct json_object const * const obj,
@@ -270,3 +314,455 @@ json_validate(
 
 	return err;
 }
+
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+//                            Compiled schemas                              //
+// :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: //
+
+/*
+ * A schema is compiled into one program per object it validates. IFEQ
+ * entries apply to the same object as their parent, so they are flattened
+ * into its program as conditional jumps; DESCEND entries refer to the
+ * program of another object.
+ *
+ * Each program collects the keys its entries look up, and maps them to
+ * slots with a perfect hash of the tuple hashes computed at parse time.
+ * Validation walks the tuples of the object once, noting the first value
+ * of every known key, then runs the entries in order without any lookup.
+ * Keys that are paths, or that cannot get a slot, are looked up as usual.
+ */
+
+/* Keys with a slot per program; one bit each in a mask */
+#define SCHEMA_MAX_KEYS     64
+
+/* Largest perfect hash table, and attempts per table size */
+#define SCHEMA_MAX_BITS     12
+#define SCHEMA_MAX_TRIES    256
+
+/* IFEQ entries nested deeper than this are assumed to loop */
+#define SCHEMA_MAX_DEPTH    64
+
+/**
+ * An entry of a compiled program.
+ */
+struct _insn {
+	struct json_schema const * in_entry;     // schema entry
+	int                        in_slot;      // key slot, or -1
+	unsigned                   in_skip;      // IFEQ: entries to skip
+	struct _prog             * in_sub;       // DESCEND: object program
+};
+
+/**
+ * The program validating an object.
+ */
+struct _prog {
+	struct _prog             * pg_next;      // all programs
+	struct json_schema const * pg_schema;    // source schema
+	unsigned                   pg_n;
+	unsigned                   pg_nkeys;     // keys with a slot
+	char const               * pg_keys[SCHEMA_MAX_KEYS];
+	size_t                     pg_keylens[SCHEMA_MAX_KEYS];
+	uint32_t                   pg_hashes[SCHEMA_MAX_KEYS];
+	uint32_t                   pg_mult;      // perfect hash multiplier
+	unsigned                   pg_shift;
+	uint8_t                  * pg_table;     // slot plus one, or zero
+	unsigned                   pg_ninsns;
+	struct _insn               pg_insns[];
+};
+
+struct json_validator {
+	struct _prog             * jvd_progs;    // all programs
+	struct _prog             * jvd_root;
+	struct json_allocator const * jvd_alloc; // or NULL
+};
+
+/* Check that a definition is well-formed */
+static bool
+_define_ok(struct json_schema_define const * const def)
+{
+	if (def->jdef_key == NULL || def->jdef_valptr == NULL)
+		return false;
+
+	switch (def->jdef_type) {
+	case JSON_SCHEMA_TYPE_OBJ:
+	case JSON_SCHEMA_TYPE_TEXT:
+	case JSON_SCHEMA_TYPE_INT:
+	case JSON_SCHEMA_TYPE_UINT:
+	case JSON_SCHEMA_TYPE_DOUBLE:
+		return def->jdef_lenptr == NULL;
+	case JSON_SCHEMA_TYPE_TEXTV:
+	case JSON_SCHEMA_TYPE_UINT32V:
+	case JSON_SCHEMA_TYPE_UINT64V:
+		return def->jdef_lenptr != NULL;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Count the entries of a program, checking the schema on the way.
+ */
+static int
+_count(struct json_schema const * const schema, unsigned const n,
+       unsigned const depth, unsigned * const count)
+{
+	int err;
+
+	if (depth > SCHEMA_MAX_DEPTH)
+		return ELOOP;
+
+	for (unsigned i = 0; i < n; i++) {
+		struct json_schema const * const it = &schema[i];
+		switch (it->jscm_op) {
+		case JSON_SCHEMA_OP_DEFINE:
+			if (!_define_ok(&it->jscm_define))
+				return ENOTSUP;
+			break;
+		case JSON_SCHEMA_OP_RECURSIVE:
+			if (it->jscm_recursive.jrec_key == NULL
+			    || it->jscm_recursive.jrec_schema == NULL)
+				return ENOTSUP;
+			break;
+		case JSON_SCHEMA_OP_IFEQ:
+			if (it->jscm_ifeq.jequ_key == NULL
+			    || it->jscm_ifeq.jequ_exp == NULL
+			    || it->jscm_ifeq.jequ_schema == NULL)
+				return ENOTSUP;
+			if ((err = _count(it->jscm_ifeq.jequ_schema,
+					  it->jscm_ifeq.jequ_n, depth + 1, count)))
+				return err;
+			break;
+		default:
+			return ENOTSUP;
+		}
+		++*count;
+	}
+	return 0;
+}
+
+/**
+ * Find the slot of a key, adding it if need be.
+ *
+ * Paths have no slot, and neither do keys whose hash is taken by another
+ * key, since no perfect hash could tell them apart.
+ */
+static int
+_slot(struct _prog * const pg, char const * const key)
+{
+	size_t const len = strlen(key);
+	uint32_t const hash = json_key_hash(key, len);
+
+	if (len == 0 || strchr(key, '/'))
+		return -1;
+
+	for (unsigned i = 0; i < pg->pg_nkeys; i++) {
+		if (pg->pg_hashes[i] != hash)
+			continue;
+		return json_key_compare(pg->pg_keys[i], pg->pg_keylens[i],
+					key, len) ? -1 : (int) i;
+	}
+
+	if (pg->pg_nkeys == SCHEMA_MAX_KEYS)
+		return -1;
+	pg->pg_keys[pg->pg_nkeys] = key;
+	pg->pg_keylens[pg->pg_nkeys] = len;
+	pg->pg_hashes[pg->pg_nkeys] = hash;
+	return pg->pg_nkeys++;
+}
+
+/**
+ * Find a multiplier mapping the hashes of all keys to distinct slots of the
+ * smallest table possible.
+ */
+static int
+_perfect_hash(struct json_validator const * const v, struct _prog * const pg)
+{
+	unsigned bits = 1;
+	uint8_t * table;
+
+	if (pg->pg_nkeys == 0)
+		return 0;
+	while ((1u << bits) < 2 * pg->pg_nkeys)
+		bits++;
+
+	for (; bits <= SCHEMA_MAX_BITS; bits++) {
+		unsigned const size = 1u << bits;
+		uint32_t mult = 0x9e3779b1;
+
+		if ((table = json_mem_alloc(v->jvd_alloc, size)) == NULL)
+			return errno;
+		for (unsigned t = 0; t < SCHEMA_MAX_TRIES; t++) {
+			unsigned i;
+			memset(table, 0, size);
+			for (i = 0; i < pg->pg_nkeys; i++) {
+				uint32_t const h =
+					pg->pg_hashes[i] * mult >> (32 - bits);
+				if (table[h])
+					break;
+				table[h] = i + 1;
+			}
+			if (i == pg->pg_nkeys) {
+				pg->pg_table = table;
+				pg->pg_mult  = mult;
+				pg->pg_shift = 32 - bits;
+				return 0;
+			}
+			mult = (mult * 0x2c1b3c6d + 0x297a2d39) | 1;
+		}
+		json_mem_free(v->jvd_alloc, table);
+	}
+
+	/* no luck: look every key up */
+	for (unsigned i = 0; i < pg->pg_ninsns; i++)
+		pg->pg_insns[i].in_slot = -1;
+	pg->pg_nkeys = 0;
+	return 0;
+}
+
+static int
+_compile(struct json_validator * v, struct json_schema const * schema,
+	 unsigned n, struct _prog ** newprog);
+
+/**
+ * Append the entries of a schema to a program.
+ */
+static int
+_flatten(struct json_validator    * const v,
+	 struct _prog             * const pg,
+	 struct json_schema const * const schema,
+	 unsigned                   const n )
+{
+	int err;
+
+	for (unsigned i = 0; i < n; i++) {
+		struct json_schema const * const it = &schema[i];
+		struct _insn * const insn = &pg->pg_insns[pg->pg_ninsns++];
+
+		*insn = (struct _insn) { .in_entry = it };
+		switch (it->jscm_op) {
+		case JSON_SCHEMA_OP_DEFINE:
+			insn->in_slot = _slot(pg, it->jscm_define.jdef_key);
+			break;
+		case JSON_SCHEMA_OP_RECURSIVE:
+			insn->in_slot = _slot(pg, it->jscm_recursive.jrec_key);
+			if ((err = _compile(v, it->jscm_recursive.jrec_schema,
+					    it->jscm_recursive.jrec_n,
+					    &insn->in_sub)))
+				return err;
+			break;
+		case JSON_SCHEMA_OP_IFEQ: {
+			unsigned const start = pg->pg_ninsns;
+			insn->in_slot = _slot(pg, it->jscm_ifeq.jequ_key);
+			if ((err = _flatten(v, pg, it->jscm_ifeq.jequ_schema,
+					    it->jscm_ifeq.jequ_n)))
+				return err;
+			insn->in_skip = pg->pg_ninsns - start;
+			break;
+		}
+		default:
+			assert(0);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Compile the program validating objects against a schema, unless it was
+ * compiled already.
+ */
+static int
+_compile(struct json_validator    * const v,
+	 struct json_schema const * const schema,
+	 unsigned                   const n,
+	 struct _prog            ** const newprog )
+{
+	struct _prog * pg;
+	unsigned count = 0;
+	int err;
+
+	for (pg = v->jvd_progs; pg; pg = pg->pg_next) {
+		if (pg->pg_schema == schema && pg->pg_n == n) {
+			*newprog = pg;
+			return 0;
+		}
+	}
+
+	if ((err = _count(schema, n, 0, &count)))
+		return err;
+	pg = json_mem_alloc(v->jvd_alloc,
+			    sizeof(*pg) + sizeof(struct _insn) * count);
+	if (pg == NULL)
+		return errno;
+	*pg = (struct _prog) {
+		.pg_next   = v->jvd_progs,
+		.pg_schema = schema,
+		.pg_n      = n,
+	};
+	v->jvd_progs = pg;
+
+	/* registered first, so that schemas may refer to themselves */
+	if ((err = _flatten(v, pg, schema, n)))
+		return err;
+	if ((err = _perfect_hash(v, pg)))
+		return err;
+
+	*newprog = pg;
+	return 0;
+}
+
+int
+json_schema_compile(
+	struct json_schema const * const schema,
+	unsigned                   const n,
+	struct json_validator   ** const newvalidator )
+{
+	return json_schema_compile_alloc(schema, n, NULL, newvalidator);
+}
+
+int
+json_schema_compile_alloc(
+	struct json_schema const    * const schema,
+	unsigned                      const n,
+	struct json_allocator const * const alloc,
+	struct json_validator      ** const newvalidator )
+{
+	struct json_validator * v;
+	int err;
+
+	if ((v = json_mem_alloc(alloc, sizeof(*v))) == NULL) {
+		err = errno;
+		goto fail;
+	}
+	*v = (struct json_validator) { .jvd_alloc = alloc };
+	if ((err = _compile(v, schema, n, &v->jvd_root)))
+		goto fail_1;
+
+	*newvalidator = v;
+	return 0;
+
+fail_1:	json_validator_free(v);
+fail:	*newvalidator = NULL;
+	return err;
+}
+
+void
+json_validator_free(struct json_validator * const v)
+{
+	struct _prog * next;
+
+	if (v == NULL)
+		return;
+	for (struct _prog * pg = v->jvd_progs; pg; pg = next) {
+		next = pg->pg_next;
+		json_mem_free(v->jvd_alloc, pg->pg_table);
+		json_mem_free(v->jvd_alloc, pg);
+	}
+	json_mem_free(v->jvd_alloc, v);
+}
+
+/**
+ * Run the program of an object.
+ */
+static int
+_run(struct _prog       const * const pg,
+     struct json_object const * const obj,
+     struct json_allocator const * const alloc,
+     char                     * const buf,
+     size_t                     const size )
+{
+	struct json_value const * vals[SCHEMA_MAX_KEYS];
+	uint64_t const all = pg->pg_nkeys == 64
+			   ? ~(uint64_t) 0 : ((uint64_t) 1 << pg->pg_nkeys) - 1;
+	uint64_t seen = 0;
+	int err;
+
+	/* note the first value of every known key */
+	for (unsigned i = 0; all && i < obj->jobj_length && seen != all; i++) {
+		struct json_tuple const * const tup = &obj->jobj_tuples[i];
+		unsigned const s =
+			pg->pg_table[tup->jtup_hash * pg->pg_mult >> pg->pg_shift];
+		if (s == 0 || seen >> (s - 1) & 1)
+			continue;
+		if (json_key_compare(pg->pg_keys[s - 1], pg->pg_keylens[s - 1],
+				     tup->jtup_key, tup->jtup_keylen))
+			continue;
+		vals[s - 1] = &tup->jtup_val;
+		seen |= (uint64_t) 1 << (s - 1);
+	}
+
+	/* run the entries in order */
+	for (unsigned i = 0; i < pg->pg_ninsns; i++) {
+		struct _insn const * const insn = &pg->pg_insns[i];
+		struct json_schema const * const it = insn->in_entry;
+		struct json_value const * jval;
+		char const * key;
+
+		switch (it->jscm_op) {
+		case JSON_SCHEMA_OP_DEFINE:
+			key = it->jscm_define.jdef_key;
+			break;
+		case JSON_SCHEMA_OP_RECURSIVE:
+			key = it->jscm_recursive.jrec_key;
+			break;
+		default:
+			key = it->jscm_ifeq.jequ_key;
+			break;
+		}
+		if (insn->in_slot < 0)
+			jval = json_get_value(obj, key);
+		else if (seen >> insn->in_slot & 1)
+			jval = vals[insn->in_slot];
+		else
+			jval = NULL;
+
+		switch (it->jscm_op) {
+		case JSON_SCHEMA_OP_DEFINE:
+			if (jval) {
+				if ((err = _extract(jval, it, alloc,
+						    buf, size)))
+					return err;
+			} else if (it->jscm_define.jdef_required) {
+				snprintf(buf, size,
+					 "missing required key `%s'", key);
+				return EINVAL;
+			}
+			break;
+		case JSON_SCHEMA_OP_RECURSIVE:
+			if (jval == NULL) {
+				snprintf(buf, size,
+					 "missing required object `%s'", key);
+				return EINVAL;
+			}
+			if (jval->jval_type != JSON_VAL_OBJECT) {
+				snprintf(buf, size,
+					 "expected OBJECT value for key `%s'",
+					 key);
+				return EINVAL;
+			}
+			if ((err = _run(insn->in_sub, jval->jval_object, alloc,
+					buf, size))) {
+				_prefix(buf, size, key);
+				return err;
+			}
+			break;
+		default:
+			if (!jval || jval->jval_type != JSON_VAL_LITERAL
+			    || strcasecmp(jval->jval_lit, it->jscm_ifeq.jequ_exp))
+				i += insn->in_skip;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+int
+json_validate_compiled(
+	struct json_object    const * const obj,
+	struct json_validator const * const validator,
+	char                        * const buf,
+	size_t                        const size
+	)
+{
+	return _run(validator->jvd_root, obj, validator->jvd_alloc, buf, size);
+}
@@ -0,0 +1,507 @@
+/*
+ * json_write.c
+ *
+ * Simple JSON parser.
+ *
+ * https://github.com/e03213ac/libjson
+ *
+ * This work belongs to the Public Domain. Everyone is free to use, modify,
+ * republish, sell or give away this work without prior consent from anybody.
+ *
+ * This software is provided on an "AS IS" basis, without warranty of any kind.
+ * Use at your own risk! Under no circumstances shall the author(s) or
+ * contributor(s) be liable for damages resulting directly or indirectly from
+ * the use or non-use of this documentation.
+ */
+
+/*
+ * Serializer.
+ *
+ * Output goes through a single cursor into a buffer. The same code measures
+ * the output, writes it to a buffer of known size, or writes it to a stream
+ * through a buffer that is flushed when full. Once a buffer of known size
+ * overflows, the rest of the output is only measured.
+ *
+ * Strings are copied a run at a time: the characters that need escaping are
+ * found a vector at a time, and everything in between is copied in bulk.
+ * Other literals are written from their typed values, not their text.
+ */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Private API */
+#include "json_private.h"
+
+/* Size of the stream buffer */
+#define STREAM_BUFFER 4096
+
+/* Indentation, per level */
+#define INDENT "    "
+
+/**
+ * Output cursor.
+ */
+struct _out {
+	char                 * o_b;           // start of buffer
+	char                 * o_p;           // next byte
+	char                 * o_e;           // end of buffer
+	size_t                 o_len;         // length of the output so far
+	FILE                 * o_f;           // stream, or NULL
+	int                    o_err;         // stream or allocation error
+};
+
+/**
+ * Open container, and the next of its values to write.
+ */
+struct _frame {
+	enum json_value_type   fr_type;
+	union {
+	struct json_object const * fr_obj;
+	struct json_array  const * fr_arr;
+	};
+	unsigned               fr_next;
+};
+
+/* Flush the stream buffer */
+static void
+_flush(struct _out * const out)
+{
+	size_t const len = out->o_p - out->o_b;
+
+	if (len && fwrite(out->o_b, 1, len, out->o_f) != len)
+		out->o_err = errno ? : EIO;
+	out->o_p = out->o_b;
+}
+
+/**
+ * Put what does not fit in the buffer.
+ */
+static void
+_put_slow(struct _out * const out, char const * const s, size_t const n)
+{
+	/* buffer of known size, or none: fill it, then only measure */
+	if (out->o_f == NULL) {
+		if (out->o_p < out->o_e) {
+			memcpy(out->o_p, s, out->o_e - out->o_p);
+			out->o_p = out->o_e;
+		}
+		return;
+	}
+
+	/* stream: flush, then buffer or write through */
+	_flush(out);
+	if (n <= (size_t) (out->o_e - out->o_p)) {
+		memcpy(out->o_p, s, n);
+		out->o_p += n;
+	} else if (fwrite(s, 1, n, out->o_f) != n)
+		out->o_err = errno ? : EIO;
+}
+
+/* Put characters */
+static inline void
+_put(struct _out * const out, char const * const s, size_t const n)
+{
+	if (n <= (size_t) (out->o_e - out->o_p)) {
+		if (n)
+			memcpy(out->o_p, s, n);
+		out->o_p += n;
+	} else
+		_put_slow(out, s, n);
+	out->o_len += n;
+}
+
+/* Put a character */
+static inline void
+_putc(struct _out * const out, char const c)
+{
+	_put(out, &c, 1);
+}
+
+/* Put a string constant */
+#define _puts(out, s) _put((out), (s), sizeof(s) - 1)
+
+/**
+ * Find the next character that needs escaping: a quote, a backslash, or
+ * anything that is not printable ASCII.
+ *
+ * Returns e if there is none.
+ */
+static inline char const *
+_scan_clean(char const * p, char const * const e)
+{
+#ifdef __SSE2__
+	/* 16 characters at a time */
+	for (; e - p >= 16; p += 16) {
+		__m128i const c = _mm_loadu_si128((__m128i const *) p);
+		__m128i const stop = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('"')),
+				     _mm_cmpeq_epi8(c, _mm_set1_epi8('\\'))),
+			/* signed: catches bytes >= 0x80 too */
+			_mm_or_si128(_mm_cmplt_epi8(c, _mm_set1_epi8(0x20)),
+				     _mm_cmpeq_epi8(c, _mm_set1_epi8(0x7f))));
+		int const m = _mm_movemask_epi8(stop);
+		if (m)
+			return p + __builtin_ctz(m);
+	}
+#else
+	/* 8 characters at a time */
+	uint64_t const ones = 0x0101010101010101ull;
+	uint64_t const high = 0x8080808080808080ull;
+	for (; e - p >= 8; p += 8) {
+		uint64_t x;
+		memcpy(&x, p, sizeof(x));
+		uint64_t const q = x ^ (ones * '"');
+		uint64_t const b = x ^ (ones * '\\');
+		uint64_t const d = x ^ (ones * 0x7f);
+		uint64_t const stop = ((q - ones) & ~q)
+				    | ((b - ones) & ~b)
+				    | ((d - ones) & ~d)
+				    | ((x - ones * 0x20) & ~x)
+				    | x;
+		if (stop & high)
+			break;
+	}
+#endif
+	for (; p < e; p++)
+		if (*p == '"' || *p == '\\' || !(isascii(*p) && isprint(*p)))
+			return p;
+	return e;
+}
+
+/**
+ * Decode a UTF-8 sequence.
+ *
+ * Returns its length, and U+FFFD for invalid sequences, one byte at a time.
+ */
+static inline size_t
+_readutf8(char const * const p, char const * const e, uint32_t * const cp)
+{
+	unsigned char const c = *p;
+	size_t n;
+
+	if (c < 0x80) {
+		*cp = c;
+		return 1;
+	}
+	if (c >= 0xc2 && c < 0xe0) {
+		*cp = c & 0x1f;
+		n = 2;
+	} else if (c >= 0xe0 && c < 0xf0) {
+		*cp = c & 0x0f;
+		n = 3;
+	} else if (c >= 0xf0 && c < 0xf5) {
+		*cp = c & 0x07;
+		n = 4;
+	} else
+		goto invalid;
+
+	if ((size_t) (e - p) < n)
+		goto invalid;
+	for (size_t i = 1; i < n; i++) {
+		if ((p[i] & 0xc0) != 0x80)
+			goto invalid;
+		*cp = *cp << 6 | (p[i] & 0x3f);
+	}
+
+	/* overlong, surrogate or out of range */
+	if (   (n == 3 && *cp < 0x800)
+	    || (n == 4 && (*cp < 0x10000 || *cp > 0x10ffff))
+	    || (*cp >= 0xd800 && *cp < 0xe000))
+		goto invalid;
+	return n;
+
+invalid:
+	*cp = 0xfffd;
+	return 1;
+}
+
+/* Put a \u escape */
+static inline void
+_put_u(struct _out * const out, uint32_t const cp)
+{
+	static char const hex[] = "0123456789abcdef";
+	char const esc[6] = {
+		'\\', 'u',
+		hex[cp >> 12 & 0xf], hex[cp >> 8 & 0xf],
+		hex[cp >> 4 & 0xf],  hex[cp & 0xf],
+	};
+
+	_put(out, esc, sizeof(esc));
+}
+
+/**
+ * Put a quoted, escaped string.
+ *
+ * The output is ASCII: anything else is escaped, UTF-16 encoded.
+ */
+static void
+_put_string(struct _out * const out, char const * s, size_t const len)
+{
+	char const * const e = s + len;
+
+	_putc(out, '"');
+	for (;;) {
+		char const * const stop = _scan_clean(s, e);
+		_put(out, s, stop - s);
+		if (stop == e)
+			break;
+
+		char esc[2] = { '\\', *stop };
+		uint32_t cp;
+		s = stop + 1;
+		switch (*stop) {
+		case '"':  case '\\':   break;
+		case '\b': esc[1] = 'b'; break;
+		case '\f': esc[1] = 'f'; break;
+		case '\n': esc[1] = 'n'; break;
+		case '\r': esc[1] = 'r'; break;
+		case '\t': esc[1] = 't'; break;
+		default:
+			s = stop + _readutf8(stop, e, &cp);
+			if (cp >= 0x10000) {
+				cp -= 0x10000;
+				_put_u(out, 0xd800 | cp >> 10);
+				_put_u(out, 0xdc00 | (cp & 0x3ff));
+			} else
+				_put_u(out, cp);
+			continue;
+		}
+		_put(out, esc, 2);
+	}
+	_putc(out, '"');
+}
+
+/* Start a new line, at the given level */
+static inline void
+_newline(struct _out * const out, unsigned const flags, unsigned const lev)
+{
+	if (!(flags & JSON_WRITE_PRETTY))
+		return;
+	_putc(out, '\n');
+	for (unsigned i = 0; i < lev; i++)
+		_puts(out, INDENT);
+}
+
+/**
+ * Put a literal, from its typed value.
+ */
+static void
+_write_literal(struct _out * const out, struct json_value const * const val)
+{
+	char buf[JSON_FORMAT_SIZE];
+	size_t n = 0;
+
+	/* numbers are formatted in place when there is room */
+	bool const room = (size_t) (out->o_e - out->o_p) >= JSON_FORMAT_SIZE;
+	char * const p = room ? out->o_p : buf;
+
+	switch (val->jval_lit_type) {
+	case JSON_LIT_STRING:
+		_put_string(out, val->jval_lit, strlen(val->jval_lit));
+		return;
+	case JSON_LIT_BOOL:
+		if (val->jval_bool)
+			_puts(out, "true");
+		else
+			_puts(out, "false");
+		return;
+	case JSON_LIT_NULL:
+		_puts(out, "null");
+		return;
+	case JSON_LIT_INT:
+		n = json_format_int64(val->jval_int, p);
+		break;
+	case JSON_LIT_UINT:
+		n = json_format_uint64(val->jval_uint, p);
+		break;
+	case JSON_LIT_DOUBLE:
+		/* out of range: as it was parsed */
+		if ((n = json_format_double(val->jval_double, p)) == 0) {
+			_put(out, val->jval_lit, strlen(val->jval_lit));
+			return;
+		}
+		break;
+	}
+
+	if (room) {
+		out->o_p += n;
+		out->o_len += n;
+	} else
+		_put(out, buf, n);
+}
+
+/* Open a container: push it, and put its opening bracket */
+static int
+_open(struct _out * const out, struct json_stack * const st,
+      struct json_value const * const val )
+{
+	struct _frame * const fr = json_stack_push(st);
+
+	if (fr == NULL)
+		return errno;
+	*fr = (struct _frame) {
+		.fr_type = val->jval_type,
+		.fr_obj  = val->jval_object,
+	};
+	_putc(out, val->jval_type == JSON_VAL_OBJECT ? '{' : '[');
+	return 0;
+}
+
+/**
+ * Put an object, walking nested containers with a stack of frames, so that
+ * the depth of the output is only bounded by memory, as that of the input
+ * is.
+ */
+static void
+_write_root(struct _out * const out, unsigned const flags,
+	    struct json_allocator const * const alloc,
+	    struct json_object const * const obj )
+{
+	struct _frame inline_frames[JSON_STACK_INLINE];
+	struct json_stack st;
+	struct _frame * fr;
+	int err;
+	struct json_value const root = {
+		.jval_type   = JSON_VAL_OBJECT,
+		.jval_object = (struct json_object *) obj,
+	};
+
+	json_stack_init(&st, inline_frames, sizeof(*inline_frames), alloc);
+	_open(out, &st, &root);
+	while ((fr = json_stack_top(&st))) {
+		bool const is_obj = fr->fr_type == JSON_VAL_OBJECT;
+		unsigned const len = is_obj ? fr->fr_obj->jobj_length
+					    : fr->fr_arr->jarr_length;
+		struct json_value const * val;
+
+		/* done with it */
+		if (fr->fr_next == len) {
+			json_stack_pop(&st);
+			_newline(out, flags, st.jst_depth);
+			_putc(out, is_obj ? '}' : ']');
+			continue;
+		}
+
+		unsigned const i = fr->fr_next++;
+		if (i)
+			_putc(out, ',');
+		_newline(out, flags, st.jst_depth);
+
+		/* sorted objects are written in document order */
+		if (is_obj) {
+			struct json_object const * const o = fr->fr_obj;
+			struct json_tuple const * const tup = &o->jobj_tuples[
+				o->jobj_order ? o->jobj_order[i] : i];
+			_put_string(out, tup->jtup_key, tup->jtup_keylen);
+			if (flags & JSON_WRITE_PRETTY)
+				_puts(out, ": ");
+			else
+				_putc(out, ':');
+			val = &tup->jtup_val;
+		} else
+			val = &fr->fr_arr->jarr_values[i];
+
+		if (val->jval_type == JSON_VAL_LITERAL)
+			_write_literal(out, val);
+		else if ((err = _open(out, &st, val))) {
+			out->o_err = err;
+			break;
+		}
+	}
+
+	json_stack_release(&st);
+}
+
+/**
+ * Serialize object to buffer, tracking deep containers in memory from the
+ * given allocator.
+ */
+static int
+_write(struct json_object    const * const obj,
+       unsigned                      const flags,
+       struct json_allocator const * const alloc,
+       char                        * const buf,
+       size_t                        const size,
+       size_t                      * const len )
+{
+	struct _out out = {
+		.o_b = buf,
+		.o_p = buf,
+		.o_e = buf + size,
+	};
+
+	if (obj == NULL) {
+		*len = 0;
+		return EINVAL;
+	}
+	_write_root(&out, flags, alloc, obj);
+	*len = out.o_len;
+	return out.o_err ? : out.o_len <= size ? 0 : ENOBUFS;
+}
+
+int
+json_write(
+	struct json_object const * const obj,
+	unsigned                   const flags,
+	char                     * const buf,
+	size_t                     const size,
+	size_t                   * const len )
+{
+	return _write(obj, flags, NULL, buf, size, len);
+}
+
+int
+json_write_alloc(
+	struct json_object    const * const obj,
+	unsigned                      const flags,
+	struct json_allocator const * const alloc,
+	char                       ** const str,
+	size_t                      * const len )
+{
+	size_t size;
+	char * s;
+	int err;
+
+	*str = NULL;
+	*len = 0;
+
+	/* measure, then write into a string of just the right size */
+	err = _write(obj, flags, alloc, NULL, 0, &size);
+	if (err && err != ENOBUFS)
+		return err;
+	if ((s = json_mem_alloc(alloc, size + 1)) == NULL)
+		return errno;
+	if ((err = _write(obj, flags, alloc, s, size, len))) {
+		json_mem_free(alloc, s);
+		*len = 0;
+		return err;
+	}
+	s[size] = '\0';
+
+	*str = s;
+	return 0;
+}
+
+int
+json_write_file(
+	struct json_object const * const obj,
+	unsigned                   const flags,
+	FILE                     * const f )
+{
+	char buf[STREAM_BUFFER];
+	struct _out out = {
+		.o_b = buf,
+		.o_p = buf,
+		.o_e = buf + sizeof(buf),
+		.o_f = f,
+	};
+
+	if (obj == NULL)
+		return EINVAL;
+	_write_root(&out, flags, NULL, obj);
+	if (out.o_err == 0)
+		_flush(&out);
+	return out.o_err;
+}
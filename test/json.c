@@ -14,10 +14,19 @@
  * the use or non-use of this documentation.
  */
 
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "json.h"
 
+#define GCC_DIM(a) (sizeof(a) / sizeof(*(a)))
+#define GCC_TYPECHECK(type, x) ((type) (x))
+#include "json_schema.h"
+
 static void test(
 	char const * const test_name,
 	char const * const test_doc
@@ -35,6 +44,1435 @@ static void test(
 	}
 }
 
+static void test_stream(
+	char const * const test_name,
+	char const * const test_doc
+	)
+{
+	json_document_t * doc;
+	FILE * f;
+	int err;
+
+	if ((f = fmemopen((void *) test_doc, strlen(test_doc), "r")) == NULL)
+		printf("%s: error: %s\n", test_name, strerror(errno));
+	else if ((err = json_parse(f, &doc)))
+		printf("%s: error: %s\n", test_name, strerror(err));
+	else {
+		printf("%s: ok\n", test_name);
+		json_dump(doc, stdout);
+		json_free(doc);
+	}
+	if (f)
+		fclose(f);
+}
+
+static void test_insitu(
+	char const * const test_name,
+	char const * const test_doc
+	)
+{
+	struct json_parse_options const opts = {
+		.jopt_flags = JSON_PARSE_INSITU,
+	};
+	json_document_t * doc;
+	char * const buf = strdup(test_doc);
+	int err;
+
+	if ((err = json_parse_data_opts(buf, strlen(buf), &opts, &doc)))
+		printf("%s: error: %s\n", test_name, strerror(err));
+	else {
+		printf("%s: ok\n", test_name);
+		json_dump(doc, stdout);
+		json_free(doc);
+	}
+	free(buf);
+}
+
+/* Parse an array of n integers, wrapped in an object */
+static void test_large(
+	char const * const test_name,
+	unsigned const n,
+	unsigned const flags
+	)
+{
+	struct json_parse_options const opts = {
+		.jopt_flags = flags,
+	};
+	json_document_t * doc;
+	size_t const size = 16 + 12 * (size_t) n;
+	char * const buf = malloc(size);
+	size_t len = 0;
+	int err;
+
+	len += sprintf(buf + len, "{ v: [");
+	for (unsigned i = 0; i < n; i++)
+		len += sprintf(buf + len, i ? ",%u" : "%u", i);
+	len += sprintf(buf + len, "] }");
+
+	if ((err = json_parse_data_opts(buf, len, &opts, &doc)))
+		printf("%s: error: %s\n", test_name, strerror(err));
+	else {
+		struct json_array const * const v =
+			json_get_array(json_doc_object(doc), "v");
+		printf("%s: ok: %u values, last %s\n", test_name,
+		       v->jarr_length, v->jarr_values[n - 1].jval_lit);
+		json_free(doc);
+	}
+	free(buf);
+}
+
+/* Parse n nested arrays, wrapped in an object */
+static void test_deep(
+	char const * const test_name,
+	unsigned const n,
+	unsigned const max_depth
+	)
+{
+	struct json_parse_options const opts = {
+		.jopt_max_depth = max_depth,
+	};
+	json_document_t * doc;
+	char * const buf = malloc(2 * (size_t) n + 128);
+	size_t len = 0;
+	int err;
+
+	len += sprintf(buf + len, "{ v: ");
+	memset(buf + len, '[', n);
+	memset(buf + len + n, ']', n);
+	len += 2 * n;
+	len += sprintf(buf + len, " }");
+
+	if ((err = json_parse_data_opts(buf, len, &opts, &doc)))
+		printf("%s: error: %s\n", test_name, strerror(err));
+	else {
+		/* written back without recursion, so as deep as parsed */
+		char * str;
+		size_t slen;
+		len = sprintf(buf, "{\"v\":");
+		memset(buf + len, '[', n);
+		memset(buf + len + n, ']', n);
+		len += 2 * n;
+		buf[len++] = '}';
+		if ((err = json_write_alloc(json_doc_object(doc), 0, NULL,
+					    &str, &slen)))
+			printf("%s: error: %s\n", test_name, strerror(err));
+		else {
+			printf("%s: ok, %s\n", test_name,
+			       slen == len && !memcmp(str, buf, len)
+			       ? "written back" : "mismatch");
+			free(str);
+		}
+
+		/* copied and compared without recursion, equal then not */
+		struct json_parse_options const popts = {
+			.jopt_max_depth = n + 3,
+		};
+		json_document_t * patch;
+		for (unsigned k = 0; k < 2; k++) {
+			len = sprintf(buf, "{ patch: [ "
+				      "{ op: copy, from: \"/v\", "
+				      "path: \"/w\" }, "
+				      "{ op: test, path: \"/w\", value: ");
+			memset(buf + len, '[', n);
+			len += n;
+			if (k)
+				buf[len++] = '1';
+			memset(buf + len, ']', n);
+			len += n;
+			len += sprintf(buf + len, " } ] }");
+			if ((err = json_parse_data_opts(buf, len, &popts,
+							&patch))) {
+				printf("%s: error: %s\n", test_name,
+				       strerror(err));
+				continue;
+			}
+			err = json_patch_apply(doc,
+				json_get_array(json_doc_object(patch), "patch"));
+			printf("%s: %s, %s\n", test_name,
+			       k ? "unequal" : "equal",
+			       err ? strerror(err) : "patched");
+			json_free(patch);
+		}
+		json_free(doc);
+	}
+	free(buf);
+}
+
+/* Parse long literals of n characters from buffer, in situ and stream */
+static void test_long(
+	char const * const test_name,
+	unsigned const n
+	)
+{
+	struct json_parse_options const opts = {
+		.jopt_flags = JSON_PARSE_INSITU,
+	};
+	char * const buf = malloc(4 * (size_t) n + 64);
+	char * const dup = malloc(4 * (size_t) n + 64);
+	size_t len = 0;
+
+	/* a string with an escape every 100 characters, a name, a number */
+	len += sprintf(buf + len, "{ s: \"");
+	for (unsigned i = 0; i < n; i++)
+		len += sprintf(buf + len, i % 100 == 99 ? "\\t" : "%c",
+			       'a' + i % 26);
+	len += sprintf(buf + len, "\", k: ");
+	for (unsigned i = 0; i < n; i++)
+		buf[len++] = 'a' + i % 26;
+	len += sprintf(buf + len, ", n: ");
+	for (unsigned i = 0; i < n; i++)
+		buf[len++] = '1' + i % 9;
+	len += sprintf(buf + len, ".5 }");
+	memcpy(dup, buf, len);
+
+	for (unsigned mode = 0; mode < 3; mode++) {
+		json_document_t * doc;
+		FILE * f = NULL;
+		int err;
+
+		switch (mode) {
+		case 0:
+			err = json_parse_data(buf, len, &doc);
+			break;
+		case 1:
+			err = json_parse_data_opts(dup, len, &opts, &doc);
+			break;
+		default:
+			f = fmemopen(buf, len, "r");
+			err = json_parse(f, &doc);
+			fclose(f);
+		}
+		if (err) {
+			printf("%s/%u: error: %s\n", test_name, mode,
+			       strerror(err));
+			continue;
+		}
+
+		struct json_object const * const obj = json_doc_object(doc);
+		char const * const s = json_get_literal(obj, "s");
+		printf("%s/%u: ok: %zu %zu %zu, tab at 99: %d\n",
+		       test_name, mode, strlen(s),
+		       strlen(json_get_literal(obj, "k")),
+		       strlen(json_get_literal(obj, "n")),
+		       s[99] == '\t');
+		json_free(doc);
+	}
+
+	free(dup);
+	free(buf);
+}
+
+/* Parse heavily indented documents from buffer, in situ and stream */
+static void test_pretty(
+	char const * const test_name,
+	unsigned const n,
+	unsigned const indent
+	)
+{
+	struct json_parse_options const opts = {
+		.jopt_flags = JSON_PARSE_INSITU,
+	};
+	size_t const size = (size_t) n * (indent + 64) + 64;
+	char * const buf = malloc(size);
+	char * const dup = malloc(size);
+	size_t len = 0;
+
+	/* keys with escaped quotes and backslashes, spaced out values */
+	len += sprintf(buf + len, "{");
+	for (unsigned i = 0; i < n; i++) {
+		len += sprintf(buf + len, "%s\n", i ? "," : "");
+		memset(buf + len, i % 2 ? ' ' : '\t', indent);
+		len += indent;
+		len += sprintf(buf + len, "\"k\\\"%u\\\\\"  :  [ %u ,\t\"{[:,]}\" ]",
+			       i, i);
+	}
+	len += sprintf(buf + len, "\n}\n");
+	memcpy(dup, buf, len);
+
+	for (unsigned mode = 0; mode < 3; mode++) {
+		json_document_t * doc;
+		FILE * f = NULL;
+		int err;
+
+		switch (mode) {
+		case 0:
+			err = json_parse_data(buf, len, &doc);
+			break;
+		case 1:
+			err = json_parse_data_opts(dup, len, &opts, &doc);
+			break;
+		default:
+			f = fmemopen(buf, len, "r");
+			err = json_parse(f, &doc);
+			fclose(f);
+		}
+		if (err) {
+			printf("%s/%u: error: %s\n", test_name, mode,
+			       strerror(err));
+			continue;
+		}
+
+		struct json_object const * const obj = json_doc_object(doc);
+		struct json_tuple const * const last =
+			&obj->jobj_tuples[obj->jobj_length - 1];
+		struct json_array const * const arr =
+			last->jtup_val.jval_array;
+		printf("%s/%u: ok: %u keys, last %s = [ %s, %s ]\n",
+		       test_name, mode, obj->jobj_length, last->jtup_key,
+		       arr->jarr_values[0].jval_lit,
+		       arr->jarr_values[1].jval_lit);
+		json_free(doc);
+	}
+
+	free(dup);
+	free(buf);
+}
+
+/* Look up every key of an object of n keys, plus a few missing ones */
+static void test_wide(
+	char const * const test_name,
+	unsigned const n
+	)
+{
+	size_t const size = 64 + 32 * (size_t) n;
+	char * const buf = malloc(size);
+	size_t len = 0;
+	json_document_t * doc;
+	unsigned found = 0;
+	int err;
+
+	/* mixed-case keys, nested objects, and a duplicate of the first key */
+	len += sprintf(buf + len, "{");
+	for (unsigned i = 0; i < n; i++)
+		len += sprintf(buf + len, "%sKey%u: %u", i ? "," : "", i, i);
+	len += sprintf(buf + len, ", sub: { x: 1 }, key0: dup }");
+
+	if ((err = json_parse_data(buf, len, &doc))) {
+		printf("%s: error: %s\n", test_name, strerror(err));
+		free(buf);
+		return;
+	}
+
+	struct json_object const * const obj = json_doc_object(doc);
+	for (unsigned i = 0; i < n; i++) {
+		char key[32];
+		unsigned v;
+		snprintf(key, sizeof(key), i % 2 ? "KEY%u" : "key%u", i);
+		if (json_get_uint(obj, key, &v) == 0 && v == i)
+			found++;
+	}
+	char const * const first = json_get_literal(obj, "KEY0");
+	int x = 0;
+
+	printf("%s: ok: %u/%u keys%s, first %s, missing %s %s, sub/x %d\n",
+	       test_name, found, n, obj->jobj_slots ? ", indexed" : "",
+	       first ? first : "(null)",
+	       json_get_value(obj, "key") ? "found" : "none",
+	       json_get_value(obj, "sub/y") ? "found" : "none",
+	       json_get_int(obj, "SUB/X", &x) ? -1 : x);
+	json_free(doc);
+	free(buf);
+}
+
+/* Look up paths, both as strings and compiled */
+static void test_path(
+	char const * const test_name,
+	char const * const test_doc,
+	char const * const path
+	)
+{
+	json_document_t * doc;
+	json_path_t * jpath;
+	int err;
+
+	if ((err = json_parse_string(test_doc, &doc))) {
+		printf("%s: error: %s\n", test_name, strerror(err));
+		return;
+	}
+	if ((err = json_path_compile(path, &jpath))) {
+		printf("%s: %s: error: %s\n", test_name, path, strerror(err));
+		json_free(doc);
+		return;
+	}
+
+	struct json_object const * const obj = json_doc_object(doc);
+	struct json_value const * const val = json_get_value(obj, path);
+	struct json_value const * const cval = json_get_value_at(obj, jpath);
+	printf("%s: %s: %s%s\n", test_name, path,
+	       val == NULL ? "(none)" :
+	       val->jval_type == JSON_VAL_LITERAL ? val->jval_lit :
+	       val->jval_type == JSON_VAL_OBJECT ? "(object)" : "(array)",
+	       val == cval ? "" : " (compiled path differs)");
+
+	json_path_free(jpath);
+	json_free(doc);
+}
+
+/* Parse documents sharing an intern table of at most max strings */
+static void test_intern(
+	char const * const test_name,
+	unsigned const max
+	)
+{
+	static char const * const docs[] = {
+		"{ key: short, \"key2\": [ \"short\", 1 ], long: "
+		"\"0123456789012345678901234567890123456789012345678901234567890123456789\" }",
+		"{ \"key2\": 2, key: \"short\", x: { key: short } }",
+	};
+	json_document_t * doc[2];
+	json_intern_t * intern;
+	json_path_t * path;
+	int err;
+
+	if ((err = json_intern_new(max, &intern))) {
+		printf("%s: error: %s\n", test_name, strerror(err));
+		return;
+	}
+	for (unsigned i = 0; i < 2; i++) {
+		struct json_parse_options const opts = {
+			.jopt_intern = intern,
+		};
+		char * const buf = strdup(docs[i]);
+		err = json_parse_data_opts(buf, strlen(buf), &opts, &doc[i]);
+		free(buf);
+		if (err) {
+			printf("%s: error: %s\n", test_name, strerror(err));
+			return;
+		}
+	}
+
+	struct json_object const * const a = json_doc_object(doc[0]);
+	struct json_object const * const b = json_doc_object(doc[1]);
+	char const * const s = json_get_literal(a, "key");
+	char const * const l = json_get_literal(a, "long");
+	(void) json_path_compile_intern("x/key", intern, &path);
+	printf("%s: ok: keys %s, values %s, long %s, path %s\n", test_name,
+	       a->jobj_tuples[1].jtup_key == b->jobj_tuples[0].jtup_key
+	       ? "shared" : "distinct",
+	          s == json_get_literal(b, "key")
+	       && s == json_get_literal(b, "x/key") ? "shared" : "distinct",
+	       l && strlen(l) == 70 ? "stored" : "lost",
+	       json_get_literal_at(b, path) == s ? "found" : "not found");
+
+	json_path_free(path);
+	json_free(doc[0]);
+	json_free(doc[1]);
+	json_intern_free(intern);
+}
+
+static void test_sorted(
+	char const * const test_name,
+	char const * const test_doc
+	)
+{
+	struct json_parse_options const opts = {
+		.jopt_flags = JSON_PARSE_SORTKEYS,
+	};
+	static char const * const keys[] = {
+		"b", "A", "c/Y", "c/x", "aa", "d", "e/1/Q",
+	};
+	char * const buf = strdup(test_doc);
+	json_document_t * doc;
+	int err;
+
+	err = json_parse_data_opts(buf, strlen(buf), &opts, &doc);
+	free(buf);
+	if (err) {
+		printf("%s: error: %s\n", test_name, strerror(err));
+		return;
+	}
+
+	/* tuples in sorted order, lookups, then the dump in document order */
+	struct json_object const * const obj = json_doc_object(doc);
+	printf("%s: ok: sorted", test_name);
+	for (unsigned i = 0; i < obj->jobj_length; i++)
+		printf(" %s", obj->jobj_tuples[i].jtup_key);
+	printf("\n");
+	for (unsigned i = 0; i < sizeof(keys) / sizeof(*keys); i++) {
+		struct json_value const * const val =
+			json_get_value(obj, keys[i]);
+		printf("    %s: %s\n", keys[i], !val ? "(none)"
+		       : val->jval_type == JSON_VAL_LITERAL ? val->jval_lit
+		       : "(container)");
+	}
+	json_dump(doc, stdout);
+	json_free(doc);
+}
+
+static void test_schema(
+	char const * const test_name,
+	char const * const test_doc
+	)
+{
+	struct _vals {
+		char const * name;
+		int          ver;
+		unsigned     port;
+		double       ratio;
+		char const * mode;
+		unsigned     x;
+		char const ** tags;
+		unsigned     ntags;
+	} v[2];
+	struct json_schema const tcp[2][2] = {
+#define TCP(i) { JSON_REQUIRE_UINT("port", &v[i].port), \
+		 JSON_REQUIRE_DBL("ratio", &v[i].ratio) }
+		TCP(0), TCP(1),
+#undef TCP
+	};
+	struct json_schema const sub[2][1] = {
+		{ JSON_REQUIRE_UINT("x", &v[0].x) },
+		{ JSON_REQUIRE_UINT("x", &v[1].x) },
+	};
+	struct json_schema const schema[2][6] = {
+#define SCHEMA(i) { \
+		JSON_REQUIRE_TEXT("name", &v[i].name), \
+		JSON_OPTIONAL_INT("VER", &v[i].ver), \
+		JSON_REQUIRE_TEXT("mode", &v[i].mode), \
+		JSON_IFEQ("mode", "tcp", tcp[i]), \
+		JSON_DESCEND("sub", sub[i]), \
+		JSON_REQUIRE_TEXTV("sub/tags", &v[i].tags, &v[i].ntags) }
+		SCHEMA(0), SCHEMA(1),
+#undef SCHEMA
+	};
+	json_validator_t * validator;
+	json_document_t * doc;
+	char buf[2][64];
+	int err[2];
+
+	if ((err[0] = json_parse_string(test_doc, &doc))) {
+		printf("%s: error: %s\n", test_name, strerror(err[0]));
+		return;
+	}
+	if ((err[0] = json_schema_compile(schema[1], 6, &validator))) {
+		printf("%s: error: %s\n", test_name, strerror(err[0]));
+		json_free(doc);
+		return;
+	}
+
+	/* both engines must agree, on errors and on values */
+	struct json_object const * const obj = json_doc_object(doc);
+	memset(v, 0, sizeof(v));
+	memset(buf, 0, sizeof(buf));
+	err[0] = json_validate(obj, schema[0], 6, buf[0], sizeof(buf[0]));
+	err[1] = json_validate_compiled(obj, validator, buf[1], sizeof(buf[1]));
+	if (err[0] || err[1])
+		printf("%s: %s: %s (%s)\n", test_name,
+		       err[0] == err[1] && !strcmp(buf[0], buf[1])
+		       ? "same" : "differ", buf[0], buf[1]);
+	else
+		printf("%s: %s: name=%s ver=%d mode=%s port=%u ratio=%g "
+		       "x=%u tags=%u\n", test_name,
+		          !strcmp(v[0].name, v[1].name)
+		       && v[0].ver == v[1].ver && v[0].port == v[1].port
+		       && v[0].ratio == v[1].ratio && v[0].x == v[1].x
+		       && v[0].ntags == v[1].ntags ? "same" : "differ",
+		       v[1].name, v[1].ver, v[1].mode, v[1].port, v[1].ratio,
+		       v[1].x, v[1].ntags);
+	free(v[0].tags);
+	free(v[1].tags);
+
+	json_validator_free(validator);
+	json_free(doc);
+}
+
+static int ev_object_begin(void * arg) { return fputs(" {", arg) < 0; }
+static int ev_object_end(void * arg)   { return fputs(" }", arg) < 0; }
+static int ev_array_begin(void * arg)  { return fputs(" [", arg) < 0; }
+static int ev_array_end(void * arg)    { return fputs(" ]", arg) < 0; }
+
+static int ev_key(void * arg, char const * key, size_t len)
+{
+	if (!strcmp(key, "stop"))
+		return ECANCELED;
+	return fprintf(arg, " %s(%zu):", key, len) < 0;
+}
+
+static int ev_value(void * arg, struct json_value const * val)
+{
+	static char const * const types[] = {
+		[JSON_LIT_STRING] = "s",
+		[JSON_LIT_INT]    = "i",
+		[JSON_LIT_UINT]   = "u",
+		[JSON_LIT_DOUBLE] = "d",
+		[JSON_LIT_BOOL]   = "b",
+		[JSON_LIT_NULL]   = "n",
+	};
+	return fprintf(arg, " %s=%s", types[val->jval_lit_type],
+		       val->jval_lit) < 0;
+}
+
+/* Run of a test from a buffer, or from a stream if in, writing to out */
+typedef int both_fn(char * buf, size_t len, FILE * in, FILE * out,
+		    void * arg);
+
+/**
+ * Run a test from a buffer, then from a stream: both must agree.
+ *
+ * Returns the error of the buffer run, and its output in out, to be freed.
+ */
+static int run_both(
+	char const * const test_doc,
+	both_fn * const fn,
+	void * const arg,
+	char ** const out,
+	size_t * const outlen,
+	bool * const same
+	)
+{
+	char * o[2] = { NULL, NULL };
+	size_t olen[2];
+	int err[2] = { 0, 0 };
+
+	for (unsigned i = 0; i < 2; i++) {
+		size_t const len = strlen(test_doc);
+		char * const buf = strdup(test_doc);
+		FILE * const f = open_memstream(&o[i], &olen[i]);
+		FILE * const in = i ? fmemopen(buf, len, "r") : NULL;
+		err[i] = fn(buf, len, in, f, arg);
+		if (in)
+			fclose(in);
+		fclose(f);
+		free(buf);
+	}
+
+	*same = err[0] == err[1] && !strcmp(o[0], o[1]);
+	*out = o[0];
+	*outlen = olen[0];
+	free(o[1]);
+	return err[0];
+}
+
+static int events_run(
+	char * const buf,
+	size_t const len,
+	FILE * const in,
+	FILE * const out,
+	void * const arg
+	)
+{
+	return in ? json_parse_events(in, NULL, arg, out)
+		  : json_parse_events_data(buf, len, NULL, arg, out);
+}
+
+static void test_events(
+	char const * const test_name,
+	char const * const test_doc
+	)
+{
+	static struct json_parse_events const events = {
+		.jev_object_begin = ev_object_begin,
+		.jev_object_end   = ev_object_end,
+		.jev_array_begin  = ev_array_begin,
+		.jev_array_end    = ev_array_end,
+		.jev_key          = ev_key,
+		.jev_value        = ev_value,
+	};
+	char * out;
+	size_t outlen;
+	bool same;
+	int const err = run_both(test_doc, events_run, (void *) &events,
+				 &out, &outlen, &same);
+
+	printf("%s: %s:%s%s%s\n", test_name, same ? "same" : "differ", out,
+	       err ? " error: " : "", err ? strerror(err) : "");
+	free(out);
+}
+
+/* Dump a document into a string */
+static char * dump_string(json_document_t const * const doc)
+{
+	char * out = NULL;
+	size_t len;
+	FILE * const f = open_memstream(&out, &len);
+
+	json_dump(doc, f);
+	fclose(f);
+	return out;
+}
+
+static void test_push(
+	char const * const test_name,
+	char const * const test_doc
+	)
+{
+	static unsigned const chunks[] = { 1, 2, 3, 5, 8, 13, 64, 100000 };
+	size_t const len = strlen(test_doc);
+	json_document_t * doc;
+	char * expected = NULL;
+	unsigned same = 0;
+	int err, experr;
+
+	/* the same document, parsed from a buffer in one go */
+	char * const buf = strdup(test_doc);
+	if ((experr = json_parse_data(buf, len, &doc)) == 0) {
+		expected = dump_string(doc);
+		json_free(doc);
+	}
+	free(buf);
+
+	for (unsigned i = 0; i < sizeof(chunks) / sizeof(*chunks); i++) {
+		json_parser_t * ps;
+		if ((err = json_parser_new(NULL, &ps)))
+			break;
+		for (size_t off = 0; off < len && !err; off += chunks[i]) {
+			size_t const n = len - off < chunks[i]
+				       ? len - off : chunks[i];
+			/* chunks are not used once fed */
+			char * const chunk = malloc(n);
+			memcpy(chunk, test_doc + off, n);
+			err = json_parser_feed(ps, chunk, n);
+			free(chunk);
+		}
+		if (err == 0 && (err = json_parser_finish(ps, &doc)) == 0) {
+			char * const out = dump_string(doc);
+			same += expected && !strcmp(out, expected);
+			free(out);
+			json_free(doc);
+		} else
+			same += err == experr;
+		json_parser_free(ps);
+	}
+
+	printf("%s: %s: %u/%zu%s%s\n", test_name, experr ? "error" : "ok", same,
+	       sizeof(chunks) / sizeof(*chunks), experr ? ": " : "",
+	       experr ? strerror(experr) : "");
+	free(expected);
+}
+
+/* Records are counted in arg, for the buffer run */
+static int records_run(
+	char * const buf,
+	size_t const len,
+	FILE * const in,
+	FILE * const out,
+	void * const arg
+	)
+{
+	json_document_t const * doc;
+	json_records_t * rc;
+	unsigned n = 0;
+	int err = in ? json_records_new(in, NULL, &rc)
+		     : json_records_new_data(buf, len, NULL, &rc);
+
+	while (err == 0 && (err = json_records_next(rc, &doc)) == 0 && doc) {
+		json_dump(doc, out);
+		n++;
+	}
+	json_records_free(rc);
+	if (in == NULL)
+		*(unsigned *) arg = n;
+	return err;
+}
+
+static void test_records(
+	char const * const test_name,
+	char const * const test_doc
+	)
+{
+	char * out;
+	size_t outlen;
+	unsigned n;
+	bool same;
+	int const err = run_both(test_doc, records_run, &n,
+				 &out, &outlen, &same);
+
+	if (err == 0)
+		printf("%s: ok: %u records\n", test_name, n);
+	else
+		printf("%s: error after %u records: %s\n", test_name, n,
+		       strerror(err));
+	fputs(out, stdout);
+	if (!same)
+		printf("%s: stream differs\n", test_name);
+	free(out);
+}
+
+/* Records seen by a parallel parse */
+struct parallel {
+	unsigned n;         // number of records
+	unsigned next;      // next id expected, when ordered
+	bool ordered;
+	bool in_order;
+	uint64_t sum;       // of ids
+};
+
+static int parallel_record(void * const arg, json_document_t const * const doc)
+{
+	struct parallel * const pr = arg;
+	int id;
+
+	if (json_get_int(json_doc_object(doc), "id", &id))
+		return ENOENT;
+	if (pr->ordered) {
+		pr->in_order &= (unsigned) id == pr->next++;
+		pr->n++;
+		pr->sum += id;
+	} else {
+		__atomic_add_fetch(&pr->n, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&pr->sum, id, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+static void test_parallel(
+	char const * const test_name,
+	unsigned const records,
+	unsigned const bad,
+	bool const ordered
+	)
+{
+	char * buf = NULL;
+	size_t len;
+	FILE * const f = open_memstream(&buf, &len);
+	struct parallel pr = { .ordered = ordered, .in_order = true };
+	int err;
+
+	/* enough records for several chunks per thread */
+	for (unsigned i = 0; i < records; i++)
+		fprintf(f, i == bad ? "{\"id\":%u,}\n"
+			: "{\"id\":%u,\"name\":\"record %u\",\"tags\":"
+			  "[\"a\",\"b\"],\"v\":{\"x\":%u.5}}\n", i, i, i);
+	fclose(f);
+
+	err = json_records_parallel(buf, len, NULL, 4, ordered,
+				    parallel_record, &pr);
+	if (err == 0)
+		printf("%s: ok: %u records, sum %llu%s\n", test_name, pr.n,
+		       (unsigned long long) pr.sum,
+		       ordered && pr.in_order ? ", in order" : "");
+	else if (ordered)
+		printf("%s: error after %u records%s: %s\n", test_name, pr.n,
+		       pr.in_order ? ", in order" : "", strerror(err));
+	else
+		printf("%s: error: %s\n", test_name, strerror(err));
+	free(buf);
+}
+
+static void test_reuse(
+	char const * const test_name,
+	json_document_t * const doc,
+	char const * const test_doc,
+	bool const stream
+	)
+{
+	size_t const len = strlen(test_doc);
+	char * const buf = strdup(test_doc);
+	FILE * const in = stream ? fmemopen(buf, len, "r") : NULL;
+	int const err = stream ? json_doc_parse(doc, in)
+			       : json_doc_parse_data(doc, buf, len);
+
+	if (err)
+		printf("%s: error: %s%s\n", test_name, strerror(err),
+		       json_doc_object(doc) ? "" : ", empty");
+	else {
+		printf("%s: ok\n", test_name);
+		json_dump(doc, stdout);
+	}
+	if (in)
+		fclose(in);
+	free(buf);
+}
+
+static void test_write(
+	char const * const test_name,
+	char const * const test_doc
+	)
+{
+	json_document_t * doc;
+	char buf[16];
+	char * str;
+	size_t len, wlen;
+	int err;
+
+	if ((err = json_parse_string(test_doc, &doc))) {
+		printf("%s: error: %s\n", test_name, strerror(err));
+		return;
+	}
+	printf("%s: ok\n", test_name);
+
+	/* too small: measured anyway */
+	err = json_write(json_doc_object(doc), 0, buf, sizeof(buf), &wlen);
+	if ((err = json_write_alloc(json_doc_object(doc), 0, NULL, &str, &len)))
+		printf("%s: error: %s\n", test_name, strerror(err));
+	else {
+		printf("%s (%zu, %s)\n", str, len,
+		       wlen == len && (len <= sizeof(buf) || !memcmp(buf, str,
+				sizeof(buf))) ? "measured" : "mismatch");
+		free(str);
+	}
+	json_write_file(json_doc_object(doc), JSON_WRITE_PRETTY, stdout);
+	putchar('\n');
+	json_free(doc);
+}
+
+/* Write an empty document, which has no root object */
+static void test_write_empty(
+	char const * const test_name
+	)
+{
+	json_document_t * doc;
+	char buf[16];
+	char * str;
+	size_t len;
+	int err;
+
+	json_doc_new(NULL, &doc);
+	err = json_write(json_doc_object(doc), 0, buf, sizeof(buf), &len);
+	printf("%s: write: %s\n", test_name, strerror(err));
+	err = json_write_alloc(json_doc_object(doc), 0, NULL, &str, &len);
+	printf("%s: alloc: %s\n", test_name, strerror(err));
+	err = json_write_file(json_doc_object(doc), 0, stdout);
+	printf("%s: file: %s\n", test_name, strerror(err));
+	printf("%s: dump: [", test_name);
+	json_dump(doc, stdout);
+	printf("]\n");
+	json_free(doc);
+}
+
+static void test_builder(
+	char const * const test_name,
+	unsigned const flags
+	)
+{
+	struct json_parse_options const opts = { .jopt_flags = flags };
+	json_builder_t * bd;
+	json_document_t * doc;
+	char key[8];
+	char * str;
+	size_t len;
+	int v = -1;
+	int err;
+
+	json_builder_new(&opts, &bd);
+	json_builder_begin_object(bd);
+	json_builder_key(bd, "id", 2);
+	json_builder_int(bd, -42);
+	json_builder_key(bd, "name", 4);
+	json_builder_string(bd, "caf\xc3\xa9 \"x\"", 9);
+	json_builder_key(bd, "big", 3);
+	json_builder_uint(bd, UINT64_MAX);
+	json_builder_key(bd, "ratio", 5);
+	json_builder_double(bd, 0.1);
+	json_builder_key(bd, "ok", 2);
+	json_builder_bool(bd, true);
+	json_builder_key(bd, "none", 4);
+	json_builder_null(bd);
+	json_builder_key(bd, "empty", 5);
+	json_builder_string(bd, NULL, 0);
+	json_builder_key(bd, "tags", 4);
+	json_builder_begin_array(bd);
+	json_builder_string(bd, "a", 1);
+	json_builder_uint(bd, 1);
+	json_builder_begin_array(bd);
+	json_builder_end(bd);
+	json_builder_begin_object(bd);
+	json_builder_end(bd);
+	json_builder_end(bd);
+	json_builder_key(bd, "wide", 4);
+	json_builder_begin_object(bd);
+	for (int i = 0; i < 20; i++) {
+		json_builder_key(bd, key, snprintf(key, sizeof(key), "k%d", i));
+		json_builder_int(bd, i);
+	}
+	json_builder_end(bd);
+	json_builder_end(bd);
+
+	if ((err = json_builder_finish(bd, &doc))) {
+		printf("%s: error: %s\n", test_name, strerror(err));
+		json_builder_free(bd);
+		return;
+	}
+	json_builder_free(bd);
+
+	json_get_int(json_doc_object(doc), "wide/K17", &v);
+	json_write_alloc(json_doc_object(doc), 0, NULL, &str, &len);
+	printf("%s: ok: %s, id %s, wide/K17 %d\n", test_name, str,
+	       json_get_literal(json_doc_object(doc), "id"), v);
+	free(str);
+	json_free(doc);
+}
+
+/* Misplaced builder calls */
+static void test_builder_misuse(
+	char const * const test_name,
+	unsigned const flags,
+	int const step
+	)
+{
+	struct json_parse_options const opts = { .jopt_flags = flags };
+	json_builder_t * bd;
+	json_document_t * doc;
+	int err = 0;
+
+	json_builder_new(&opts, &bd);
+	switch (step) {
+	case 0:         // array root
+		err = json_builder_begin_array(bd);
+		break;
+	case 1:         // value without a key
+		json_builder_begin_object(bd);
+		err = json_builder_int(bd, 1);
+		break;
+	case 2:         // key in an array
+		json_builder_begin_object(bd);
+		json_builder_key(bd, "a", 1);
+		json_builder_begin_array(bd);
+		err = json_builder_key(bd, "b", 1);
+		break;
+	case 3:         // not a number
+		json_builder_begin_object(bd);
+		json_builder_key(bd, "a", 1);
+		err = json_builder_double(bd, 0.0 / 0.0);
+		break;
+	case 4:         // duplicate key, rejected if sorted
+		json_builder_begin_object(bd);
+		json_builder_key(bd, "a", 1);
+		json_builder_int(bd, 1);
+		json_builder_key(bd, "A", 1);
+		json_builder_int(bd, 2);
+		err = json_builder_end(bd);
+		break;
+	case 5:         // unfinished
+		json_builder_begin_object(bd);
+		break;
+	case 6:         // string without text
+		json_builder_begin_object(bd);
+		json_builder_key(bd, "a", 1);
+		err = json_builder_string(bd, NULL, 1);
+		break;
+	case 7:         // key with a NUL
+		json_builder_begin_object(bd);
+		err = json_builder_key(bd, "a\0b", 3);
+		break;
+	case 8:         // string with a NUL
+		json_builder_begin_object(bd);
+		json_builder_key(bd, "a", 1);
+		err = json_builder_string(bd, "x\0y", 3);
+		break;
+	}
+	if (err == 0)
+		err = json_builder_finish(bd, &doc);
+	else if (json_builder_end(bd) != err)
+		printf("%s: error not sticky\n", test_name);
+
+	if (err)
+		printf("%s: error: %s\n", test_name, strerror(err));
+	else {
+		printf("%s: ok\n", test_name);
+		json_dump(doc, stdout);
+		json_free(doc);
+	}
+	json_builder_free(bd);
+}
+
+/* JSON Patch, then single edits */
+static void test_patch(
+	char const * const test_name,
+	unsigned const flags,
+	char const * const test_doc,
+	char const * const test_patch
+	)
+{
+	struct json_parse_options const opts = { .jopt_flags = flags };
+	json_document_t * doc;
+	json_document_t * patch;
+	char * data = strdup(test_doc);
+	char * str;
+	size_t len;
+	int err;
+
+	if ((err = json_parse_data_opts(data, strlen(data), &opts, &doc))) {
+		printf("%s: error: %s\n", test_name, strerror(err));
+		free(data);
+		return;
+	}
+	if ((err = json_parse_string(test_patch, &patch)))
+		printf("%s: error: %s\n", test_name, strerror(err));
+	else {
+		err = json_patch_apply(doc,
+			json_get_array(json_doc_object(patch), "patch"));
+		json_write_alloc(json_doc_object(doc), 0, NULL, &str, &len);
+		printf("%s: %s: %s\n", test_name,
+		       err ? strerror(err) : "ok", str);
+		free(str);
+		json_free(patch);
+	}
+	if (err) {
+		json_free(doc);
+		free(data);
+		return;
+	}
+
+	/* and each edit on its own */
+	struct json_value const one = {
+		.jval_type     = JSON_VAL_LITERAL,
+		.jval_lit_type = JSON_LIT_INT,
+		.jval_int      = 1,
+	};
+	struct json_value const half = {
+		.jval_type     = JSON_VAL_LITERAL,
+		.jval_lit_type = JSON_LIT_DOUBLE,
+		.jval_double   = 0.5,
+	};
+	struct json_value const text = {
+		.jval_type     = JSON_VAL_LITERAL,
+		.jval_lit_type = JSON_LIT_STRING,
+	};
+	printf("%s: insert %s", test_name,
+	       strerror(json_doc_insert(doc, "/new", &one)));
+	printf(", insert %s", strerror(json_doc_insert(doc, "/half", &half)));
+	printf(", insert %s", strerror(json_doc_insert(doc, "/text", &text)));
+	printf(", set %s", strerror(json_doc_set(doc, "/missing", &one)));
+	printf(", move %s", strerror(json_doc_move(doc, "/new", "/new/x")));
+	printf(", remove %s\n", strerror(json_doc_remove(doc, "/a")));
+	json_write_alloc(json_doc_object(doc), 0, NULL, &str, &len);
+	printf("%s: %s, half %s\n", test_name, str,
+	       json_get_literal(json_doc_object(doc), "half"));
+	free(str);
+	json_free(doc);
+	free(data);
+}
+
+/* Allocator with a cap on the memory in use */
+struct capped {
+	size_t used;        // bytes in use
+	size_t cap;
+	unsigned calls;     // allocations
+};
+
+static void * capped_realloc(void * const ctx, void * const p, size_t const size)
+{
+	struct capped * const cp = ctx;
+	size_t const old = p ? ((size_t *) p)[-1] : 0;
+	size_t * q;
+
+	if (cp->used - old + size > cp->cap)
+		return NULL;
+	if ((q = realloc(p ? (size_t *) p - 1 : NULL, sizeof(*q) + size)) == NULL)
+		return NULL;
+	cp->used += size - old;
+	cp->calls++;
+	*q = size;
+	return q + 1;
+}
+
+static void * capped_malloc(void * const ctx, size_t const size)
+{
+	return capped_realloc(ctx, NULL, size);
+}
+
+static void capped_free(void * const ctx, void * const p)
+{
+	struct capped * const cp = ctx;
+
+	cp->used -= ((size_t *) p)[-1];
+	free((size_t *) p - 1);
+}
+
+static void test_allocator(
+	char const * const test_name,
+	char const * const test_doc,
+	size_t const cap
+	)
+{
+	struct capped cp = { .cap = cap };
+	struct json_allocator const alloc = {
+		capped_malloc, capped_realloc, capped_free, &cp,
+	};
+	struct json_parse_options opts = { .jopt_allocator = &alloc };
+	size_t const len = strlen(test_doc);
+	char * const buf = strdup(test_doc);
+	json_document_t * doc;
+	json_intern_t * in = NULL;
+	json_path_t * path = NULL;
+	json_validator_t * v = NULL;
+	json_reader_t * rd;
+	struct json_read ev;
+	uint64_t * vec;
+	unsigned n = 0;
+	int err;
+
+	/* an intern table, a compiled path and a compiled schema */
+	struct json_schema const schema[] = {
+		JSON_REQUIRE_U64V("x", &vec, &n),
+	};
+	if (   (err = json_intern_new_alloc(0, &alloc, &in)) == 0
+	    && (err = json_path_compile_alloc("y/z", in, &alloc, &path)) == 0)
+		err = json_schema_compile_alloc(schema, 1, &alloc, &v);
+	opts.jopt_intern = in;
+	size_t const setup = cp.used;
+
+	/* a document, and vectors out of it */
+	if (err == 0 && (err = json_parse_data_opts(buf, len, &opts, &doc)) == 0) {
+		struct json_array const * const arr =
+			json_get_array(json_doc_object(doc), "x");
+		if ((err = json_get_array_of_uint64_alloc(arr, &alloc,
+							  &vec, &n)) == 0)
+			capped_free(&cp, vec);
+		if (   err == 0
+		    && json_get_value_at(json_doc_object(doc), path) == NULL)
+			err = ENOENT;
+		if (   err == 0
+		    && (err = json_validate_compiled(json_doc_object(doc), v,
+						     NULL, 0)) == 0)
+			capped_free(&cp, vec);
+		json_free(doc);
+	}
+	json_validator_free(v);
+	json_path_free(path);
+	opts.jopt_intern = NULL;
+	json_intern_free(in);
+
+	/* a reader */
+	if (err == 0 && (err = json_reader_new_data(buf, len, &opts, &rd)) == 0) {
+		while ((err = json_reader_next(rd, &ev)) == 0
+		       && ev.jrd_type != JSON_READ_END)
+			;
+		json_reader_free(rd);
+	}
+
+	if (err)
+		printf("%s: error: %s, %zu bytes left\n", test_name, strerror(err),
+		       cp.used);
+	else
+		printf("%s: ok: %u values, %s, setup %s, %zu bytes left\n",
+		       test_name, n, cp.calls ? "allocated" : "not allocated",
+		       setup ? "allocated" : "not allocated", cp.used);
+	free(buf);
+}
+
+/* Read a document, skipping the values of the given key, into a string */
+static int read_events(
+	json_reader_t * const rd,
+	char const * const skip,
+	FILE * const f
+	)
+{
+	struct json_read ev;
+	int err;
+
+	for (;;) {
+		if ((err = json_reader_next(rd, &ev)))
+			return err;
+		switch (ev.jrd_type) {
+		case JSON_READ_END:
+			return 0;
+		case JSON_READ_OBJECT_BEGIN: fputs(" {", f); break;
+		case JSON_READ_OBJECT_END:   fputs(" }", f); break;
+		case JSON_READ_ARRAY_BEGIN:  fputs(" [", f); break;
+		case JSON_READ_ARRAY_END:    fputs(" ]", f); break;
+		case JSON_READ_VALUE:
+			fprintf(f, " %s", ev.jrd_val.jval_lit);
+			break;
+		case JSON_READ_KEY:
+			fprintf(f, " %s:", ev.jrd_key);
+			if (strcmp(ev.jrd_key, skip))
+				break;
+			if ((err = json_reader_skip(rd)))
+				return err;
+			fputs(" (skipped)", f);
+			break;
+		}
+	}
+}
+
+static int reader_run(
+	char * const buf,
+	size_t const len,
+	FILE * const in,
+	FILE * const out,
+	void * const arg
+	)
+{
+	json_reader_t * rd;
+	int err = in ? json_reader_new(in, NULL, &rd)
+		     : json_reader_new_data(buf, len, NULL, &rd);
+
+	if (err == 0) {
+		err = read_events(rd, arg, out);
+		json_reader_free(rd);
+	}
+	return err;
+}
+
+static void test_reader(
+	char const * const test_name,
+	char const * const test_doc,
+	char const * const skip
+	)
+{
+	char * out;
+	size_t outlen;
+	bool same;
+	int const err = run_both(test_doc, reader_run, (void *) skip,
+				 &out, &outlen, &same);
+
+	/* long outputs are summed up */
+	printf("%s: %s:%s%s%s\n", test_name, same ? "same" : "differ",
+	       outlen < 200 ? out : " ...",
+	       err ? " error: " : "", err ? strerror(err) : "");
+	free(out);
+}
+
+/* A document with a large value to skip, spanning many index windows */
+static void test_reader_large(
+	char const * const test_name,
+	unsigned const n
+	)
+{
+	static char const item[] =
+		"{ \"s\": \"]}[{ \\\" \\\\\", \"t\": [ 1, 2.5, true, {} ] },\n";
+	size_t const size = 64 + (sizeof(item) + 80) * (size_t) n;
+	char * const buf = malloc(size);
+	size_t len = 0;
+
+	len += sprintf(buf + len, "{ first: 1, debug: [");
+	for (unsigned i = 0; i < n; i++) {
+		len += sprintf(buf + len, "%s", item);
+		/* long strings, some straddling window boundaries */
+		if (i % 500 == 0) {
+			buf[len++] = '"';
+			for (unsigned j = 0; j < 70; j++)
+				buf[len++] = j % 7 ? 'x' : '{';
+			len += sprintf(buf + len, "\",\n");
+		}
+	}
+	len += sprintf(buf + len, "0 ], last: 2 }");
+
+	test_reader(test_name, buf, "debug");
+	free(buf);
+}
+
+static void test_typed(
+	char const * const test_name,
+	char const * const test_doc
+	)
+{
+	static char const * const types[] = {
+		[JSON_LIT_STRING] = "string",
+		[JSON_LIT_INT]    = "int",
+		[JSON_LIT_UINT]   = "uint",
+		[JSON_LIT_DOUBLE] = "double",
+		[JSON_LIT_BOOL]   = "bool",
+		[JSON_LIT_NULL]   = "null",
+	};
+	json_document_t * doc;
+	int err;
+
+	if ((err = json_parse_string(test_doc, &doc))) {
+		printf("%s: error: %s\n", test_name, strerror(err));
+		return;
+	}
+
+	printf("%s: ok\n", test_name);
+	struct json_object const * const obj = json_doc_object(doc);
+	for (unsigned i = 0; i < obj->jobj_length; i++) {
+		char const * const key = obj->jobj_tuples[i].jtup_key;
+		struct json_value const * const val =
+			&obj->jobj_tuples[i].jtup_val;
+		int64_t i64;
+		uint64_t u64;
+		double d;
+		bool b;
+		int ei, eu, ed, eb;
+
+		printf("  %s: %s", key, val->jval_type == JSON_VAL_LITERAL
+			? types[val->jval_lit_type] : "container");
+		if ((ei = json_get_int64(obj, key, &i64)))
+			printf(" int64=<%s>", strerror(ei));
+		else
+			printf(" int64=%lld", (long long) i64);
+		if ((eu = json_get_uint64(obj, key, &u64)))
+			printf(" uint64=<%s>", strerror(eu));
+		else
+			printf(" uint64=%llu", (unsigned long long) u64);
+		if ((ed = json_get_double(obj, key, &d)))
+			printf(" double=<%s>", strerror(ed));
+		else
+			printf(" double=%g", d);
+		if ((eb = json_get_bool(obj, key, &b)))
+			printf(" bool=<%s>\n", strerror(eb));
+		else
+			printf(" bool=%s\n", b ? "true" : "false");
+	}
+	json_free(doc);
+}
+
+static void test_float(
+	char const * const test_name,
+	unsigned const n
+	)
+{
+	static char const * const fixed[] = {
+		"0", "-0", "1e-400", "1e400", "-1e400", "1e23", ".5", "5.",
+		"4.9406564584124654e-324", "2.4703282292062327e-324",
+		"2.4703282292062328e-324", "2.2250738585072011e-308",
+		"1.7976931348623157e308", "1.7976931348623159e308",
+		"9007199254740993", "9007199254740993.000000000000000000001",
+		"123456789012345678901234567890e-10",
+	};
+	uint64_t x = 88172645463325252ull;
+	unsigned mismatches = 0;
+	char buf[1200];
+
+	/* compare with strtod(), bit for bit */
+#define CHECK(s) \
+	do { \
+		double const a = strtod((s), NULL); \
+		double b; \
+		int const err = json_str2double((s), strlen(s), &b); \
+		if ((err && !isinf(a)) || memcmp(&a, &b, sizeof(a))) \
+			printf("%s: mismatch: %s\n", test_name, (s)); \
+		mismatches += (err && !isinf(a)) || memcmp(&a, &b, sizeof(a)); \
+	} while (0)
+
+	for (unsigned i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++)
+		CHECK(fixed[i]);
+
+	for (unsigned i = 0; i < n; i++) {
+		double d;
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		memcpy(&d, &x, sizeof(d));
+		if (!isfinite(d))
+			continue;
+		/* shortest and longer representations */
+		snprintf(buf, sizeof(buf), "%.*g", 1 + (int) (x % 17), d);
+		CHECK(buf);
+		snprintf(buf, sizeof(buf), "%.17e", d);
+		CHECK(buf);
+		snprintf(buf, sizeof(buf), "%.25e", d);
+		CHECK(buf);
+		/* exactly halfway to the next double */
+#if LDBL_MANT_DIG >= 64
+		long double const mid =
+			((long double) d + nextafter(d, INFINITY)) / 2;
+		snprintf(buf, sizeof(buf), "%.1100Le", mid);
+		CHECK(buf);
+#endif
+		/* integers and fixed notation */
+		snprintf(buf, sizeof(buf), "%llu",
+			 (unsigned long long) (x >> (x % 64)));
+		CHECK(buf);
+		snprintf(buf, sizeof(buf), "%f", d);
+		CHECK(buf);
+	}
+#undef CHECK
+
+	/* syntax errors */
+	static char const * const bad[] = {
+		"", ".", "-", "e5", "1e", "1e+", "1x", " 1", "inf", "nan", "0x10",
+	};
+	for (unsigned i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		double d;
+		if (json_str2double(bad[i], strlen(bad[i]), &d) != EINVAL)
+			printf("%s: accepted: \"%s\"\n", test_name, bad[i]);
+	}
+
+	printf("%s: %s\n", test_name, mismatches ? "mismatch" : "ok");
+}
 
 int
 main()
@@ -81,14 +1519,27 @@ main()
 	test("0c348644", "{ \"hello world\": \"foo bar\" }");
 	test("a8013767", "{ \"hello world\": \"foo \\\"bar\" }");
 	test("2f40cb81", "{ \"hello world\": \"foo\nbar\" }"); // bad
+	test("e2a39c07", "{ \"a\\/b\": \"\\u0041\\u00e9\\u20ac\\ud83d\\ude00\" }");
+	test("0f6b2d4e", "{ x: \"\\q\" }"); // bad
+	test("61d8e0b3", "{ x: \"\\u12\" }"); // bad
+	test("b7c41a95", "{ x: \"\\u0000\" }"); // bad
+	test("38ad5f10", "{ x: \"\\ud83d\" }"); // bad
+	test("c90e4f27", "{ x: \"\\ude00\" }"); // bad
+	test("d0b5a8e1", "{ x: \"0123456789abcdef0123456789abcdef\\\\0123456789abcdef\\\"\" }");
+	test("7e2c914a", "{ x: \"0123456789abcdef0123456789\tabcdef\" }"); // bad
+	test("1a9f60dc", "{ x: \"0123456789abcdef0123456789\x7f\" }"); // bad
+	test("bb47e3f8", "{ x: \"0123456789abcdef0123456789\xc3\xa9\" }"); // bad
 	test("64b2f1cb", "{ \"hello world\": \"foo"); // bad
 	test("379df015", "{ \"hello world\": \""); // bad
 
 	/* large tokens */
 	test("83cb7be2", "{ foo: \"012345678901234567890123456789012345678901234567890123456789012\" }");
 	test("aa922bf2", "{ foo: a12345678901234567890123456789012345678901234567890123456789012 }");
-	test("a54f32db", "{ foo: \"0123456789012345678901234567890123456789012345678901234567890123\" }"); // bad
-	test("35c8fc21", "{ foo: a123456789012345678901234567890123456789012345678901234567890123 }"); // bad
+	test("a54f32db", "{ foo: \"0123456789012345678901234567890123456789012345678901234567890123\" }");
+	test("35c8fc21", "{ foo: a123456789012345678901234567890123456789012345678901234567890123 }");
+
+	test_long("7c0a4e19", 100);
+	test_long("3e95b6d2", 100000);
 
 	/* numbers */
 	test("3aaf8a94", "{ x: 0 }");
@@ -122,5 +1573,227 @@ main()
 	test("76c526a0", "{ x: [ {}, {}, {}] }");
 	test("76c526a0", "{ x: [ {}, [], {}, [], {} ] }");
 
+	/* in situ */
+	test_insitu("4b8e21c6", "{foo:a,bar:[1,{x:1,y:2.5},3,4]}");
+	test_insitu("d5073fa2", "{ \"hello world\": \"foo \\\"bar\\\"\\u00e9\", v: [] }");
+	test_insitu("1c6a9e8d", "{ foo: \"0123456789012345678901234567890123456789012345678901234567890123456789\" }");
+	test_insitu("a7e3f520", "{x:1"); // bad
+	test_insitu("6f92c3bd", "{x:0.}"); // bad
+
+	/* large documents */
+	test_large("9d3f0c44", 10000, 0);
+	test_large("e1b7a25f", 10000, JSON_PARSE_HUGEPAGES);
+	test_large("58c2e9a0", 10000, JSON_PARSE_INSITU);
+	test_large("07ae5d93", 1000000, 0);
+	test_large("f3c81b6e", 1000000, JSON_PARSE_HUGEPAGES);
+
+	/* indentation */
+	test_pretty("a4c7e092", 10, 3);
+	test_pretty("5b1f8d36", 1000, 70);
+	test_pretty("e80d2c5b", 100, 3000);
+
+	/* nesting depth */
+	test_deep("2c9e70f1", 511, 0);
+	test_deep("b5a4d38e", 512, 0); // bad
+	test_deep("6d01ce27", 100000, 100001);
+	test_deep("8e3f5b02", 100000, 1000); // bad
+
+	/* key lookup */
+	test_wide("6a0c3e9b", 4);
+	test_wide("d9b27f14", 15);
+	test_wide("41e8a7c0", 1000);
+	test_wide("f05c6d2b", 100000);
+
+	/* paths */
+#define PATHDOC "{ a: { b: [ 10, { c: x }, [ 20, 21 ] ] }, 3: three, e: [] }"
+	test_path("e2a9c471", PATHDOC, "a/b/0");
+	test_path("e2a9c471", PATHDOC, "A/B/1/C");
+	test_path("e2a9c471", PATHDOC, "a/b/2/1");
+	test_path("e2a9c471", PATHDOC, "a/b/2");
+	test_path("e2a9c471", PATHDOC, "a/b/3");
+	test_path("e2a9c471", PATHDOC, "a/b/01");
+	test_path("e2a9c471", PATHDOC, "a/b/x");
+	test_path("e2a9c471", PATHDOC, "a/b/0/c");
+	test_path("e2a9c471", PATHDOC, "a/b/99999999999999999999");
+	test_path("e2a9c471", PATHDOC, "3");
+	test_path("e2a9c471", PATHDOC, "e/0");
+	test_path("e2a9c471", PATHDOC, "a//b"); // bad
+	test_path("e2a9c471", PATHDOC, "a/"); // bad
+	test_path("e2a9c471", PATHDOC, ""); // bad
+#undef PATHDOC
+
+	/* interning */
+	test_intern("9b4e0a17", 0);
+	test_intern("35c8f2d0", 2);
+
+	/* sorted keys */
+	test_sorted("c3e81f5a", "{ b: 1, a: 2, C: { y: 3, X: 4 }, "
+		    "Aa: 5, e: [ 1, { q: 6, p: 7 } ], d: {} }");
+	test_sorted("7f2a0b96", "{}");
+	test_sorted("49d6e0c3", "{ a: 1, b: { x: 1, y: 2, x: 3 } }"); // bad
+	test_sorted("e05b7c21", "{ Key: 1, kEY: 2 }"); // bad
+
+	/* schemas */
+	test_schema("5d0e7b31", "{ name: a, ver: 2, mode: TCP, port: 80, "
+		    "ratio: 0.5, sub: { x: 1, tags: [ p, q ] } }");
+	test_schema("a61f2c08", "{ mode: udp, Name: b, sub: { X: 2, "
+		    "tags: [] }, port: x, name: c }");
+	test_schema("0c94d7e5", "{ name: a, mode: tcp, ratio: 1, "
+		    "sub: { x: 1, tags: [] } }"); // bad
+	test_schema("e7b3a150", "{ name: a, mode: udp, sub: { y: 1 } }"); // bad
+	test_schema("3f8c61d2", "{ name: a, mode: udp, sub: [] }"); // bad
+	test_schema("96a2e04b", "{ name: a, ver: x, mode: udp }"); // bad
+	test_schema("28d5f9c7", "{ name: a, mode: udp, sub: "
+		    "{ x: 1, tags: [ {} ] } }"); // bad
+
+	/* events */
+	test_events("7b2d0e94", "{ a: 1, \"b\\u00e9\": [ -2.5, true, null, "
+		    "{}, [ x, \"y z\" ] ], c: { d: 18446744073709551615 } }");
+	test_events("e9a40c13", "{ a: [ 1, 2 }"); // bad
+	test_events("1f6c83a7", "{ a: 1, stop: 2, c: 3 }"); // bad
+
+	/* push parser */
+	test_push("4e1b9a73", "{ a: 1, \"b\\\"\\u00e9\\\\\": [ -2.5e-3, true, null, "
+		  "{}, [ xyz, \"y, z}\" ] ], c: { d: 18446744073709551615 },"
+		  "\"\": \"\\ud83d\\ude00\" }");
+	test_push("b7305c1e", "{ a: [ 1, 2 }"); // bad
+	test_push("b7305c1e", "{ a: 1, b: \"x\\q\" }"); // bad
+	test_push("b7305c1e", "{ a: 1, b: [ 2 ] "); // bad
+	test_push("b7305c1e", "{ a: 1 } trailing");
+
+	/* records */
+	test_records("2c7e9f05", "{ id: 1, a: [ x ] }\n{ id: 2 }\n\n"
+		     "{\"id\":3,\"b\":{}}{ id: 4 } { id: 5 }\n");
+	test_records("6b3d18a4", "");
+	test_records("f0a95e27", "{ id: 1 }\n{ id: 2, }\n{ id: 3 }\n"); // bad
+
+	/* parallel records */
+	test_parallel("8e41c07b", 40000, UINT_MAX, true);
+	test_parallel("8e41c07b", 40000, UINT_MAX, false);
+	test_parallel("d3962af0", 40000, 31000, true); // bad
+	test_parallel("d3962af0", 40000, 31000, false); // bad
+
+	/* document reuse */
+	json_document_t * reused;
+	json_doc_new(NULL, &reused);
+	test_reuse("a60d4c19", reused, "{ a: [ 1, 2 ], b: { c: d } }", false);
+	test_reuse("a60d4c19", reused, "{ x: y }", true);
+	test_reuse("a60d4c19", reused, "{ x: [ y }", false); // bad
+	test_reuse("a60d4c19", reused, "{ a: [ 1, 2 ], b: { c: d } }", false);
+	json_doc_reset(reused);
+	printf("a60d4c19: reset: %s\n", json_doc_object(reused) ? "no" : "empty");
+	json_doc_trim(reused);
+	test_reuse("a60d4c19", reused, "{ x: y }", true);
+	json_free(reused);
+
+	/* allocator */
+	test_allocator("c81e5f37", "{ x: [ 1, 2, 3 ], y: { z: \"w\" } }",
+		       SIZE_MAX);
+	test_allocator("c81e5f37", "{ x: [ 1, 2, 3 ], y: { z: \"w\" } }",
+		       1024); // bad
+
+	/* output */
+	test_write("5e1a9c3d", "{ a: [ 1, -2.5e3, true, null, {}, [] ], "
+		   "b: { \"c d\": \"e\\\"f\\\\g\" }, "
+		   "\"k\\ty\": \"line\\nbreak\\ttab\\u0001ctl\\r\\b\\f\", "
+		   "l: \"a fairly long string, with a quote \\\" in the middle "
+		   "and \\u00e9 past it\" }");
+	test_write("5e1a9c3d", "{}");
+	test_write_empty("5e1a9c3d"); // bad
+	test_write("0b7d3e91", "{ a: [ 0.1, 2.50, 1e21, 1e22, 1e-6, 1e-7, -0, -0.0, "
+		   "5e-324, 1.7976931348623157e308, 9007199254740993, "
+		   "18446744073709551615, -9223372036854775808, 1e400 ] }");
+
+	/* builder */
+	test_builder("4c8a2f6e", 0);
+	test_builder("4c8a2f6e", JSON_PARSE_SORTKEYS);
+	for (int i = 0; i < 9; i++)
+		test_builder_misuse("b5e03d72", 0, i); // bad, except 4
+	test_builder_misuse("b5e03d72", JSON_PARSE_SORTKEYS, 4); // bad
+
+	/* editing */
+#define PATCHDOC "{ a: [ 1, 2, 3 ], b: { c: \"d\" }, \"e/f\": 0, " \
+		 "w: { k0: 0, k1: 1, k2: 2, k3: 3, k4: 4, k5: 5, k6: 6, " \
+		 "k7: 7, k8: 8, k9: 9, k10: 10, k11: 11, k12: 12, k13: 13, " \
+		 "k14: 14 } }"
+	test_patch("7d2c4e19", 0, PATCHDOC, "{ patch: [ "
+		   "{ op: \"add\", path: \"/a/1\", value: [ \"x\", {} ] }, "
+		   "{ op: \"add\", path: \"/a/-\", value: 4.0 }, "
+		   "{ op: \"remove\", path: \"/a/0\" }, "
+		   "{ op: \"replace\", path: \"/B/c\", value: null }, "
+		   "{ op: \"add\", path: \"/b/a\", value: true }, "
+		   "{ op: \"move\", from: \"/e~1f\", path: \"/b/m\" }, "
+		   "{ op: \"copy\", from: \"/a/0\", path: \"/a/0/1/y\" }, "
+		   "{ op: \"add\", path: \"/w/k15\", value: 15 }, "
+		   "{ op: \"add\", path: \"/w/k16\", value: 16 }, "
+		   "{ op: \"remove\", path: \"/w/k3\" }, "
+		   "{ op: \"move\", from: \"/w\", path: \"/W\" }, "
+		   "{ op: \"test\", path: \"/w/K16\", value: 16.0 }, "
+		   "{ op: \"test\", path: \"/a\", "
+		   "value: [ [ \"x\", { y: [ \"x\", {} ] } ], 2, 3, 4 ] } ] }");
+	test_patch("7d2c4e19", JSON_PARSE_SORTKEYS, PATCHDOC, "{ patch: [ "
+		   "{ op: \"add\", path: \"/b/a\", value: true }, "
+		   "{ op: \"add\", path: \"/b/z\", value: false }, "
+		   "{ op: \"move\", from: \"/b/c\", path: \"/0\" }, "
+		   "{ op: \"remove\", path: \"/w\" }, "
+		   "{ op: \"test\", path: \"/b\", "
+		   "value: { z: false, A: true } } ] }");
+	test_patch("7d2c4e19", 0, PATCHDOC, "{ patch: [ " // bad, rolled back
+		   "{ op: \"add\", path: \"/a/0\", value: 0 }, "
+		   "{ op: \"remove\", path: \"/w/k0\" }, "
+		   "{ op: \"add\", path: \"\", value: {} }, "
+		   "{ op: \"test\", path: \"\", value: [] } ] }");
+	test_patch("7d2c4e19", 0, PATCHDOC, "{ patch: [ " // bad
+		   "{ op: \"add\", path: \"/a/01\", value: 0 } ] }");
+	test_patch("7d2c4e19", 0, PATCHDOC, "{ patch: [ " // bad
+		   "{ op: \"move\", from: \"/b\", path: \"/b/c/d\" } ] }");
+	test_patch("7d2c4e19", 0, PATCHDOC, "{ patch: [ " // bad
+		   "{ op: \"frob\", path: \"/b\" } ] }");
+	test_patch("7d2c4e19", 0, PATCHDOC, "{ patch: [ " // bad
+		   "{ op: \"move\", from: \"/x\", path: \"/x\" } ] }");
+	test_patch("7d2c4e19", 0, PATCHDOC, "{ patch: [ " // bad
+		   "{ op: \"add\", path: \"/n\", value: 9007199254740993 }, "
+		   "{ op: \"test\", path: \"/n\", "
+		   "value: 9007199254740992.0 } ] }");
+
+	/* pull reader */
+#define READERDOC "{ a: 1, debug: { x: [ \"]\", { y: \"\\\"}\" } ] }, " \
+		  "b: [ 2, { debug: [] }, debug ], debug: 3, c: {} }"
+	test_reader("d8e15c72", READERDOC, "");
+	test_reader("d8e15c72", READERDOC, "debug");
+	test_reader("d8e15c72", READERDOC, "a");
+	test_reader("5a07f3e1", "{ a: 1, debug: [ 1, { ] }", "debug"); // bad
+	test_reader("5a07f3e1", "{ a: 1, debug: \"x", "debug"); // bad
+	test_reader("5a07f3e1", "{ a: 1, debug: [1,2] ", "debug"); // bad
+	test_reader_large("96c2d4b0", 10);
+	test_reader_large("96c2d4b0", 20000);
+#undef READERDOC
+
+	/* typed literals */
+	test_typed("3f6b1c2e", "{ i: 42, z: 0, m: 9223372036854775807, "
+		   "u: 9223372036854775808, x: 18446744073709551615, "
+		   "b: 18446744073709551616, d: 2.5, t: true, f: false, "
+		   "n: null, s: \"42\", q: \"true\", w: truth, o: {} }");
+
+	test_typed("8d2e4f17", "{ a: -1, b: -0, c: -9223372036854775808, "
+		   "d: -9223372036854775809, e: 1e3, f: -2.5E-3, g: 0e0, "
+		   "h: 1.5e+2 }");
+
+	/* numbers */
+	test("c7a1e350", "{ x: [ -1, -0.5, 1e10, 1E-10, 0.5e+3, -0e0 ] }");
+	test("1b9f6d2a", "{ x: - }"); // bad
+	test("5e8c0f43", "{ x: -a }"); // bad
+	test("92d4b7e1", "{ x: 1e }"); // bad
+	test("0f3a6c58", "{ x: 1e+ }"); // bad
+	test("e4b12d97", "{ x: 1.e5 }"); // bad
+	test("7c05a9f3", "{ x: -01 }"); // bad
+	test("3a8f1e62", "{ x: 1-1 }"); // bad
+	test_float("b06e3d1f", 100000);
+
+	/* stream input */
+	test_stream("5e0d7a31", "{ foo: \"bar\", x: [ 1, 2.5, { y: z } ] }");
+	test_stream("c4e8b019", "{ x: 1"); // bad
+	test_stream("9a1f2e6d", "{ x: 0.b }"); // bad
+
 	return 0;
 }